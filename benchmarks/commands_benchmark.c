@@ -0,0 +1,645 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "commands.h"
+#include "commands_multiplexer.h"
+#include "command_clear.h"
+#include "command_help.h"
+#include "command_services.h"
+
+// Host benchmark of the engine: keystroke replay and script throughput, Enter-to-execute
+// latency, dispatch cost by registry size, service scheduling jitter and the
+// output of multiplexed sessions. The configuration comes from the compile
+// definitions of this executable, see CMakeLists.txt.
+
+////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////
+
+#define BENCHMARK_BUFFER_SIZE 64
+#define BENCHMARK_LINES 20000
+#define BENCHMARK_HOST_WORK 200
+#define BENCHMARK_MAX_REGISTRY 250
+#define BENCHMARK_TRANSPORT_LOOPS 4
+#define BENCHMARK_TRANSPORT_ROOM 16
+#define BENCHMARK_SCRIPT_LINES 256
+
+////////////////////////////////////////////////////////////////////////////////
+// Measurement
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned long ReadCycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return (unsigned long)__builtin_ia32_rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)now.tv_sec * 1000000000UL + (unsigned long)now.tv_nsec;
+#endif
+}
+
+static double ReadSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int CompareCycles(const void* a, const void* b)
+{
+    unsigned long left = *(const unsigned long*)a;
+    unsigned long right = *(const unsigned long*)b;
+
+    return left < right ? -1 : left > right;
+}
+
+static void WritePercentiles(const char* label, unsigned long* samples, unsigned count)
+{
+    unsigned long total = 0;
+    unsigned i = 0;
+
+    qsort(samples, count, sizeof(unsigned long), CompareCycles);
+
+    for(i = 0; i < count; ++i)
+    {
+        total += samples[i];
+    }
+
+    printf("%-44s mean %8lu  p50 %8lu  p99 %8lu  max %8lu cycles\n",
+        label, total / count, samples[count / 2], samples[count * 99 / 100], samples[count - 1]);
+}
+
+// Stands for the rest of the firmware main loop between two DoTasks calls
+static void HostLoopWork(void)
+{
+    volatile unsigned i = 0;
+    for(i = 0; i < BENCHMARK_HOST_WORK; ++i)
+    {
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Commands
+////////////////////////////////////////////////////////////////////////////////
+
+static __thread unsigned long outputBytes;
+static __thread unsigned long executedCount;
+static __thread unsigned long executedAt;
+static __thread long lastSum;
+
+static void DiscardOutput(const char* string)
+{
+    while (*string != '\0')
+    {
+        ++outputBytes;
+        ++string;
+    }
+}
+
+static byte* AddCommandImplementation(const char* args[], struct CommandEngine* commandEngine)
+{
+    executedAt = ReadCycles();
+    ++executedCount;
+
+    lastSum = 0;
+    while (*args != NULL)
+    {
+        lastSum += atol(*args);
+        ++args;
+    }
+
+    return (byte*)NULL;
+}
+
+static const Command AddCommand = {
+    "add",
+    AddCommandImplementation,
+    "Adds its arguments."
+};
+
+static const Command* registeredCommands[] = {
+    &HelpCommand,
+    &ClearCommand,
+    &ServicesCommand,
+    &AddCommand,
+    NULL
+};
+
+static Application* noApplications[] = { NULL };
+static Service* noServices[] = { NULL };
+
+static void StartEngine(CommandEngine* commandEngine)
+{
+    // The first keystroke only shows the intro
+    AddKeystroke(commandEngine, ' ');
+    while (DoTasksUntilIdle(commandEngine, 64))
+    {
+    }
+}
+
+static void TypeLine(CommandEngine* commandEngine, const char* line)
+{
+    unsigned short length = strlen(line);
+    unsigned short written = 0;
+
+    while (written < length)
+    {
+        written += AddKeystrokes(commandEngine, (const byte*)line + written, length - written);
+        while (DoTasksUntilIdle(commandEngine, 64))
+        {
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Benchmarks
+////////////////////////////////////////////////////////////////////////////////
+
+// Like a terminal user, the next line is only sent once the previous one ran.
+// Without an input buffer, keystrokes sent earlier would be mixed into the
+// line being parsed.
+static byte ReadyForKeystroke(unsigned long sent, unsigned long lineLength)
+{
+    return sent % lineLength != 0 || executedCount == sent / lineLength;
+}
+
+// One keystroke per DoTasks call, as a UART would deliver them
+static void BenchmarkThroughput(unsigned lines)
+{
+    static const char line[] = "add 12 30\r";
+    byte buffer[BENCHMARK_BUFFER_SIZE];
+    CommandEngine commandEngine = { buffer, sizeof(buffer), registeredCommands, noApplications, noServices,
+        DiscardOutput, DiscardOutput, "> ", NULL, NULL, ReadCycles };
+
+    StartEngine(&commandEngine);
+    executedCount = 0;
+
+    unsigned long keystrokes = (unsigned long)lines * (sizeof(line) - 1);
+    unsigned long sent = 0;
+    unsigned long calls = 0;
+    double start = ReadSeconds();
+
+    while (executedCount < lines)
+    {
+        if (sent < keystrokes && ReadyForKeystroke(sent, sizeof(line) - 1))
+        {
+            AddKeystroke(&commandEngine, line[sent % (sizeof(line) - 1)]);
+            ++sent;
+        }
+
+        DoTasks(&commandEngine);
+        ++calls;
+    }
+
+    double elapsed = ReadSeconds() - start;
+
+    printf("%-44s %lu DoTasks calls, %.0f calls/s, %.0f keystrokes/s, %.0f lines/s\n",
+        "throughput (1 keystroke per call)", calls, calls / elapsed, keystrokes / elapsed, lines / elapsed);
+}
+
+#ifdef COMMANDS_ENABLE_SCRIPTS
+// The same lines as a script, given in one buffer at a time
+static void BenchmarkScript(unsigned lines)
+{
+    static const char line[] = "add 12 30\n";
+    byte buffer[BENCHMARK_BUFFER_SIZE];
+    CommandEngine commandEngine = { buffer, sizeof(buffer), registeredCommands, noApplications, noServices,
+        DiscardOutput, DiscardOutput, "> ", NULL, NULL, ReadCycles };
+    char script[BENCHMARK_SCRIPT_LINES * (sizeof(line) - 1)];
+    unsigned sent = 0;
+    unsigned i = 0;
+
+    for(i = 0; i < BENCHMARK_SCRIPT_LINES; ++i)
+    {
+        memcpy(&script[i * (sizeof(line) - 1)], line, sizeof(line) - 1);
+    }
+
+    StartEngine(&commandEngine);
+    executedCount = 0;
+
+    double start = ReadSeconds();
+
+    StartScript(&commandEngine, 0, NULL, 0);
+    for(sent = 0; sent < lines; sent += BENCHMARK_SCRIPT_LINES)
+    {
+        unsigned count = lines - sent < BENCHMARK_SCRIPT_LINES ? lines - sent : BENCHMARK_SCRIPT_LINES;
+        unsigned short length = count * (sizeof(line) - 1);
+        unsigned short taken = 0;
+
+        while (taken < length)
+        {
+            taken += RunScript(&commandEngine, &script[taken], length - taken);
+            if (taken < length)
+            {
+                DoTasks(&commandEngine);
+            }
+        }
+    }
+
+    ScriptSummary summary;
+    while (!RunScript(&commandEngine, NULL, 0) || IsScriptLineRunning(&commandEngine))
+    {
+        DoTasks(&commandEngine);
+    }
+
+    EndScript(&commandEngine, &summary);
+
+    double elapsed = ReadSeconds() - start;
+
+    printf("%-44s %.0f lines/s, %u failed, %lu executed\n",
+        "script", lines / elapsed, summary.Failed, executedCount);
+}
+#endif
+
+// Cycles from the Enter keystroke to the command running, with some host
+// loop work between each call into the engine
+static void BenchmarkLatency(const char* label, byte untilIdle, unsigned lines)
+{
+    byte buffer[BENCHMARK_BUFFER_SIZE];
+    CommandEngine commandEngine = { buffer, sizeof(buffer), registeredCommands, noApplications, noServices,
+        DiscardOutput, DiscardOutput, "> ", NULL, NULL, ReadCycles };
+    unsigned long * samples = malloc(lines * sizeof(unsigned long));
+    unsigned long hostLoops = 0;
+    unsigned i = 0;
+
+    StartEngine(&commandEngine);
+
+    for(i = 0; i < lines; ++i)
+    {
+        TypeLine(&commandEngine, "add 1 2");
+
+        unsigned long executed = executedCount;
+        unsigned long start = ReadCycles();
+        AddKeystroke(&commandEngine, RETURN_ASCII);
+
+        while (executedCount == executed)
+        {
+            HostLoopWork();
+
+            if (untilIdle)
+            {
+                DoTasksUntilIdle(&commandEngine, 16);
+            }
+            else
+            {
+                DoTasks(&commandEngine);
+            }
+
+            ++hostLoops;
+        }
+
+        samples[i] = executedAt - start;
+
+        while (DoTasksUntilIdle(&commandEngine, 64))
+        {
+        }
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s (%.1f host loops)", label, (double)hostLoops / lines);
+    WritePercentiles(name, samples, lines);
+    free(samples);
+}
+
+// With the index compiled in, runs again with it switched off on the same
+// engine, so that the two lookups are compared within one program
+static void BenchmarkDispatch(unsigned short registrySize, byte indexed, unsigned lines)
+{
+    static char names[BENCHMARK_MAX_REGISTRY][8];
+    static Command commands[BENCHMARK_MAX_REGISTRY];
+    static const Command* registry[BENCHMARK_MAX_REGISTRY + 1];
+    unsigned short i = 0;
+
+    for(i = 0; i < registrySize; ++i)
+    {
+        snprintf(names[i], sizeof(names[i]), "c%03u", i);
+        commands[i].Name = names[i];
+        commands[i].Execute = AddCommandImplementation;
+        commands[i].HelpText = NULL;
+        registry[i] = &commands[i];
+    }
+
+    registry[registrySize] = NULL;
+
+    byte buffer[BENCHMARK_BUFFER_SIZE];
+    CommandEngine commandEngine = { buffer, sizeof(buffer), registry, noApplications, noServices,
+        DiscardOutput, DiscardOutput, "> ", NULL, NULL, ReadCycles };
+    unsigned long * samples = malloc(lines * sizeof(unsigned long));
+    unsigned seed = 1;
+    unsigned line = 0;
+
+    StartEngine(&commandEngine);
+#if COMMANDS_DISPATCH_INDEX_SIZE > 0
+    commandEngine.DispatchIndexReady = commandEngine.DispatchIndexReady && indexed;
+#endif
+
+    for(line = 0; line < lines; ++line)
+    {
+        seed = seed * 1103515245 + 12345;
+        TypeLine(&commandEngine, names[(seed >> 16) % registrySize]);
+
+        unsigned long start = ReadCycles();
+        AddKeystroke(&commandEngine, RETURN_ASCII);
+        while (DoTasksUntilIdle(&commandEngine, 64))
+        {
+        }
+
+        samples[line] = executedAt - start;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "dispatch (%u commands, %s)", registrySize,
+#if COMMANDS_DISPATCH_INDEX_SIZE > 0
+        commandEngine.DispatchIndexReady ? "index" : "scan");
+#else
+        "scan");
+#endif
+    WritePercentiles(name, samples, lines);
+    free(samples);
+}
+
+typedef struct ControlServiceData {
+    unsigned long LastRun;
+    unsigned long Runs;
+    unsigned long * Intervals;
+    unsigned long Capacity;
+} ControlServiceData;
+
+static byte ControlServiceRun(byte state, void* data, struct CommandEngine* commandEngine)
+{
+    ControlServiceData * control = data;
+    unsigned long now = ReadCycles();
+
+    if (control->LastRun != 0 && control->Runs < control->Capacity)
+    {
+        control->Intervals[control->Runs] = now - control->LastRun;
+        ++control->Runs;
+    }
+
+    control->LastRun = now;
+    return 1;
+}
+
+static byte LoggingServiceRun(byte state, void* data, struct CommandEngine* commandEngine)
+{
+    volatile unsigned i = 0;
+    for(i = 0; i < 5 * BENCHMARK_HOST_WORK; ++i)
+    {
+    }
+
+    return 1;
+}
+
+// Interval between runs of a control service while logging services and a
+// stream of commands compete for the loop
+static void BenchmarkJitter(unsigned lines)
+{
+    ControlServiceData control = { 0, 0, NULL, 0 };
+    control.Capacity = lines * 16;
+    control.Intervals = malloc(control.Capacity * sizeof(unsigned long));
+
+    Service controlService = { "control", NULL, ControlServiceRun, Starting, &control, 1, 2 };
+    Service logging1 = { "logging1", NULL, LoggingServiceRun, Starting, NULL, 0, 1 };
+    Service logging2 = { "logging2", NULL, LoggingServiceRun, Starting, NULL, 0, 1 };
+    Service logging3 = { "logging3", NULL, LoggingServiceRun, Starting, NULL, 0, 1 };
+    Service* services[] = { &logging1, &logging2, &controlService, &logging3, NULL };
+
+    byte buffer[BENCHMARK_BUFFER_SIZE];
+    CommandEngine commandEngine = { buffer, sizeof(buffer), registeredCommands, noApplications, services,
+        DiscardOutput, DiscardOutput, "> ", NULL, NULL, ReadCycles };
+    static const char line[] = "add 12 30\r";
+    unsigned long keystrokes = (unsigned long)lines * (sizeof(line) - 1);
+    unsigned long sent = 0;
+
+    StartEngine(&commandEngine);
+    executedCount = 0;
+    control.Runs = 0;
+    control.LastRun = 0;
+
+    while (sent < keystrokes && control.Runs < control.Capacity)
+    {
+        if (ReadyForKeystroke(sent, sizeof(line) - 1))
+        {
+            AddKeystroke(&commandEngine, line[sent % (sizeof(line) - 1)]);
+            ++sent;
+        }
+
+        HostLoopWork();
+        DoTasks(&commandEngine);
+    }
+
+    WritePercentiles("control service interval", control.Intervals, control.Runs);
+    free(control.Intervals);
+}
+
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+
+static __thread unsigned short transportRoom;
+
+// Accepts only what fits, like a UART transmit FIFO
+static unsigned short SlowTransportWrite(const char* data, unsigned short length)
+{
+    if (length > transportRoom)
+    {
+        length = transportRoom;
+    }
+
+    transportRoom -= length;
+    outputBytes += length;
+
+    return length;
+}
+
+// Interval between runs of a control service while the output of a stream
+// of commands drains through a transport that takes one character every
+// BENCHMARK_TRANSPORT_LOOPS loops
+static void BenchmarkBackpressure(unsigned lines)
+{
+    ControlServiceData control = { 0, 0, NULL, 0 };
+    control.Capacity = lines * 64;
+    control.Intervals = malloc(control.Capacity * sizeof(unsigned long));
+
+    Service controlService = { "control", NULL, ControlServiceRun, Starting, &control, 1, 1 };
+    Service* services[] = { &controlService, NULL };
+
+    byte buffer[BENCHMARK_BUFFER_SIZE];
+    CommandEngine commandEngine = { buffer, sizeof(buffer), registeredCommands, noApplications, services,
+        NULL, NULL, "> ", NULL, NULL, ReadCycles, SlowTransportWrite };
+    static const char line[] = "add 12 30\r";
+    unsigned long keystrokes = (unsigned long)lines * (sizeof(line) - 1);
+    unsigned long sent = 0;
+    unsigned long loops = 0;
+
+    transportRoom = 0xFFFF;
+    StartEngine(&commandEngine);
+    executedCount = 0;
+    outputBytes = 0;
+    control.Runs = 0;
+    control.LastRun = 0;
+
+    while (sent < keystrokes && control.Runs < control.Capacity)
+    {
+        if (ReadyForKeystroke(sent, sizeof(line) - 1))
+        {
+            AddKeystroke(&commandEngine, line[sent % (sizeof(line) - 1)]);
+            ++sent;
+        }
+
+        if (++loops % BENCHMARK_TRANSPORT_LOOPS == 0)
+        {
+            transportRoom = 1;
+            NotifyOutputReady(&commandEngine);
+        }
+
+        DoTasks(&commandEngine);
+    }
+
+    WritePercentiles("control service interval, slow transport", control.Intervals, control.Runs);
+    printf("%-44s %lu lines, %lu characters sent, %u stalls\n", "slow transport",
+        executedCount, outputBytes, commandEngine.OutputStalls);
+    free(control.Intervals);
+}
+
+static unsigned long channelBytes[2];
+static byte transportChannel;
+static byte transportEscaped;
+
+// Demultiplexes what a transport of BENCHMARK_TRANSPORT_ROOM characters
+// per loop accepts, counting the characters of each session
+static unsigned short MultiplexedTransportWrite(const char* data, unsigned short length)
+{
+    unsigned short i = 0;
+
+    if (length > transportRoom)
+    {
+        length = transportRoom;
+    }
+
+    transportRoom -= length;
+
+    for(i = 0; i < length; ++i)
+    {
+        if (transportEscaped)
+        {
+            transportEscaped = 0;
+            if (data[i] != MULTIPLEXER_ESCAPE)
+            {
+                transportChannel = data[i] - '0';
+                continue;
+            }
+        }
+        else if (data[i] == MULTIPLEXER_ESCAPE)
+        {
+            transportEscaped = 1;
+            continue;
+        }
+
+        ++channelBytes[transportChannel & 1];
+    }
+
+    return length;
+}
+
+// Share of the transport taken by a session listing help and a session
+// running short commands, both typing their next line as soon as they can
+static void BenchmarkMultiplexer(unsigned lines)
+{
+    byte buffers[2][BENCHMARK_BUFFER_SIZE];
+    CommandEngine first = { buffers[0], sizeof(buffers[0]), registeredCommands, noApplications, noServices,
+        NULL, NULL, "> ", NULL, NULL, ReadCycles };
+    CommandEngine second = { buffers[1], sizeof(buffers[1]), registeredCommands, noApplications, noServices,
+        NULL, NULL, "> ", NULL, NULL, ReadCycles };
+    CommandEngine* sessions[] = { &first, &second, NULL };
+    CommandMultiplexer multiplexer = { sessions, MultiplexedTransportWrite };
+    static const char* sessionLines[2] = { "\x10" "0help\r", "\x10" "1add 12 30\r" };
+    unsigned long loops = (unsigned long)lines * 16;
+    unsigned long i = 0;
+
+    channelBytes[0] = 0;
+    channelBytes[1] = 0;
+
+    for(i = 0; i < loops; ++i)
+    {
+        byte session = i & 1;
+        const char* line = sessionLines[session];
+
+        if (sessions[session]->ParsedCommand == NULL && sessions[session]->OutputCount == 0)
+        {
+            while (*line != '\0')
+            {
+                AddMultiplexedKeystroke(&multiplexer, (unsigned char)*line);
+                ++line;
+            }
+        }
+
+        transportRoom = BENCHMARK_TRANSPORT_ROOM;
+        DoMultiplexerTasks(&multiplexer);
+    }
+
+    printf("%-44s %lu / %lu characters, %.1f%% to the help session\n", "multiplexed sessions",
+        channelBytes[0], channelBytes[1], 100.0 * channelBytes[0] / (channelBytes[0] + channelBytes[1]));
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char* argv[])
+{
+    static const unsigned short registrySizes[] = { 8, 32, 128, BENCHMARK_MAX_REGISTRY };
+    unsigned lines = BENCHMARK_LINES;
+    unsigned i = 0;
+
+    if (argc > 1)
+    {
+        lines = (unsigned)(BENCHMARK_LINES * atof(argv[1]));
+        if (lines < 100)
+        {
+            lines = 100;
+        }
+    }
+
+    printf("\nConfiguration: dispatch index %d, input buffer %d, output buffer %d, %s scheduler, "
+           "timer wheel %d, statistics %s, CommandEngine %u bytes\n",
+        COMMANDS_DISPATCH_INDEX_SIZE, COMMANDS_INPUT_BUFFER_SIZE, COMMANDS_OUTPUT_BUFFER_SIZE,
+#ifdef COMMANDS_PRIORITY_SCHEDULER
+        "priority",
+#else
+        "round-robin",
+#endif
+        COMMANDS_TIMER_WHEEL_SLOTS,
+#ifdef COMMANDS_ENABLE_STATISTICS
+        "on",
+#else
+        "off",
+#endif
+        (unsigned)sizeof(CommandEngine));
+
+    BenchmarkThroughput(lines);
+#ifdef COMMANDS_ENABLE_SCRIPTS
+    BenchmarkScript(lines);
+#endif
+    BenchmarkLatency("latency, DoTasks", 0, lines);
+    BenchmarkLatency("latency, DoTasksUntilIdle", 1, lines);
+    for(i = 0; i < sizeof(registrySizes) / sizeof(registrySizes[0]); ++i)
+    {
+        BenchmarkDispatch(registrySizes[i], 1, lines);
+#if COMMANDS_DISPATCH_INDEX_SIZE > 0
+        BenchmarkDispatch(registrySizes[i], 0, lines);
+#endif
+    }
+    BenchmarkJitter(lines / 10);
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+    BenchmarkBackpressure(lines / 10);
+    BenchmarkMultiplexer(lines / 10);
+#endif
+
+    return 0;
+}
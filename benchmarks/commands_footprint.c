@@ -0,0 +1,15 @@
+#include <stdio.h>
+
+#include "commands.h"
+
+// Prints the RAM an integrator allocates for one engine in this configuration.
+// The ROM and static data of the engine objects are reported by 'size'.
+int main(void)
+{
+    printf("\nMAX_CMD_ARGS=%d COMMANDS_BUFFER_SIZE=%d\n", MAX_CMD_ARGS, COMMANDS_BUFFER_SIZE);
+    printf("\tCommandEngine:  %u bytes\n", (unsigned)sizeof(CommandEngine));
+    printf("\tCommand buffer: %u bytes\n", (unsigned)COMMANDS_BUFFER_SIZE);
+    printf("\tEngine RAM:     %u bytes\n", (unsigned)(sizeof(CommandEngine) + COMMANDS_BUFFER_SIZE));
+
+    return 0;
+}
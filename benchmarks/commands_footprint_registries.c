@@ -0,0 +1,79 @@
+#include <stdio.h>
+
+#include "commands.h"
+#include "commands_registry.h"
+
+// Sample registries of 16 commands, 4 applications and 8 services, generated
+// by COMMANDS_REGISTRY. Built once as is and once with
+// COMMANDS_CONST_REGISTRIES, 'size' of the two programs gives what the const
+// registries save.
+
+#define FOOTPRINT_COMMANDS(X) \
+    X(command0) X(command1) X(command2) X(command3) \
+    X(command4) X(command5) X(command6) X(command7) \
+    X(command8) X(command9) X(command10) X(command11) \
+    X(command12) X(command13) X(command14) X(command15)
+
+#define FOOTPRINT_APPLICATIONS(X) \
+    X(application0) X(application1) X(application2) X(application3)
+
+#define FOOTPRINT_SERVICES(X) \
+    X(service0) X(service1) X(service2) X(service3) \
+    X(service4) X(service5) X(service6) X(service7)
+
+static byte* FootprintExecute(const char* args[], struct CommandEngine* commandEngine)
+{
+    return NULL;
+}
+
+static byte FootprintRun(byte state, struct CommandEngine* commandEngine)
+{
+    return state;
+}
+
+static byte FootprintServiceRun(byte state, void* data, struct CommandEngine* commandEngine)
+{
+    return state;
+}
+
+#define FOOTPRINT_COMMAND(name) \
+    static const Command name = { #name, FootprintExecute, NULL };
+#define FOOTPRINT_APPLICATION(name) \
+    static ApplicationEntry name = { #name, NULL, NULL, NULL, NULL, FootprintRun, 0 };
+#define FOOTPRINT_SERVICE(name) \
+    static ServiceEntry name = { #name, NULL, FootprintServiceRun, Starting, NULL, 0, 1 };
+
+FOOTPRINT_COMMANDS(FOOTPRINT_COMMAND)
+FOOTPRINT_APPLICATIONS(FOOTPRINT_APPLICATION)
+FOOTPRINT_SERVICES(FOOTPRINT_SERVICE)
+
+COMMANDS_REGISTRY(footprint, FOOTPRINT_COMMANDS, FOOTPRINT_APPLICATIONS, FOOTPRINT_SERVICES)
+
+static void DiscardOutput(const char* string)
+{
+}
+
+static byte buffer[COMMANDS_BUFFER_SIZE];
+static CommandEngine commandEngine = { .CommandBuffer = buffer, .CommandBufferSize = sizeof(buffer),
+    COMMANDS_REGISTRY_ENGINE(footprint), .WriteToOutput = DiscardOutput };
+
+int main(void)
+{
+    byte i = 0;
+
+    // Runs the services once, so that nothing is left out of the program
+    for(i = 0; i < 4; ++i)
+    {
+        DoTasks(&commandEngine);
+    }
+
+#ifdef COMMANDS_CONST_REGISTRIES
+    printf("const registries: %d commands, %d applications, %d services\n",
+        footprintCommandCount, footprintApplicationCount, footprintServiceCount);
+#else
+    printf("registries: %d commands, %d applications, %d services\n",
+        footprintCommandCount, footprintApplicationCount, footprintServiceCount);
+#endif
+
+    return 0;
+}
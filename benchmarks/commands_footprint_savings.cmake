@@ -0,0 +1,33 @@
+# Prints what COMMANDS_CONST_REGISTRIES saves, from 'size' of the two builds
+# of commands_footprint_registries.c. Run with -P, given SIZE_TOOL, REGISTRIES
+# and CONST_REGISTRIES.
+
+function(read_size program prefix)
+    execute_process(COMMAND ${SIZE_TOOL} ${program} OUTPUT_VARIABLE output)
+    # Berkeley format: a header line, then text, data and bss
+    string(REGEX MATCH "\n *([0-9]+)[ \t]+([0-9]+)[ \t]+([0-9]+)" line "${output}")
+    set(${prefix}_TEXT ${CMAKE_MATCH_1} PARENT_SCOPE)
+    set(${prefix}_DATA ${CMAKE_MATCH_2} PARENT_SCOPE)
+    set(${prefix}_BSS ${CMAKE_MATCH_3} PARENT_SCOPE)
+endfunction()
+
+read_size(${REGISTRIES} MUTABLE)
+read_size(${CONST_REGISTRIES} CONST)
+
+# RAM holds data and bss, flash holds text and the initial data
+math(EXPR mutableRam "${MUTABLE_DATA} + ${MUTABLE_BSS}")
+math(EXPR constRam "${CONST_DATA} + ${CONST_BSS}")
+math(EXPR ramChange "${constRam} - ${mutableRam}")
+math(EXPR mutableFlash "${MUTABLE_TEXT} + ${MUTABLE_DATA}")
+math(EXPR constFlash "${CONST_TEXT} + ${CONST_DATA}")
+math(EXPR flashChange "${constFlash} - ${mutableFlash}")
+
+foreach(change ramChange flashChange)
+    if(${change} GREATER 0)
+        set(${change} "+${${change}}")
+    endif()
+endforeach()
+
+message("\nRegistries of 16 commands, 4 applications, 8 services")
+message("\tRAM:   ${mutableRam} bytes, ${constRam} bytes const (${ramChange})")
+message("\tFlash: ${mutableFlash} bytes, ${constFlash} bytes const (${flashChange})")
@@ -0,0 +1,138 @@
+#include "commands.h"
+#include "command_filters.h"
+
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+
+// Pieces of a long line are searched as one text: PipeData keeps how much of
+// the text the end of the previous piece matched, and whether the line
+// already matched, so that its later pieces are written as well.
+#define GrepMatched (0x10000UL)
+#define GrepProgress (0xFFFFUL)
+
+static unsigned short Length(const char* text)
+{
+    unsigned short length = 0;
+
+    while (text[length] != NULL)
+    {
+        ++length;
+    }
+
+    return length;
+}
+
+// The piece searched is the carried part of the text followed by the line
+static char SearchedAt(const char* line, const char* text, unsigned short carried, unsigned short position)
+{
+    return position < carried ? text[position] : line[position - carried];
+}
+
+static byte MatchesAt(const char* line, const char* text, unsigned short carried, unsigned short position, unsigned short length)
+{
+    unsigned short i = 0;
+
+    for(i = 0; i < length; ++i)
+    {
+        if (SearchedAt(line, text, carried, position + i) != text[i])
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Returns whether the text is in the line, and sets how much of it the end
+// of the line matches
+static byte Contains(const char* line, const char* text, unsigned short carried, unsigned short* progress)
+{
+    unsigned short textLength = Length(text);
+    unsigned short length = carried + Length(line);
+    unsigned short position = 0;
+    byte found = textLength == 0;
+
+    for(position = 0; !found && position + textLength <= length; ++position)
+    {
+        found = MatchesAt(line, text, carried, position, textLength);
+    }
+
+    if (textLength == 0)
+    {
+        *progress = 0;
+        return found;
+    }
+
+    *progress = textLength - 1 < length ? textLength - 1 : length;
+    while (*progress > 0 && !MatchesAt(line, text, carried, length - *progress, *progress))
+    {
+        --*progress;
+    }
+
+    return found;
+}
+
+#endif
+
+static void GrepFilterLine(const char* line, const char* args[], struct CommandEngine* commandEngine)
+{
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+    const char * text = args[0] != NULL ? args[0] : "";
+    unsigned short progress = 0;
+
+    if (!commandEngine->PipeContinued)
+    {
+        commandEngine->PipeData = 0;
+    }
+
+    // Of a line that is written in pieces, the ones before the match are gone
+    byte matched = Contains(line, text, commandEngine->PipeData & GrepProgress, &progress)
+        || (commandEngine->PipeData & GrepMatched) != 0;
+
+    if (matched)
+    {
+        WriteOutput(commandEngine, line);
+
+        if (!commandEngine->PipeUnterminated)
+        {
+            WriteOutput(commandEngine, CMD_CRLF);
+        }
+    }
+
+    commandEngine->PipeData = (matched ? GrepMatched : 0) | progress;
+#endif
+}
+
+static void CountFilterLine(const char* line, const char* args[], struct CommandEngine* commandEngine)
+{
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+    // Each line once, however many pieces it comes in
+    if (!commandEngine->PipeContinued)
+    {
+        ++commandEngine->PipeData;
+    }
+#endif
+}
+
+static void CountFilterEnd(const char* args[], struct CommandEngine* commandEngine)
+{
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+    char number[NUMBER_BUFFER_SIZE];
+
+    WriteOutput(commandEngine, UnsignedToString(commandEngine->PipeData, number));
+    WriteOutput(commandEngine, CMD_CRLF);
+#endif
+}
+
+const Filter GrepFilter = {
+    "grep",
+    "Writes the lines that contain its argument: command | grep <text>.",
+    GrepFilterLine,
+    NULL
+};
+
+const Filter CountFilter = {
+    "count",
+    "Writes the number of lines, blank ones included: command | count.",
+    CountFilterLine,
+    CountFilterEnd
+};
@@ -0,0 +1,20 @@
+
+#ifndef COMMAND_FILTERS_H
+#define	COMMAND_FILTERS_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Exports
+////////////////////////////////////////////////////////////////////////////////
+extern const struct Filter GrepFilter;
+extern const struct Filter CountFilter;
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* COMMAND_FILTERS_H */
+
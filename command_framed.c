@@ -0,0 +1,20 @@
+
+#include "commands.h"
+#include "command_framed.h"
+
+static byte* FramedCommandImplementation(const char* args[], struct CommandEngine* commandEngine)
+{
+    if (!SetFramedMode(commandEngine, 1))
+    {
+        return (byte*)(CMD_CRLF "Framed mode is not available." CMD_CRLF);
+    }
+
+    // Nothing is written in the terminal format from here on
+    return (byte*)NULL;
+}
+
+const Command FramedCommand = {
+    "framed",
+    FramedCommandImplementation,
+    "Switches the terminal to framed requests and responses."
+};
@@ -0,0 +1,19 @@
+
+#ifndef COMMAND_FRAMED_H
+#define	COMMAND_FRAMED_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Exports
+////////////////////////////////////////////////////////////////////////////////
+extern const struct Command FramedCommand;
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* COMMAND_FRAMED_H */
+
@@ -2,48 +2,95 @@
 #include "commands.h"
 #include "command_help.h"
 
-static byte* HelpCommandImplementation(const char* args[], struct CommandEngine* commandEngine)
+static void WriteHelpEntry(struct CommandEngine* commandEngine, const char* name, const char* helpText)
 {
-    commandEngine->WriteToOutput(CMD_MAKEBOLD CMD_MAKEGREEN CMD_CRLF 
-            CMD_CRLF " (*)" CMD_MAKEWHITE " Available commands in this terminal"
-            CMD_CRLF CMD_CRLF CMD_CLEARATTRIBUTES
-            CMD_MAKEGREEN "Commands:"
-            CMD_CRLF CMD_CLEARATTRIBUTES);
-
-    unsigned short i = 0;
-    for(i = 0; commandEngine->RegisteredCommands[i] != NULL; ++i)
+    const char * description = helpText != NULL
+        ? helpText
+        : "[ No description ]\0";
+
+    WriteOutput(commandEngine, name);
+    WriteOutput(commandEngine, CMD_CRLF "\t");
+    WriteOutput(commandEngine, description);
+    WriteOutput(commandEngine, CMD_CRLF);
+}
+
+// The cursor keeps the section and the position in it, so that no step
+// counts the registries again. The position of the applications and the
+// filters starts after their header.
+#define HelpSection (0xC000U)
+#define HelpCommands (0x0000U)
+#define HelpApplications (0x4000U)
+#define HelpFilters (0x8000U)
+
+// Writes one entry per step: the header, the commands, the applications
+// header, the applications, the filters header, the filters and the footer
+static unsigned short HelpCommandImplementation(unsigned short cursor, const char* args[], struct CommandEngine* commandEngine)
+{
+    if (cursor == CommandStarting)
     {
-        const char * description = commandEngine->RegisteredCommands[i]->HelpText != NULL
-            ? commandEngine->RegisteredCommands[i]->HelpText
-            : "[ No description ]\0";
-
-        commandEngine->WriteToOutput(commandEngine->RegisteredCommands[i]->Name);
-        commandEngine->WriteToOutput(CMD_CRLF "\t");
-        commandEngine->WriteToOutput(description);
-        commandEngine->WriteToOutput(CMD_CRLF);
+        WriteOutput(commandEngine, CMD_MAKEBOLD CMD_MAKEGREEN CMD_CRLF 
+                CMD_CRLF " (*)" CMD_MAKEWHITE " Available commands in this terminal"
+                CMD_CRLF CMD_CRLF CMD_CLEARATTRIBUTES
+                CMD_MAKEGREEN "Commands:"
+                CMD_CRLF CMD_CLEARATTRIBUTES);
+
+        return cursor + 1;
     }
 
-    commandEngine->WriteToOutput(CMD_MAKEGREEN CMD_CRLF "Applications:" CMD_CRLF CMD_CLEARATTRIBUTES);
+    unsigned short section = cursor & HelpSection;
+    unsigned short i = cursor & ~HelpSection;
+    if (section == HelpCommands)
+    {
+        if (i - 1 < commandEngine->CommandCount)
+        {
+            WriteHelpEntry(commandEngine,
+                commandEngine->RegisteredCommands[i - 1]->Name,
+                commandEngine->RegisteredCommands[i - 1]->HelpText);
+
+            return cursor + 1;
+        }
+
+        WriteOutput(commandEngine, CMD_MAKEGREEN CMD_CRLF "Applications:" CMD_CRLF CMD_CLEARATTRIBUTES);
 
-    for(i = 0; commandEngine->RegisteredApplications[i] != NULL; ++i)
+        return HelpApplications;
+    }
+
+    if (section == HelpApplications)
+    {
+        if (commandEngine->RegisteredApplications[i] != NULL)
+        {
+            WriteHelpEntry(commandEngine,
+                commandEngine->RegisteredApplications[i]->Name,
+                commandEngine->RegisteredApplications[i]->HelpText);
+
+            return cursor + 1;
+        }
+
+        if (commandEngine->RegisteredFilters != NULL && commandEngine->RegisteredFilters[0] != NULL)
+        {
+            WriteOutput(commandEngine, CMD_MAKEGREEN CMD_CRLF "Filters:" CMD_CRLF CMD_CLEARATTRIBUTES);
+
+            return HelpFilters;
+        }
+    }
+    else if (commandEngine->RegisteredFilters[i] != NULL)
     {
-        const char * description = commandEngine->RegisteredApplications[i]->HelpText != NULL
-            ? commandEngine->RegisteredApplications[i]->HelpText
-            : "[ No description ]\0";
-
-        commandEngine->WriteToOutput(commandEngine->RegisteredApplications[i]->Name);
-        commandEngine->WriteToOutput(CMD_CRLF "\t");
-        commandEngine->WriteToOutput(description);
-        commandEngine->WriteToOutput(CMD_CRLF);
+        WriteHelpEntry(commandEngine,
+            commandEngine->RegisteredFilters[i]->Name,
+            commandEngine->RegisteredFilters[i]->HelpText);
+
+        return cursor + 1;
     }
 
-    commandEngine->WriteToOutput(CMD_CRLF);
+    WriteOutput(commandEngine, CMD_CRLF);
 
-    return (byte*)NULL;
+    return CommandCompleted;
 }
 
 const Command HelpCommand = {
     "help",
+    NULL,
+    "Provides descriptions for commands.",
     HelpCommandImplementation,
-    "Provides descriptions for commands."
+    1
 };
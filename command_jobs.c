@@ -0,0 +1,104 @@
+
+#include "commands.h"
+#include "command_jobs.h"
+
+// Reads a job number, 0 if the argument is missing or not a number
+static byte ParseJob(const char* args[])
+{
+    const char * digit = args[0];
+    unsigned short job = 0;
+
+    if (digit == NULL || *digit == NULL)
+    {
+        return 0;
+    }
+
+    for(; *digit != NULL; ++digit)
+    {
+        if (*digit < '0' || *digit > '9' || job > 0xFF)
+        {
+            return 0;
+        }
+
+        job = job * 10 + (*digit - '0');
+    }
+
+    return job <= 0xFF ? (byte)job : 0;
+}
+
+static byte* JobsCommandImplementation(const char* args[], struct CommandEngine* commandEngine)
+{
+#if COMMANDS_MAX_JOBS > 0
+    char number[NUMBER_BUFFER_SIZE];
+    byte running = 0;
+    byte job = 0;
+
+    WriteOutput(commandEngine, CMD_CRLF);
+
+    for(job = 1; job <= COMMANDS_MAX_JOBS; ++job)
+    {
+        ApplicationEntry * application = GetJob(commandEngine, job);
+        if (application != NULL)
+        {
+            WriteOutput(commandEngine, "[");
+            WriteOutput(commandEngine, UnsignedToString(job, number));
+            WriteOutput(commandEngine, "] " CMD_MAKEGREEN "Running" CMD_CLEARATTRIBUTES "\t");
+            WriteOutput(commandEngine, application->Name);
+            WriteOutput(commandEngine, CMD_CRLF);
+            ++running;
+        }
+    }
+
+    if (running == 0)
+    {
+        WriteOutput(commandEngine, "No jobs are running." CMD_CRLF);
+    }
+
+    return (byte*)NULL;
+#else
+    return (byte*)(CMD_CRLF "Jobs are not enabled." CMD_CRLF);
+#endif
+}
+
+static byte* ForegroundCommandImplementation(const char* args[], struct CommandEngine* commandEngine)
+{
+    if (!ForegroundJob(commandEngine, ParseJob(args)))
+    {
+        return (byte*)(CMD_CRLF "No such job." CMD_CRLF);
+    }
+
+    return (byte*)(CMD_CRLF);
+}
+
+static byte* KillCommandImplementation(const char* args[], struct CommandEngine* commandEngine)
+{
+    byte job = ParseJob(args);
+
+    if (GetJob(commandEngine, job) == NULL)
+    {
+        return (byte*)(CMD_CRLF "No such job." CMD_CRLF);
+    }
+
+    WriteOutput(commandEngine, CMD_CRLF);
+    KillJob(commandEngine, job);
+
+    return (byte*)NULL;
+}
+
+const Command JobsCommand = {
+    "jobs",
+    JobsCommandImplementation,
+    "Lists the applications running in the background."
+};
+
+const Command ForegroundCommand = {
+    "fg",
+    ForegroundCommandImplementation,
+    "Brings a job to the foreground: fg <job>. Ctrl-Z sends it back."
+};
+
+const Command KillCommand = {
+    "kill",
+    KillCommandImplementation,
+    "Closes a job: kill <job>."
+};
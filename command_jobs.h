@@ -0,0 +1,21 @@
+
+#ifndef COMMAND_JOBS_H
+#define	COMMAND_JOBS_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Exports
+////////////////////////////////////////////////////////////////////////////////
+extern const struct Command JobsCommand;
+extern const struct Command ForegroundCommand;
+extern const struct Command KillCommand;
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* COMMAND_JOBS_H */
+
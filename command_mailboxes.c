@@ -0,0 +1,48 @@
+
+#include "commands.h"
+#include "command_mailboxes.h"
+
+// Writes the header on the first step, then one mailbox per step
+static unsigned short MailboxesCommandImplementation(unsigned short cursor, const char* args[], struct CommandEngine* commandEngine)
+{
+    if (cursor == CommandStarting)
+    {
+        WriteOutput(commandEngine, CMD_MAKEBOLD CMD_MAKEGREEN CMD_CRLF 
+                CMD_CRLF " (*)" CMD_MAKEWHITE " Mailboxes in this terminal"
+                CMD_CRLF CMD_CRLF CMD_CLEARATTRIBUTES);
+
+        return cursor + 1;
+    }
+
+    unsigned short i = cursor - 1;
+    if (commandEngine->RegisteredMailboxes == NULL || commandEngine->RegisteredMailboxes[i] == NULL)
+    {
+        WriteOutput(commandEngine, CMD_CRLF);
+
+        return CommandCompleted;
+    }
+
+    Mailbox * mailbox = commandEngine->RegisteredMailboxes[i];
+    char number[NUMBER_BUFFER_SIZE];
+
+    WriteOutput(commandEngine, mailbox->Name);
+    WriteOutput(commandEngine, "\t\t[");
+    WriteOutput(commandEngine, UnsignedToString(GetMailboxDepth(mailbox), number));
+    WriteOutput(commandEngine, "/");
+    WriteOutput(commandEngine, UnsignedToString(mailbox->Capacity, number));
+    WriteOutput(commandEngine, "] high ");
+    WriteOutput(commandEngine, UnsignedToString(mailbox->HighWater, number));
+    WriteOutput(commandEngine, ", dropped ");
+    WriteOutput(commandEngine, mailbox->Dropped != 0 ? CMD_MAKERED : "");
+    WriteOutput(commandEngine, UnsignedToString(mailbox->Dropped, number));
+    WriteOutput(commandEngine, CMD_CLEARATTRIBUTES CMD_CRLF);
+
+    return cursor + 1;
+}
+
+const Command MailboxesCommand = {
+    "mailboxes",
+    NULL,
+    "Provides the depth, high-water mark and dropped messages of each mailbox.",
+    MailboxesCommandImplementation
+};
@@ -0,0 +1,19 @@
+
+#ifndef COMMAND_MAILBOXES_H
+#define	COMMAND_MAILBOXES_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Exports
+////////////////////////////////////////////////////////////////////////////////
+extern const struct Command MailboxesCommand;
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* COMMAND_MAILBOXES_H */
+
@@ -2,47 +2,73 @@
 #include "commands.h"
 #include "command_services.h"
 
-static byte* ServicesCommandImplementation(const char* args[], struct CommandEngine* commandEngine)
+// Writes the header on the first step, then one service per step
+static unsigned short ServicesCommandImplementation(unsigned short cursor, const char* args[], struct CommandEngine* commandEngine)
 {
-    commandEngine->WriteToOutput(CMD_MAKEBOLD CMD_MAKEGREEN CMD_CRLF 
-            CMD_CRLF " (*)" CMD_MAKEWHITE " Available services in this terminal"
-            CMD_CRLF CMD_CRLF CMD_CLEARATTRIBUTES);
+    if (cursor == CommandStarting)
+    {
+        WriteOutput(commandEngine, CMD_MAKEBOLD CMD_MAKEGREEN CMD_CRLF 
+                CMD_CRLF " (*)" CMD_MAKEWHITE " Available services in this terminal"
+                CMD_CRLF CMD_CRLF CMD_CLEARATTRIBUTES);
+
+        return cursor + 1;
+    }
 
-    unsigned short i = 0;
-    for(i = 0; commandEngine->RegisteredServices[i] != NULL; ++i)
+    unsigned short i = cursor - 1;
+    if (commandEngine->RegisteredServices[i] == NULL)
     {
-        const char * description = commandEngine->RegisteredServices[i]->HelpText != NULL
-            ? commandEngine->RegisteredServices[i]->HelpText
-            : "[ No description ]\0";
-
-        const char * state = commandEngine->RegisteredServices[i]->State == Stopped
-            ? CMD_MAKERED "Stopped" CMD_CLEARATTRIBUTES
-            : commandEngine->RegisteredServices[i]->State == Starting
-                ? CMD_MAKEGREEN "Starting" CMD_CLEARATTRIBUTES
-                : CMD_MAKEGREEN "Running" CMD_CLEARATTRIBUTES;
-
-        char hex[3];
-        hex[0] = TO_HEX(((commandEngine->RegisteredServices[i]->State & 0xF0) >> 4));
-        hex[1] = TO_HEX(((commandEngine->RegisteredServices[i]->State & 0x0F)));
-        hex[2] = '\0';
-
-        commandEngine->WriteToOutput(commandEngine->RegisteredServices[i]->Name);
-        commandEngine->WriteToOutput("\t\t[");
-        commandEngine->WriteToOutput(state);
-        commandEngine->WriteToOutput("] / [0x");
-        commandEngine->WriteToOutput(hex);
-        commandEngine->WriteToOutput("]" CMD_CRLF "\t");
-        commandEngine->WriteToOutput(description);
-        commandEngine->WriteToOutput(CMD_CRLF);
+        WriteOutput(commandEngine, CMD_CRLF);
+
+        return CommandCompleted;
     }
 
-    commandEngine->WriteToOutput(CMD_CRLF);
+    const char * description = commandEngine->RegisteredServices[i]->HelpText != NULL
+        ? commandEngine->RegisteredServices[i]->HelpText
+        : "[ No description ]\0";
+
+    byte serviceState = GetServiceState(commandEngine, i);
+    const char * state = serviceState == Stopped
+        ? CMD_MAKERED "Stopped" CMD_CLEARATTRIBUTES
+        : IsServiceSleeping(commandEngine, i)
+            ? CMD_MAKEYELLOW "Sleeping" CMD_CLEARATTRIBUTES
+            : IsServiceWaiting(commandEngine, i)
+                ? CMD_MAKEYELLOW "Waiting" CMD_CLEARATTRIBUTES
+                : serviceState == Starting
+                    ? CMD_MAKEGREEN "Starting" CMD_CLEARATTRIBUTES
+                    : CMD_MAKEGREEN "Running" CMD_CLEARATTRIBUTES;
+
+    char hex[3];
+    hex[0] = TO_HEX(((serviceState & 0xF0) >> 4));
+    hex[1] = TO_HEX(((serviceState & 0x0F)));
+    hex[2] = '\0';
+
+    WriteOutput(commandEngine, commandEngine->RegisteredServices[i]->Name);
+    WriteOutput(commandEngine, "\t\t[");
+    WriteOutput(commandEngine, state);
+    WriteOutput(commandEngine, "] / [0x");
+    WriteOutput(commandEngine, hex);
+    WriteOutput(commandEngine, "]" CMD_CRLF "\t");
+    WriteOutput(commandEngine, description);
+    WriteOutput(commandEngine, CMD_CRLF);
+
+#ifdef COMMANDS_ENABLE_STATISTICS
+    byte verbose = args[0] != NULL
+        && args[0][0] == '-' && args[0][1] == 'v' && args[0][2] == '\0';
+
+    if (verbose && i < COMMANDS_MAX_SERVICES)
+    {
+        WriteOutput(commandEngine, "\t");
+        WriteStatistics(commandEngine, &commandEngine->ServiceStatistics[i]);
+        WriteOutput(commandEngine, CMD_CRLF);
+    }
+#endif
 
-    return (byte*)NULL;
+    return cursor + 1;
 }
 
 const Command ServicesCommand = {
     "services",
-    ServicesCommandImplementation,
-    "Provides details of the background services."
+    NULL,
+    "Provides details of the background services. Use -v for runtime statistics.",
+    ServicesCommandImplementation
 };
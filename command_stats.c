@@ -0,0 +1,73 @@
+#include "commands.h"
+#include "command_stats.h"
+
+// The cursor of the first command, after the header, one per service and
+// the end of the services
+#define StatsCommandsCursor (COMMANDS_MAX_SERVICES + 2)
+
+// Writes the header on the first step, then one service or command per step
+// and the idle time on the last one
+static unsigned short StatsCommandImplementation(unsigned short cursor, const char* args[], struct CommandEngine* commandEngine)
+{
+#ifdef COMMANDS_ENABLE_STATISTICS
+    if (cursor == CommandStarting)
+    {
+        WriteOutput(commandEngine, CMD_MAKEBOLD CMD_MAKEGREEN CMD_CRLF 
+                CMD_CRLF " (*)" CMD_MAKEWHITE " Runtime statistics"
+                CMD_CRLF CMD_CRLF CMD_CLEARATTRIBUTES
+                CMD_MAKEGREEN "Services:"
+                CMD_CRLF CMD_CLEARATTRIBUTES);
+
+        return cursor + 1;
+    }
+
+    if (cursor < StatsCommandsCursor)
+    {
+        unsigned short i = cursor - 1;
+        if (i == COMMANDS_MAX_SERVICES || commandEngine->RegisteredServices[i] == NULL)
+        {
+            WriteOutput(commandEngine, CMD_MAKEGREEN CMD_CRLF "Commands:" CMD_CRLF CMD_CLEARATTRIBUTES);
+
+            return StatsCommandsCursor;
+        }
+
+        WriteOutput(commandEngine, commandEngine->RegisteredServices[i]->Name);
+        WriteOutput(commandEngine, CMD_CRLF "\t");
+        WriteStatistics(commandEngine, &commandEngine->ServiceStatistics[i]);
+        WriteOutput(commandEngine, CMD_CRLF);
+
+        return cursor + 1;
+    }
+
+    unsigned short i = cursor - StatsCommandsCursor;
+    if (i < COMMANDS_MAX_COMMANDS && commandEngine->RegisteredCommands[i] != NULL)
+    {
+        WriteOutput(commandEngine, commandEngine->RegisteredCommands[i]->Name);
+        WriteOutput(commandEngine, CMD_CRLF "\t");
+        WriteStatistics(commandEngine, &commandEngine->CommandStatistics[i]);
+        WriteOutput(commandEngine, CMD_CRLF);
+
+        return cursor + 1;
+    }
+
+    char number[NUMBER_BUFFER_SIZE];
+
+    WriteOutput(commandEngine, CMD_MAKEGREEN CMD_CRLF "Idle:" CMD_CRLF CMD_CLEARATTRIBUTES "\t");
+    WriteStatistics(commandEngine, &commandEngine->IdleStatistics);
+    WriteOutput(commandEngine, CMD_CRLF "\tduty cycle ");
+    WriteOutput(commandEngine, UnsignedToString(GetDutyCycle(commandEngine), number));
+    WriteOutput(commandEngine, "%" CMD_CRLF CMD_CRLF);
+#else
+    WriteOutput(commandEngine, CMD_CRLF "Statistics are not enabled." CMD_CRLF);
+#endif
+
+    return CommandCompleted;
+}
+
+const Command StatsCommand = {
+    "stats",
+    NULL,
+    "Shows runtime statistics of services and commands, and the duty cycle.",
+    StatsCommandImplementation
+};
+
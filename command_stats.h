@@ -0,0 +1,19 @@
+
+#ifndef COMMAND_STATS_H
+#define	COMMAND_STATS_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Exports
+////////////////////////////////////////////////////////////////////////////////
+extern const struct Command StatsCommand;
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* COMMAND_STATS_H */
+
@@ -0,0 +1,92 @@
+
+#include "commands.h"
+#include "command_trace.h"
+
+#if COMMANDS_TRACE_SIZE > 0
+
+#define RecordsPerLine (4)
+
+// Appends the low 32 bits of the time, the event and the data in hex
+static char* FormatRecord(const TraceRecord* record, char* hex)
+{
+    signed char shift = 28;
+
+    for(; shift >= 0; shift -= 4)
+    {
+        *hex++ = TO_HEX((record->Time >> shift) & 0x0F);
+    }
+
+    *hex++ = TO_HEX(record->Event >> 4);
+    *hex++ = TO_HEX(record->Event & 0x0F);
+    *hex++ = TO_HEX(record->Data >> 4);
+    *hex++ = TO_HEX(record->Data & 0x0F);
+
+    return hex;
+}
+
+#endif
+
+// Writes the header on the first step, then RecordsPerLine events per step.
+// The trace is paused meanwhile, so the dump does not overwrite it.
+static unsigned short TraceCommandImplementation(unsigned short cursor, const char* args[], struct CommandEngine* commandEngine)
+{
+#if COMMANDS_TRACE_SIZE > 0
+    char number[NUMBER_BUFFER_SIZE];
+    TraceRecord record;
+
+    if (cursor == CommandStarting)
+    {
+        if (args[0] != NULL && args[0][0] == '-' && args[0][1] == 'c' && args[0][2] == '\0')
+        {
+            ClearTrace(commandEngine);
+            WriteOutput(commandEngine, CMD_CRLF "Trace cleared." CMD_CRLF);
+
+            return CommandCompleted;
+        }
+
+        PauseTrace(commandEngine, 1);
+
+        WriteOutput(commandEngine, CMD_CRLF "TRACE ");
+        WriteOutput(commandEngine, UnsignedToString(commandEngine->TraceCount, number));
+        WriteOutput(commandEngine, CMD_CRLF);
+
+        return cursor + 1;
+    }
+
+    unsigned short index = (cursor - 1) * RecordsPerLine;
+    char line[RecordsPerLine * 12 + sizeof(CMD_CRLF)];
+    char * hex = line;
+    byte i = 0;
+
+    for(i = 0; i < RecordsPerLine && ReadTrace(commandEngine, index + i, &record); ++i)
+    {
+        hex = FormatRecord(&record, hex);
+    }
+
+    if (i == 0)
+    {
+        WriteOutput(commandEngine, "END" CMD_CRLF);
+        PauseTrace(commandEngine, 0);
+
+        return CommandCompleted;
+    }
+
+    *hex++ = '\r';
+    *hex++ = '\n';
+    *hex = NULL;
+    WriteOutput(commandEngine, line);
+
+    return cursor + 1;
+#else
+    WriteOutput(commandEngine, CMD_CRLF "Tracing is not enabled." CMD_CRLF);
+
+    return CommandCompleted;
+#endif
+}
+
+const Command TraceCommand = {
+    "trace",
+    NULL,
+    "Dumps the event trace in hex for tools/commands_trace.c. Use -c to clear it.",
+    TraceCommandImplementation
+};
@@ -0,0 +1,19 @@
+
+#ifndef COMMAND_TRACE_H
+#define	COMMAND_TRACE_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Exports
+////////////////////////////////////////////////////////////////////////////////
+extern const struct Command TraceCommand;
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* COMMAND_TRACE_H */
+
@@ -1,66 +1,138 @@
 #ifndef COMMANDS_C
 #define	COMMANDS_C
 
+#include <limits.h>
 #include <stdbool.h>
 
 #include "commands.h"
 
-////////////////////////////////////////////////////////////////////////////////
-// Imports
-////////////////////////////////////////////////////////////////////////////////
-
-static void strncpy(char * s1, const char * s2, unsigned short size)
-{
-    while (*s2 != '\0' && size > 0)
-    {
-        *s1 = *s2;
-        s1++;
-        s2++;
-        size--;
-    }
-}
-
-static unsigned short strlen(const char * s)
-{
-    int result = 0;
-
-    while (*s != '\0')
-    {
-        result++;
-        s++;
-    }
-
-    return result;
-}
-
-static short strcmp(const char * s1, const char * s2)
-{
-    while (*s1 != '\0' && *s2 != '\0' && *s1 == *s2)
-    {
-        s1++;
-        s2++;
-    }
-
-    return *s1 - *s2;
-}
-
 ////////////////////////////////////////////////////////////////////////////////
 // Private methods declarations
 ////////////////////////////////////////////////////////////////////////////////
 
+#define NoService (0xFF)
+#define JobOutputPieceSize (0x10)
+// Types in ArgumentTypes, with InvalidArgument added when the argument did
+// not parse as that type
+#define UnparsedArgument (0x00)
+#define IntegerArgument (0x01)
+#define HexArgument (0x02)
+#define BooleanArgument (0x03)
+#define InvalidArgument (0x80)
+
+static void InitializeDispatch(CommandEngine* commandEngine);
+static unsigned short FindEntry(CommandEngine* commandEngine, const char* name, unsigned short length);
+#if COMMANDS_COMPLETION_SIZE > 0
+static byte FindPrefix(CommandEngine* commandEngine, const char* prefix, unsigned short length, byte* first);
+static bool IsLineTyped(CommandEngine* commandEngine);
+static void CompleteCommand(CommandEngine* commandEngine);
+#endif
+static bool HasPendingWork(CommandEngine* commandEngine);
+static void ProcessKeystroke(CommandEngine* commandEngine, unsigned char keystroke);
+static void InsertKeystroke(CommandEngine* commandEngine, unsigned char keystroke);
+#if COMMANDS_INPUT_BUFFER_SIZE > 0
+static void ReadKeystrokes(CommandEngine* commandEngine);
+#endif
 static const Command* CheckCommand(struct CommandEngine* commandEngine);
-static void ExecuteCommand(struct CommandEngine* commandEngine, const Command* command);
+static bool ExecuteCommand(struct CommandEngine* commandEngine, const Command* command);
+static void CancelCommand(CommandEngine* commandEngine);
 static void ExecuteApplication(CommandEngine* commandEngine);
 static void ExecuteService(CommandEngine* commandEngine);
-static int StringToArgs(char *pRawString, char *argv[]);
-
-////////////////////////////////////////////////////////////////////////////////
-// Local buffers
-////////////////////////////////////////////////////////////////////////////////
-
-static char characterEchoBuffer[2] = "\0\0";
-static char stringFormatBuffer[COMMANDS_BUFFER_SIZE];
-static char* argv[MAX_CMD_ARGS];
+static void RunService(CommandEngine* commandEngine, byte index);
+static byte* ServiceState(CommandEngine* commandEngine, byte index);
+static byte* ApplicationState(CommandEngine* commandEngine, ApplicationEntry* application, byte job);
+#ifdef COMMANDS_CONST_REGISTRIES
+static void InitializeServiceStates(CommandEngine* commandEngine);
+#endif
+static bool IsConfigurationValid(CommandEngine* commandEngine);
+#ifdef COMMANDS_PRIORITY_SCHEDULER
+static bool IsServiceBlocked(CommandEngine* commandEngine, byte index);
+#endif
+#if defined(COMMANDS_PRIORITY_SCHEDULER) || COMMANDS_TIMER_WHEEL_SLOTS > 0 || defined(COMMANDS_ENABLE_MAILBOXES)
+static byte LowestBit(unsigned long bits);
+#endif
+#if !defined(COMMANDS_PRIORITY_SCHEDULER) && (COMMANDS_TIMER_WHEEL_SLOTS > 0 || defined(COMMANDS_ENABLE_MAILBOXES))
+static byte FindAwakeService(CommandEngine* commandEngine, unsigned short start, unsigned short end);
+#endif
+#if COMMANDS_MAX_JOBS > 0
+static byte GetJobNumber(CommandEngine* commandEngine, ApplicationEntry* application);
+static bool TakeBackgroundToken(CommandEngine* commandEngine);
+static bool StartJob(CommandEngine* commandEngine, ApplicationEntry* application);
+static void ExecuteJob(CommandEngine* commandEngine);
+static void EndJob(CommandEngine* commandEngine, byte job, const char* status);
+static void WriteJobOutput(CommandEngine* commandEngine, const char* string);
+#endif
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+static bool SplitPipe(CommandEngine* commandEngine, const Filter** filter);
+static void StartPipe(CommandEngine* commandEngine, const Filter* filter);
+static void WritePipe(CommandEngine* commandEngine, const char* string);
+static void EndPipe(CommandEngine* commandEngine);
+static const Filter* FindFilter(CommandEngine* commandEngine, const char* name, unsigned short length);
+#endif
+#ifdef COMMANDS_ENABLE_STATISTICS
+static void ResetStatistics(CommandEngine* commandEngine);
+static void RecordStatistics(ExecutionStatistics* statistics, unsigned long start, unsigned long end, bool invocation);
+#endif
+#ifdef COMMANDS_PRIORITY_SCHEDULER
+static void InitializeScheduler(CommandEngine* commandEngine);
+#endif
+#if COMMANDS_TIMER_WHEEL_SLOTS > 0
+static void InitializeTimerWheel(CommandEngine* commandEngine);
+static void AdvanceTimerWheel(CommandEngine* commandEngine);
+#endif
+#ifdef COMMANDS_ENABLE_MAILBOXES
+static void InitializeMailboxes(CommandEngine* commandEngine);
+static void WakeWaitingServices(CommandEngine* commandEngine);
+#endif
+static unsigned long GetIdleTicks(CommandEngine* commandEngine);
+static void EnterIdle(CommandEngine* commandEngine);
+#if COMMANDS_TRACE_SIZE > 0
+static void RecordTrace(CommandEngine* commandEngine, byte event, byte data);
+static byte TraceLength(const char* string);
+#endif
+static void ResetCommandBuffer(CommandEngine* commandEngine);
+static void TokenizeKeystroke(CommandEngine* commandEngine, unsigned char keystroke);
+static void TokenizeBackspace(CommandEngine* commandEngine);
+static unsigned short TokenEnd(CommandEngine* commandEngine, byte token);
+#ifdef COMMANDS_ENABLE_QUOTES
+static unsigned short ScanQuotedToken(CommandEngine* commandEngine, unsigned short position, unsigned short end, unsigned short* tokenEnd);
+static void TokenizeQuotes(CommandEngine* commandEngine);
+#endif
+#ifdef COMMANDS_ENABLE_TYPED_ARGUMENTS
+static void PackArgument(CommandEngine* commandEngine, unsigned short start, unsigned short end, unsigned short* packed);
+static void PackExtraArguments(CommandEngine* commandEngine);
+static const char* FindArgument(CommandEngine* commandEngine, byte index);
+#endif
+static const char* WriteOutputPart(CommandEngine* commandEngine, const char* string);
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+static bool IsOutputBlocked(CommandEngine* commandEngine);
+static bool ReserveOutput(CommandEngine* commandEngine, unsigned short length);
+static const char* QueueOutputString(CommandEngine* commandEngine, const char* string);
+static void QueueOutput(CommandEngine* commandEngine, char value);
+static unsigned short WriteOutputChunk(CommandEngine* commandEngine);
+static void SpillOutput(CommandEngine* commandEngine, const char* string);
+static void SpillCharacter(CommandEngine* commandEngine, char value);
+static void RefillOutput(CommandEngine* commandEngine);
+#endif
+#if COMMANDS_OUTPUT_CACHE_SIZE > 0
+static const char* StartCachedOutput(CommandEngine* commandEngine, const Command* command);
+static void RenderOutput(CommandEngine* commandEngine, const char* string);
+static void EndRendering(CommandEngine* commandEngine, const Command* command);
+#endif
+#if COMMANDS_FRAME_PAYLOAD_SIZE > 0
+static void DecodeFrame(CommandEngine* commandEngine, byte value);
+static void AppendFrame(CommandEngine* commandEngine, byte type, const char* string);
+static bool CloseFrame(CommandEngine* commandEngine, bool spill);
+static bool SendDone(CommandEngine* commandEngine, FrameStatus status, bool spill);
+#endif
+#ifdef COMMANDS_ENABLE_SCRIPTS
+static void StartScriptLine(CommandEngine* commandEngine);
+static void ContinueScriptLine(CommandEngine* commandEngine);
+static void EndScriptLine(CommandEngine* commandEngine);
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+static bool IsScriptOutputPending(CommandEngine* commandEngine);
+#endif
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 // Public methods
@@ -68,17 +140,58 @@ static char* argv[MAX_CMD_ARGS];
 
 void DoTasks(CommandEngine* commandEngine)
 {
+#if COMMANDS_TRACE_SIZE > 0
+    // The loop and the services are entered on every pass, services are
+    // traced when they run instead
+    if (commandEngine->Status != LoopStatus && commandEngine->Status != ExecuteServicesStatus)
+    {
+        RecordTrace(commandEngine, StateTrace, commandEngine->Status);
+    }
+#endif
+
     switch(commandEngine->Status)
     {
         case InitializeStatus:
             commandEngine->KeyInputStatus = ReadyForKeyInputStatus;
             commandEngine->ServiceCount = 0;
             commandEngine->ServiceRunning = 0;
+            commandEngine->CurrentService = NoService;
 
+#ifdef COMMANDS_CONST_REGISTRIES
+            // Generated registries come with their counts
+            commandEngine->ServiceCount = commandEngine->RegisteredServiceCount;
+            if (commandEngine->ServiceCount == 0)
+#endif
             while(commandEngine->RegisteredServices[commandEngine->ServiceCount] != NULL)
             {
                 ++commandEngine->ServiceCount;
             }
+
+            // The engine does not start with a configuration it cannot run
+            if (!IsConfigurationValid(commandEngine))
+            {
+                break;
+            }
+
+#ifdef COMMANDS_CONST_REGISTRIES
+            InitializeServiceStates(commandEngine);
+#endif
+            InitializeDispatch(commandEngine);
+#ifdef COMMANDS_PRIORITY_SCHEDULER
+            InitializeScheduler(commandEngine);
+#endif
+#if COMMANDS_TIMER_WHEEL_SLOTS > 0
+            InitializeTimerWheel(commandEngine);
+#endif
+#ifdef COMMANDS_ENABLE_MAILBOXES
+            InitializeMailboxes(commandEngine);
+#endif
+#ifdef COMMANDS_ENABLE_STATISTICS
+            ResetStatistics(commandEngine);
+#endif
+#if COMMANDS_OUTPUT_CACHE_SIZE > 0
+            InvalidateOutputCache(commandEngine, NULL);
+#endif
             
             commandEngine->Status = ReadyForInputStatus;
             
@@ -97,29 +210,108 @@ void DoTasks(CommandEngine* commandEngine)
             
             break;
         case ExecuteCommandStatus:
-            ExecuteCommand(commandEngine, commandEngine->ParsedCommand);
+#ifdef COMMANDS_ENABLE_SCRIPTS
+            if (commandEngine->ScriptRunning)
+            {
+                // Script lines end without a prompt
+                ContinueScriptLine(commandEngine);
+                commandEngine->Status = ExecuteServicesStatus;
+
+                break;
+            }
+#endif
+            if (!ExecuteCommand(commandEngine, commandEngine->ParsedCommand))
+            {
+                // Resumed on the next loop, after services had their turn
+                commandEngine->Status = ExecuteServicesStatus;
+
+                break;
+            }
+
             commandEngine->ParsedCommand = NULL;
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+            if (IsOutputBlocked(commandEngine))
+            {
+                // The prompt waits for the output of the command
+                commandEngine->KeyInputStatus = ReadyToShowPromptStatus;
+                commandEngine->Status = ExecuteServicesStatus;
+
+                break;
+            }
+#endif
             
         case ReadyForInputStatus:
-            commandEngine->BufferPosition = 0;
+            ResetCommandBuffer(commandEngine);
+
+#if COMMANDS_FRAME_PAYLOAD_SIZE > 0
+            if (commandEngine->FramedMode)
+            {
+                // The response ends with a done frame instead of a prompt
+                if (commandEngine->FrameRequestPending)
+                {
+                    if (!SendDone(commandEngine, commandEngine->FrameStatus, false))
+                    {
+                        // Retried once the transport has room
+                        commandEngine->KeyInputStatus = ReadyToShowPromptStatus;
+                        commandEngine->Status = ExecuteServicesStatus;
+
+                        break;
+                    }
+
+                    commandEngine->FrameRequestPending = false;
+                }
+
+                commandEngine->Status = LoopStatus;
+
+                break;
+            }
+#endif
             
             if (commandEngine->Prompt != NULL
                     && commandEngine->RunningApplication == NULL
                     && commandEngine->KeystrokeReceived)
             {
-                commandEngine->WriteToOutput(commandEngine->Prompt);    
+                WriteOutput(commandEngine, commandEngine->Prompt);
             }
             
             commandEngine->Status = LoopStatus;
             
             break;
         case LoopStatus:
+#if COMMANDS_INPUT_BUFFER_SIZE > 0
+            ReadKeystrokes(commandEngine);
+#endif
+#if COMMANDS_FRAME_PAYLOAD_SIZE > 0
+            if (commandEngine->ParsedCommand == NULL && !commandEngine->FrameRequestPending)
+            {
+                // Output written outside of a request, e.g. by services, or
+                // a frame the ring could not take yet
+                CloseFrame(commandEngine, false);
+            }
+#endif
             
-            if (commandEngine->ParsedCommand != NULL)
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+            if (commandEngine->OutputCount > 0 && !IsOutputBlocked(commandEngine))
             {
-                commandEngine->Status = ExecuteCommandStatus;
+                commandEngine->Status = WriteStatus;
             }
-            else if (commandEngine->KeyInputStatus == ReadyToParseStatus)
+            else if (IsOutputBlocked(commandEngine)
+#if COMMANDS_INPUT_BUFFER_SIZE == 0
+                    // Keystrokes are not kept, the line and the prompt go
+                    // on as they come
+                    && commandEngine->KeyInputStatus == ReadyForKeyInputStatus
+#endif
+                    )
+            {
+                // The prompt, commands and the application wait for the
+                // transport, so they always start on an empty ring
+                commandEngine->Status = commandEngine->OnIdle != NULL && IsEngineIdle(commandEngine)
+                    ? IdleStatus
+                    : ExecuteServicesStatus;
+            }
+            else
+#endif
+            if (commandEngine->KeyInputStatus == ReadyToParseStatus)
             {
                 commandEngine->Status = ParseForCommandStatus;
                 commandEngine->KeyInputStatus = ReadyForKeyInputStatus;
@@ -129,6 +321,14 @@ void DoTasks(CommandEngine* commandEngine)
                 commandEngine->Status = ReadyForInputStatus;
                 commandEngine->KeyInputStatus = ReadyForKeyInputStatus;
             }
+            else if (commandEngine->OnIdle != NULL && IsEngineIdle(commandEngine))
+            {
+                commandEngine->Status = IdleStatus;
+            }
+            else if (commandEngine->ParsedCommand != NULL)
+            {
+                commandEngine->Status = ExecuteCommandStatus;
+            }
             else if (commandEngine->RunningApplication == NULL)
             {
                 commandEngine->Status = ExecuteServicesStatus;
@@ -138,6 +338,21 @@ void DoTasks(CommandEngine* commandEngine)
                 commandEngine->Status = ExecuteApplicationStatus;
             }
             
+            break;
+        case WriteStatus:
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+            WriteOutputChunk(commandEngine);
+#endif
+
+            if (commandEngine->RunningApplication == NULL)
+            {
+                commandEngine->Status = ExecuteServicesStatus;
+            }
+            else
+            {
+                commandEngine->Status = ExecuteApplicationStatus;
+            }
+            
             break;
         case ExecuteApplicationStatus:
             ExecuteApplication(commandEngine);
@@ -145,9 +360,33 @@ void DoTasks(CommandEngine* commandEngine)
             
             break;
         case ExecuteServicesStatus:
-            ExecuteService(commandEngine);
+            if (!commandEngine->ServicesDisabled
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+                    // A run could only add to the spill
+                    && commandEngine->SpillCount == 0
+#endif
+                    )
+            {
+                ExecuteService(commandEngine);
+            }
+#if COMMANDS_MAX_JOBS > 0
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+            if (!IsOutputBlocked(commandEngine))
+#endif
+            {
+                ExecuteJob(commandEngine);
+            }
+#endif
+
             commandEngine->Status = LoopStatus;
             
+            break;
+        case IdleStatus:
+            EnterIdle(commandEngine);
+
+            // Services woken by the timer wheel run first
+            commandEngine->Status = ExecuteServicesStatus;
+
             break;
         default:
             commandEngine->Status = InitializeStatus;
@@ -158,9 +397,216 @@ void DoTasks(CommandEngine* commandEngine)
     return;
 }
 
+// Runs up to maxSteps state transitions, returning early once the engine is
+// back in the loop with nothing but services left to run. Every loop pass
+// still gives a service its slot. Returns non-zero if work is still pending.
+byte DoTasksUntilIdle(CommandEngine* commandEngine, unsigned short maxSteps)
+{
+    bool servicesVisited = false;
+
+    while (maxSteps > 0)
+    {
+        if (commandEngine->Status == ExecuteServicesStatus)
+        {
+            servicesVisited = true;
+        }
+
+        DoTasks(commandEngine);
+        --maxSteps;
+
+        if (servicesVisited
+                && commandEngine->Status == LoopStatus
+                && !HasPendingWork(commandEngine))
+        {
+            return false;
+        }
+    }
+
+    return commandEngine->Status != LoopStatus || HasPendingWork(commandEngine);
+}
+
 void AddKeystroke(CommandEngine* commandEngine, unsigned char keystroke)
 {
+#if COMMANDS_INPUT_BUFFER_SIZE > 0
+    byte head = commandEngine->InputHead;
+    if ((byte)(head - commandEngine->InputTail) == COMMANDS_INPUT_BUFFER_SIZE)
+    {
+        ++commandEngine->InputOverruns;
+        return;
+    }
+
+    // The slot is only reused once DoTasks has read it
+    COMMANDS_ACQUIRE_BARRIER();
+    commandEngine->InputBuffer[head & (COMMANDS_INPUT_BUFFER_SIZE - 1)] = keystroke;
+    COMMANDS_RELEASE_BARRIER();
+    commandEngine->InputHead = head + 1;
+#else
+    ProcessKeystroke(commandEngine, keystroke);
+#endif
+}
+
+unsigned short AddKeystrokes(CommandEngine* commandEngine, const byte* keystrokes, unsigned short length)
+{
+    unsigned short i = 0;
+
+#if COMMANDS_INPUT_BUFFER_SIZE > 0
+    byte head = commandEngine->InputHead;
+    byte space = COMMANDS_INPUT_BUFFER_SIZE - (byte)(head - commandEngine->InputTail);
+    if (length > space)
+    {
+        length = space;
+    }
+
+    COMMANDS_ACQUIRE_BARRIER();
+    for(i = 0; i < length; ++i)
+    {
+        commandEngine->InputBuffer[(byte)(head + i) & (COMMANDS_INPUT_BUFFER_SIZE - 1)] = keystrokes[i];
+    }
+
+    // Publish the whole batch at once
+    COMMANDS_RELEASE_BARRIER();
+    commandEngine->InputHead = head + (byte)length;
+#else
+    for(i = 0; i < length; ++i)
+    {
+        ProcessKeystroke(commandEngine, keystrokes[i]);
+    }
+#endif
+
+    return length;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private methods
+////////////////////////////////////////////////////////////////////////////////
+
+static bool HasPendingWork(CommandEngine* commandEngine)
+{
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+    if (IsOutputBlocked(commandEngine))
+    {
+        // Input and commands wait for NotifyOutputReady
+        return false;
+    }
+#endif
+#if COMMANDS_INPUT_BUFFER_SIZE > 0
+    if (commandEngine->InputTail != commandEngine->InputHead)
+    {
+        return true;
+    }
+#endif
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+    if (commandEngine->OutputCount > 0)
+    {
+        return true;
+    }
+#endif
+#if COMMANDS_FRAME_PAYLOAD_SIZE > 0
+    if (commandEngine->FramePayloadLength > 0)
+    {
+        return true;
+    }
+#endif
+
+    return commandEngine->ParsedCommand != NULL
+        || commandEngine->KeyInputStatus != ReadyForKeyInputStatus;
+}
+
+#if COMMANDS_INPUT_BUFFER_SIZE > 0
+static void ReadKeystrokes(CommandEngine* commandEngine)
+{
+    // The producer only counts, so the count is never cleared under it
+    byte overruns = commandEngine->InputOverruns;
+    if (overruns != commandEngine->InputOverrunsSeen)
+    {
+        commandEngine->InputOverrunsSeen = overruns;
+        WriteErrorOutput(commandEngine, CMD_CRLF "Input overrun!" CMD_CRLF);
+    }
+
+#ifdef COMMANDS_ENABLE_SCRIPTS
+    if (commandEngine->ScriptRunning)
+    {
+        // The command buffer holds the script line, input waits for EndScript
+        return;
+    }
+#endif
+
+    byte count = 0;
+    while (count < COMMANDS_INPUT_BATCH_SIZE && commandEngine->InputTail != commandEngine->InputHead)
+    {
+        // The keystrokes are read after the head that published them
+        COMMANDS_ACQUIRE_BARRIER();
+
+        // Keep the rest of the input until the current line has been handled,
+        // only a Ctrl-C can go through to cancel a running command
+        bool cancel = commandEngine->ParsedCommand != NULL
+            && commandEngine->InputBuffer[commandEngine->InputTail & (COMMANDS_INPUT_BUFFER_SIZE - 1)] == CTRL_C_ASCII;
+#if COMMANDS_FRAME_PAYLOAD_SIZE > 0
+        // Frames are binary, the next one waits for the current request
+        cancel = cancel && !commandEngine->FramedMode;
+#endif
+
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+        if (IsOutputBlocked(commandEngine))
+        {
+            // The echo waits for the transport, a Ctrl-C too as nothing
+            // runs meanwhile
+            return;
+        }
+#endif
+
+        if (commandEngine->RunningApplication == NULL
+                && (commandEngine->KeyInputStatus != ReadyForKeyInputStatus
+                    || commandEngine->ParsedCommand != NULL)
+                && !cancel)
+        {
+            return;
+        }
+
+        byte tail = commandEngine->InputTail;
+        ProcessKeystroke(commandEngine, commandEngine->InputBuffer[tail & (COMMANDS_INPUT_BUFFER_SIZE - 1)]);
+        // The slot is read before it is handed back to the producer
+        COMMANDS_RELEASE_BARRIER();
+        commandEngine->InputTail = tail + 1;
+        ++count;
+    }
+}
+#endif
+
+static void ProcessKeystroke(CommandEngine* commandEngine, unsigned char keystroke)
+{
+#if COMMANDS_TRACE_SIZE > 0
+    RecordTrace(commandEngine, KeystrokeTrace, keystroke);
+#endif
+#if COMMANDS_FRAME_PAYLOAD_SIZE > 0
+    if (commandEngine->FramedMode) {
+        DecodeFrame(commandEngine, keystroke);
+        return;
+    }
+#endif
+#ifdef COMMANDS_ENABLE_SCRIPTS
+    if (commandEngine->ScriptRunning) {
+        // Without the input ring nothing keeps the keystroke
+        return;
+    }
+#endif
+
     if (commandEngine->RunningApplication != NULL) {
+#if COMMANDS_MAX_JOBS > 0
+        if (keystroke == CTRL_Z_ASCII) {
+            // Continues as a job, if there is a free slot
+            if (StartJob(commandEngine, commandEngine->RunningApplication)) {
+#ifdef COMMANDS_CONST_REGISTRIES
+                byte job = GetJobNumber(commandEngine, commandEngine->RunningApplication);
+                commandEngine->JobStates[job - 1] = commandEngine->ApplicationState;
+#endif
+                commandEngine->RunningApplication = NULL;
+                commandEngine->KeyInputStatus = ReadyToShowPromptStatus;
+            }
+
+            return;
+        }
+#endif
         if (keystroke != CTRL_C_ASCII) {
             // Feed all the characters synchronously in the application
             // It is the application's responsibility to be state-based
@@ -175,14 +621,22 @@ void AddKeystroke(CommandEngine* commandEngine, unsigned char keystroke)
     if (keystroke == NULL) {
         return;
     }
+
+    if (commandEngine->ParsedCommand != NULL) {
+        // The command line is in use until the command completes
+        if (keystroke == CTRL_C_ASCII) {
+            CancelCommand(commandEngine);
+        }
+
+        return;
+    }
     
     if (!commandEngine->KeystrokeReceived) {
         if (commandEngine->Intro != NULL) {
-            commandEngine->WriteToOutput(commandEngine->Intro);
+            WriteOutput(commandEngine, commandEngine->Intro);
         }
             
-        commandEngine->BufferPosition = 0;
-        commandEngine->CommandBuffer[commandEngine->BufferPosition] = NULL;
+        ResetCommandBuffer(commandEngine);
         commandEngine->KeyInputStatus = ReadyToShowPromptStatus;
         
         commandEngine->KeystrokeReceived = true;
@@ -196,7 +650,7 @@ void AddKeystroke(CommandEngine* commandEngine, unsigned char keystroke)
         }
         else {
             commandEngine->KeyInputStatus = ReadyToShowPromptStatus;
-            commandEngine->WriteToOutput(CMD_CRLF);
+            WriteOutput(commandEngine, CMD_CRLF);
         }
         return;
     }
@@ -208,10 +662,12 @@ void AddKeystroke(CommandEngine* commandEngine, unsigned char keystroke)
             case BACKSPACE_ASCII:
                 if (commandEngine->BufferPosition > 0)
                 {
+                    TokenizeBackspace(commandEngine);
                     --commandEngine->BufferPosition;
 
-                    characterEchoBuffer[0] = keystroke;
-                    commandEngine->WriteToOutput(characterEchoBuffer);
+                    commandEngine->EchoBuffer[0] = keystroke;
+                    commandEngine->EchoBuffer[1] = NULL;
+                    WriteOutput(commandEngine, commandEngine->EchoBuffer);
                 }
                 break;
             case RETURN_ASCII:
@@ -221,19 +677,19 @@ void AddKeystroke(CommandEngine* commandEngine, unsigned char keystroke)
                 // Clear the buffer and press 'enter'
                 commandEngine->KeyInputStatus = ReadyToShowPromptStatus;
                 
-                commandEngine->BufferPosition = 0;
-                commandEngine->CommandBuffer[commandEngine->BufferPosition] = NULL;
+                ResetCommandBuffer(commandEngine);
                 
-                commandEngine->WriteToOutput(CMD_CRLF);
+                WriteOutput(commandEngine, CMD_CRLF);
                 break;
+#if COMMANDS_COMPLETION_SIZE > 0
+            case TAB_ASCII:
+                CompleteCommand(commandEngine);
+                break;
+#endif
             default:
                 if (keystroke > 31)
                 {
-                    commandEngine->CommandBuffer[commandEngine->BufferPosition] = keystroke;
-                    ++commandEngine->BufferPosition;
-
-                    characterEchoBuffer[0] = keystroke;
-                    commandEngine->WriteToOutput(characterEchoBuffer);
+                    InsertKeystroke(commandEngine, keystroke);
                 }
                 else
                 {
@@ -242,9 +698,9 @@ void AddKeystroke(CommandEngine* commandEngine, unsigned char keystroke)
                     hex[1] = TO_HEX(((keystroke & 0x0F)));
                     hex[2] = '\0';
 
-                    commandEngine->WriteError(CMD_CRLF "ASCII character 0x");
-                    commandEngine->WriteError(hex);
-                    commandEngine->WriteError(" is not supported." CMD_CRLF);
+                    WriteErrorOutput(commandEngine, CMD_CRLF "ASCII character 0x");
+                    WriteErrorOutput(commandEngine, hex);
+                    WriteErrorOutput(commandEngine, " is not supported." CMD_CRLF);
                 }
         }
 
@@ -254,83 +710,192 @@ void AddKeystroke(CommandEngine* commandEngine, unsigned char keystroke)
     }
 
     // Buffer overflow, we have to lose data
-    if (commandEngine->WriteError != NULL) {
-        commandEngine->WriteError(CMD_CRLF "Buffer overflow!" CMD_CRLF);
-    }
+    WriteErrorOutput(commandEngine, CMD_CRLF "Buffer overflow!" CMD_CRLF);
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// Private methods
-////////////////////////////////////////////////////////////////////////////////
+static void InsertKeystroke(CommandEngine* commandEngine, unsigned char keystroke)
+{
+    TokenizeKeystroke(commandEngine, keystroke);
+    commandEngine->CommandBuffer[commandEngine->BufferPosition] = keystroke;
+    ++commandEngine->BufferPosition;
+
+    commandEngine->EchoBuffer[0] = keystroke;
+    commandEngine->EchoBuffer[1] = NULL;
+    WriteOutput(commandEngine, commandEngine->EchoBuffer);
+}
 
 static void CheckArguments(struct CommandEngine* commandEngine)
 {
-    argv[0] = NULL;
+    // Tokens are already known, only terminate them in place
+    byte count = commandEngine->TokenCount <= MAX_CMD_ARGS + 1
+        ? commandEngine->TokenCount
+        : MAX_CMD_ARGS + 1;
+    byte i = 0;
 
-    byte * p = commandEngine->CommandBuffer;
-    while(*p != ' ')
+    commandEngine->Arguments[0] = NULL;
+
+    for(i = 0; i < count; ++i)
     {
-        if (*p == NULL) {
-            return;
-        }
+        commandEngine->CommandBuffer[TokenEnd(commandEngine, i)] = NULL;
 
-        ++p;
+        if (i > 0)
+        {
+            commandEngine->Arguments[i - 1] = (char *)&commandEngine->CommandBuffer[commandEngine->TokenStart[i]];
+            commandEngine->Arguments[i] = NULL;
+        }
     }
 
-    while(*p == ' ')
+#ifdef COMMANDS_ENABLE_TYPED_ARGUMENTS
+    for(i = 0; i < MAX_CMD_ARGS; ++i)
     {
-        if (*p == NULL) {
-            return;
-        }
-
-        ++p;
+        commandEngine->ArgumentTypes[i] = UnparsedArgument;
     }
 
-    StringToArgs(p, argv);
+#ifdef COMMANDS_ENABLE_QUOTES
+    // TokenizeQuotes has packed them already
+    if (!commandEngine->QuotedLine)
+#endif
+    {
+        PackExtraArguments(commandEngine);
+    }
+#endif
 
     return;
 }
 
 static const Command* CheckCommand(struct CommandEngine* commandEngine)
 {
-    byte * p = commandEngine->CommandBuffer;
-    while(*p != ' ' && *p != NULL)
+    if (commandEngine->TokenCount == 0)
     {
-        ++p;
+        // Only spaces were typed
+        commandEngine->KeyInputStatus = ReadyToShowPromptStatus;
+        return (Command*) NULL;
     }
 
-    unsigned short index = (p - commandEngine->CommandBuffer);
-    char * commandName = stringFormatBuffer;
-    strncpy(commandName, commandEngine->CommandBuffer, index);
-    commandName[index] = NULL;
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+    const Filter * filter = NULL;
+    if (!SplitPipe(commandEngine, &filter))
+    {
+        commandEngine->KeyInputStatus = ReadyToShowPromptStatus;
+        return (Command*) NULL;
+    }
+#endif
+#ifdef COMMANDS_ENABLE_QUOTES
+    if (commandEngine->QuotedLine)
+    {
+        TokenizeQuotes(commandEngine);
+    }
+#endif
 
-    unsigned short i = 0;
-    for(i = 0; commandEngine->RegisteredCommands[i] != NULL; ++i)
+    char * commandName = (char *)&commandEngine->CommandBuffer[commandEngine->TokenStart[0]];
+    unsigned short length = TokenEnd(commandEngine, 0) - commandEngine->TokenStart[0];
+
+    unsigned short entry = FindEntry(commandEngine, commandName, length);
+
+#if COMMANDS_COMPLETION_SIZE > 0
+    byte first = 0;
+    if (entry == 0 && IsLineTyped(commandEngine)
+            && FindPrefix(commandEngine, commandName, length, &first) == 1)
     {
-        if (strcmp(commandName, commandEngine->RegisteredCommands[i]->Name) == 0)
-        {
-            return commandEngine->RegisteredCommands[i];
-        }
+        // A unique abbreviation
+        entry = commandEngine->SortedEntries[first];
     }
+#endif
 
-    for(i = 0; commandEngine->RegisteredApplications[i] != NULL; ++i)
+    if (entry != 0 && entry <= commandEngine->CommandCount)
+    {
+        CheckArguments(commandEngine);
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+        StartPipe(commandEngine, filter);
+#endif
+        commandEngine->ParsedCommandIndex = entry - 1;
+        commandEngine->CommandCursor = CommandStarting;
+#if COMMANDS_TRACE_SIZE > 0
+        RecordTrace(commandEngine, CommandStartTrace, entry - 1);
+#endif
+        return commandEngine->RegisteredCommands[entry - 1];
+    }
+
+#if COMMANDS_FRAME_PAYLOAD_SIZE > 0
+    if (entry != 0 && commandEngine->FramedMode)
+    {
+        // Applications need the terminal
+        commandEngine->FrameStatus = FrameStatusUnsupported;
+        commandEngine->KeyInputStatus = ReadyToShowPromptStatus;
+        return (Command*) NULL;
+    }
+#endif
+#ifdef COMMANDS_ENABLE_SCRIPTS
+    if (entry != 0 && commandEngine->ScriptRunning)
+    {
+        WriteErrorOutput(commandEngine, CMD_CRLF "Applications cannot run from a script" CMD_CRLF);
+        commandEngine->ScriptLineStatus = ScriptLineUnsupported;
+        return (Command*) NULL;
+    }
+#endif
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+    if (entry != 0 && filter != NULL)
+    {
+        WriteErrorOutput(commandEngine, CMD_CRLF "Only commands can be piped" CMD_CRLF);
+        commandEngine->KeyInputStatus = ReadyToShowPromptStatus;
+        return (Command*) NULL;
+    }
+#endif
+
+    if (entry != 0)
     {
-        if (strcmp(commandName, commandEngine->RegisteredApplications[i]->Name) == 0)
+        ApplicationEntry * application = commandEngine->RegisteredApplications[entry - commandEngine->CommandCount - 1];
+
+#if COMMANDS_MAX_JOBS > 0
+        if (TakeBackgroundToken(commandEngine))
         {
-            commandEngine->RunningApplication = commandEngine->RegisteredApplications[i];
-            if (commandEngine->RunningApplication->OnStart != NULL) {
-                CheckArguments(commandEngine);
-                commandEngine->RunningApplication->OnStart((const char **)argv, commandEngine);
+            if (StartJob(commandEngine, application))
+            {
+                byte job = GetJobNumber(commandEngine, application);
+#ifdef COMMANDS_CONST_REGISTRIES
+                commandEngine->JobStates[job - 1] = application->State;
+#endif
+
+                if (application->OnStart != NULL)
+                {
+                    CheckArguments(commandEngine);
+
+                    commandEngine->CurrentJob = job;
+                    application->OnStart((const char **)commandEngine->Arguments, commandEngine);
+                    commandEngine->CurrentJob = 0;
+                }
             }
-            break;
+
+            commandEngine->KeyInputStatus = ReadyToShowPromptStatus;
+            return (Command*) NULL;
+        }
+#endif
+
+        commandEngine->RunningApplication = application;
+#ifdef COMMANDS_CONST_REGISTRIES
+        commandEngine->ApplicationState = application->State;
+#endif
+        if (commandEngine->RunningApplication->OnStart != NULL) {
+            CheckArguments(commandEngine);
+            commandEngine->RunningApplication->OnStart((const char **)commandEngine->Arguments, commandEngine);
         }
     }
     
-    if (commandEngine->RunningApplication == NULL && commandEngine->WriteError != NULL)
+    if (commandEngine->RunningApplication == NULL)
     {
-        commandEngine->WriteError(CMD_CRLF "Command '");
-        commandEngine->WriteError(commandName);
-        commandEngine->WriteError("' not found" CMD_CRLF);
+        // The buffer is discarded after this, so the name can be terminated in place
+        commandName[length] = NULL;
+
+#if COMMANDS_FRAME_PAYLOAD_SIZE > 0
+        commandEngine->FrameStatus = FrameStatusNotFound;
+#endif
+
+        WriteErrorOutput(commandEngine, CMD_CRLF "Command '");
+        WriteErrorOutput(commandEngine, commandName);
+        WriteErrorOutput(commandEngine, "' not found" CMD_CRLF);
+#ifdef COMMANDS_ENABLE_SCRIPTS
+        commandEngine->ScriptLineStatus = ScriptLineNotFound;
+#endif
         
         commandEngine->KeyInputStatus = ReadyToShowPromptStatus;
     }
@@ -338,40 +903,160 @@ static const Command* CheckCommand(struct CommandEngine* commandEngine)
     return (Command*) NULL;
 }
 
-static void ExecuteCommand(CommandEngine* commandEngine, const Command* command)
+// Returns false while a resumable command has more steps to run
+static bool ExecuteCommand(CommandEngine* commandEngine, const Command* command)
 {
     if (command != NULL) {
-        if (commandEngine->WriteToOutput != NULL) {
-            CheckArguments(commandEngine);
-            const char* output = command->Execute((const char **)argv, commandEngine);
-            
-            if (output != NULL) {
-                commandEngine->WriteToOutput(output);
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+        if (commandEngine->PendingOutput != NULL) {
+            // The rest of the output of the last step, which did not fit in
+            // the ring, goes before the next one
+            commandEngine->PendingOutput = QueueOutputString(commandEngine, commandEngine->PendingOutput);
+
+            if (commandEngine->PendingOutput != NULL || commandEngine->CommandCursor != CommandCompleted) {
+                return false;
             }
-        }
-    }
+        } else
+#endif
+        if (commandEngine->WriteToOutput != NULL || commandEngine->WriteToOutputNonBlocking != NULL) {
+#ifdef COMMANDS_ENABLE_STATISTICS
+            bool invocation = commandEngine->CommandCursor == CommandStarting;
+            unsigned long start = commandEngine->GetCycles != NULL ? commandEngine->GetCycles() : 0;
+#endif
+            const char* output = NULL;
 
-    commandEngine->BufferPosition = 0;
-    commandEngine->CommandBuffer[commandEngine->BufferPosition] = NULL;
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+            commandEngine->PipeActive = commandEngine->PipeFilter != NULL;
+#endif
+#if COMMANDS_OUTPUT_CACHE_SIZE > 0
+            if (commandEngine->CommandCursor == CommandStarting
+                    && command->CacheOutput
+                    && GetArgumentCount(commandEngine) == 0)
+            {
+                output = StartCachedOutput(commandEngine, command);
+            }
 
-    return;
-}
+            commandEngine->OutputCapturing = commandEngine->OutputRendering;
 
-static void ExecuteApplication(CommandEngine* commandEngine)
-{
-    if (commandEngine->RunningApplication == NULL)
-    {
+            if (output != NULL) {
+                // Replayed with one write, the command does not run
+                commandEngine->CommandCursor = CommandCompleted;
+            } else
+#endif
+            if (command->Resume != NULL) {
+                commandEngine->CommandCursor = command->Resume(commandEngine->CommandCursor,
+                    (const char **)commandEngine->Arguments, commandEngine);
+            } else {
+                output = (const char*)command->Execute((const char **)commandEngine->Arguments, commandEngine);
+                commandEngine->CommandCursor = CommandCompleted;
+            }
+#ifdef COMMANDS_ENABLE_STATISTICS
+            if (commandEngine->GetCycles != NULL && commandEngine->ParsedCommandIndex < COMMANDS_MAX_COMMANDS)
+            {
+                RecordStatistics(&commandEngine->CommandStatistics[commandEngine->ParsedCommandIndex],
+                    start, commandEngine->GetCycles(), invocation);
+            }
+#endif
+            
+            if (output != NULL) {
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+                commandEngine->PendingOutput = WriteOutputPart(commandEngine, output);
+#else
+                WriteOutput(commandEngine, output);
+#endif
+            }
+#if COMMANDS_OUTPUT_CACHE_SIZE > 0
+            commandEngine->OutputCapturing = false;
+            if (commandEngine->CommandCursor == CommandCompleted)
+            {
+                EndRendering(commandEngine, command);
+            }
+#endif
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+            commandEngine->PipeActive = false;
+#endif
+
+            if (commandEngine->CommandCursor != CommandCompleted) {
+                return false;
+            }
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+            if (commandEngine->PendingOutput != NULL) {
+                return false;
+            }
+#endif
+        }
+#if COMMANDS_TRACE_SIZE > 0
+        RecordTrace(commandEngine, CommandEndTrace, commandEngine->ParsedCommandIndex);
+#endif
+    }
+
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+    EndPipe(commandEngine);
+#endif
+    ResetCommandBuffer(commandEngine);
+
+    return true;
+}
+
+static void CancelCommand(CommandEngine* commandEngine)
+{
+    commandEngine->ParsedCommand = NULL;
+    commandEngine->CommandCursor = CommandStarting;
+    commandEngine->KeyInputStatus = ReadyToShowPromptStatus;
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+    commandEngine->PendingOutput = NULL;
+#endif
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+    // The filter does not see the rest of the output
+    commandEngine->PipeFilter = NULL;
+#endif
+#if COMMANDS_TRACE_SIZE > 0
+    // A canceled dump does not leave the trace paused
+    commandEngine->TracePaused = false;
+#endif
+#if COMMANDS_OUTPUT_CACHE_SIZE > 0
+    // Only a part of the output was rendered
+    commandEngine->OutputRendering = false;
+#endif
+
+    ResetCommandBuffer(commandEngine);
+    WriteOutput(commandEngine, CMD_CRLF);
+}
+
+static void ExecuteApplication(CommandEngine* commandEngine)
+{
+    if (commandEngine->RunningApplication == NULL)
+    {
         return;
     }
 
-    Application * app = commandEngine->RunningApplication;
+    ApplicationEntry * app = commandEngine->RunningApplication;
     if (app->Run != NULL)
     {
-        app->State = app->Run(app->State, commandEngine);
+        byte * state = ApplicationState(commandEngine, app, 0);
+        *state = app->Run(*state, commandEngine);
     }
     return;
 }
 
+// The state of the application in the foreground (job 0) or of a job
+static byte* ApplicationState(CommandEngine* commandEngine, ApplicationEntry* application, byte job)
+{
+#ifdef COMMANDS_CONST_REGISTRIES
+#if COMMANDS_MAX_JOBS > 0
+    if (job != 0)
+    {
+        return &commandEngine->JobStates[job - 1];
+    }
+#endif
+
+    return &commandEngine->ApplicationState;
+#else
+    return &application->State;
+#endif
+}
+
+#ifndef COMMANDS_PRIORITY_SCHEDULER
 static void ExecuteService(CommandEngine* commandEngine)
 {
     if (commandEngine->ServiceCount == 0)
@@ -379,17 +1064,53 @@ static void ExecuteService(CommandEngine* commandEngine)
         return;
     }
 
-    if (commandEngine->RegisteredServices[commandEngine->ServiceRunning] == NULL)
+    if (commandEngine->ServiceRunning >= commandEngine->ServiceCount)
     {
         commandEngine->ServiceRunning = 0;
     }
 
+#if COMMANDS_TIMER_WHEEL_SLOTS > 0 || defined(COMMANDS_ENABLE_MAILBOXES)
+#if COMMANDS_TIMER_WHEEL_SLOTS > 0
+    AdvanceTimerWheel(commandEngine);
+#endif
+#ifdef COMMANDS_ENABLE_MAILBOXES
+    WakeWaitingServices(commandEngine);
+#endif
+
+    // Only the services outside the blocked bitmaps are visited, from the
+    // next one in turn
+    byte visited = 0;
+    byte index = commandEngine->ServiceRunning;
+    for(visited = 0; visited < commandEngine->ServiceCount; ++visited)
+    {
+        byte awake = FindAwakeService(commandEngine, index, commandEngine->ServiceCount);
+        if (awake == NoService)
+        {
+            awake = FindAwakeService(commandEngine, 0, index);
+        }
+
+        if (awake == NoService)
+        {
+            return;
+        }
+
+        index = awake + 1 < commandEngine->ServiceCount ? awake + 1 : 0;
+
+        if (*ServiceState(commandEngine, awake) != Stopped)
+        {
+            RunService(commandEngine, awake);
+            commandEngine->ServiceRunning = index;
+
+            return;
+        }
+    }
+#else
     byte referenceToServiceRunning = commandEngine->ServiceRunning;
-    while(commandEngine->RegisteredServices[commandEngine->ServiceRunning]->State == Stopped)
+    while(*ServiceState(commandEngine, commandEngine->ServiceRunning) == Stopped)
     {
         ++commandEngine->ServiceRunning;
 
-        if (commandEngine->RegisteredServices[commandEngine->ServiceRunning] == NULL) {
+        if (commandEngine->ServiceRunning >= commandEngine->ServiceCount) {
             commandEngine->ServiceRunning = 0;
         }
         
@@ -399,14 +1120,183 @@ static void ExecuteService(CommandEngine* commandEngine)
         }
     }
 
-    Service * service = commandEngine->RegisteredServices[commandEngine->ServiceRunning];
-    service->State = service->Run(service->State, service->Data, commandEngine);
+    RunService(commandEngine, commandEngine->ServiceRunning);
     ++commandEngine->ServiceRunning;
-    return;
+#endif
+}
+
+#if COMMANDS_TIMER_WHEEL_SLOTS > 0 || defined(COMMANDS_ENABLE_MAILBOXES)
+// Returns the first service from start to end, excluded, that is neither
+// sleeping nor waiting, or NoService
+static byte FindAwakeService(CommandEngine* commandEngine, unsigned short start, unsigned short end)
+{
+    while (start < end)
+    {
+        byte word = start >> 5;
+        unsigned long blocked = 0;
+#if COMMANDS_TIMER_WHEEL_SLOTS > 0
+        blocked |= commandEngine->BlockedServices[word];
+#endif
+#ifdef COMMANDS_ENABLE_MAILBOXES
+        blocked |= commandEngine->WaitingServices[word];
+#endif
+        unsigned long awake = ~blocked & (0xFFFFFFFFUL << (start & 0x1F)) & 0xFFFFFFFFUL;
+
+        if (awake != 0)
+        {
+            byte index = (word << 5) + LowestBit(awake);
+            return index < end ? index : NoService;
+        }
+
+        start = (unsigned short)(word + 1) << 5;
+    }
+
+    return NoService;
+}
+#endif
+#endif
+
+static void RunService(CommandEngine* commandEngine, byte index)
+{
+    ServiceEntry * service = commandEngine->RegisteredServices[index];
+    byte * state = ServiceState(commandEngine, index);
+
+    commandEngine->CurrentService = index;
+#ifdef COMMANDS_ENABLE_MAILBOXES
+    // Waiting again takes a new call to WaitForMessage
+    if (index < COMMANDS_MAX_SERVICES)
+    {
+        commandEngine->WaitingMailboxes[index] = NULL;
+        commandEngine->WaitingServices[index >> 5] &= ~(1UL << (index & 0x1F));
+    }
+#endif
+#ifdef COMMANDS_ENABLE_STATISTICS
+    unsigned long start = commandEngine->GetCycles != NULL ? commandEngine->GetCycles() : 0;
+#endif
+#if COMMANDS_TRACE_SIZE > 0
+    RecordTrace(commandEngine, ServiceStartTrace, index);
+#endif
+    *state = service->Run(*state, service->Data, commandEngine);
+#if COMMANDS_TRACE_SIZE > 0
+    RecordTrace(commandEngine, ServiceEndTrace, index);
+#endif
+#ifdef COMMANDS_ENABLE_STATISTICS
+    if (commandEngine->GetCycles != NULL && index < COMMANDS_MAX_SERVICES)
+    {
+        RecordStatistics(&commandEngine->ServiceStatistics[index], start, commandEngine->GetCycles(), true);
+    }
+#endif
+    commandEngine->CurrentService = NoService;
+}
+
+static byte* ServiceState(CommandEngine* commandEngine, byte index)
+{
+#ifdef COMMANDS_CONST_REGISTRIES
+    return &commandEngine->ServiceStates[index];
+#else
+    return &commandEngine->RegisteredServices[index]->State;
+#endif
+}
+
+#ifdef COMMANDS_CONST_REGISTRIES
+// The registered State of each service is its initial one
+static void InitializeServiceStates(CommandEngine* commandEngine)
+{
+    byte i = 0;
+
+    for(i = 0; i < commandEngine->ServiceCount; ++i)
+    {
+        commandEngine->ServiceStates[i] = commandEngine->RegisteredServices[i]->State;
+    }
+}
+#endif
+
+static bool IsConfigurationValid(CommandEngine* commandEngine)
+{
+    const char* error = NULL;
+
+#if COMMANDS_OUTPUT_BUFFER_SIZE == 0
+    if (commandEngine->WriteToOutputNonBlocking != NULL)
+    {
+        // Nothing would keep what the writer does not accept
+        error = "WriteToOutputNonBlocking requires COMMANDS_OUTPUT_BUFFER_SIZE" CMD_CRLF;
+    }
+#endif
+#if defined(COMMANDS_PRIORITY_SCHEDULER) || defined(COMMANDS_CONST_REGISTRIES) \
+        || COMMANDS_TIMER_WHEEL_SLOTS > 0 || defined(COMMANDS_ENABLE_MAILBOXES)
+    if (commandEngine->ServiceCount > COMMANDS_MAX_SERVICES)
+    {
+        // The schedule, the states and the blocked services are kept for
+        // that many services only
+        error = "More services than COMMANDS_MAX_SERVICES" CMD_CRLF;
+    }
+#endif
+
+    if (error == NULL)
+    {
+        return true;
+    }
+
+    // Reported once, as DoTasks keeps trying
+    if (!commandEngine->ConfigurationRejected)
+    {
+        commandEngine->ConfigurationRejected = true;
+        WriteErrorOutput(commandEngine, error);
+    }
+
+    return false;
+}
+
+byte GetServiceState(CommandEngine* commandEngine, byte serviceIndex)
+{
+    if (serviceIndex >= commandEngine->ServiceCount)
+    {
+        return Stopped;
+    }
+
+    return *ServiceState(commandEngine, serviceIndex);
+}
+
+#ifdef COMMANDS_PRIORITY_SCHEDULER
+// Waiting services are taken as blocked until WakeWaitingServices sees a
+// message for them
+static bool IsServiceBlocked(CommandEngine* commandEngine, byte index)
+{
+#ifdef COMMANDS_ENABLE_MAILBOXES
+    if (index < COMMANDS_MAX_SERVICES
+            && (commandEngine->WaitingServices[index >> 5] & (1UL << (index & 0x1F))) != 0)
+    {
+        return true;
+    }
+#endif
+
+    return IsServiceSleeping(commandEngine, index);
+}
+#endif
+
+#if defined(COMMANDS_PRIORITY_SCHEDULER) || COMMANDS_TIMER_WHEEL_SLOTS > 0 || defined(COMMANDS_ENABLE_MAILBOXES)
+static const byte LowestBitPosition[32] = {
+    0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+    31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+};
+
+// Position of the lowest set bit of a non-zero 32-bit word
+static byte LowestBit(unsigned long bits)
+{
+    unsigned long lowest = (bits & (0 - bits)) & 0xFFFFFFFFUL;
+    return LowestBitPosition[((lowest * 0x077CB531UL) & 0xFFFFFFFFUL) >> 27];
 }
+#endif
 
 void CloseApplication(CommandEngine* commandEngine)
 {
+#if COMMANDS_MAX_JOBS > 0
+    if (commandEngine->CurrentJob != 0) {
+        EndJob(commandEngine, commandEngine->CurrentJob, "Done ");
+        return;
+    }
+#endif
+
     if (commandEngine->RunningApplication->OnClose != NULL) {
         commandEngine->RunningApplication->OnClose(commandEngine);
     }
@@ -416,47 +1306,3064 @@ void CloseApplication(CommandEngine* commandEngine)
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// Helper methods
+// Priority scheduler
 ////////////////////////////////////////////////////////////////////////////////
-static int StringToArgs(char *pRawString, char *argv[])
+
+#ifdef COMMANDS_PRIORITY_SCHEDULER
+
+// Positions in ServiceOrder are sorted by priority, so the lowest ready bit
+// is always the next service to run. A round ends when every ready service
+// has used its Weight slots.
+
+static void InitializeScheduler(CommandEngine* commandEngine)
 {
-    unsigned short argc = 0, i = 0, strsize = 0;
+    // Stable insertion sort, equal priorities keep their registration order
+    byte i = 0;
+    for(i = 0; i < commandEngine->ServiceCount; ++i)
+    {
+        byte priority = commandEngine->RegisteredServices[i]->Priority;
+        byte position = i;
+        while(position > 0
+                && commandEngine->RegisteredServices[commandEngine->ServiceOrder[position - 1]]->Priority < priority)
+        {
+            commandEngine->ServiceOrder[position] = commandEngine->ServiceOrder[position - 1];
+            --position;
+        }
+
+        commandEngine->ServiceOrder[position] = i;
+    }
 
-    if(pRawString == NULL)
+    for(i = 0; i < COMMANDS_SERVICE_BITMAP_WORDS; ++i)
     {
-        return 0;
+        commandEngine->ReadyServices[i] = 0;
     }
+}
 
-    strsize = strlen(pRawString);
+static void StartServiceRound(CommandEngine* commandEngine)
+{
+    byte position = 0;
+    for(position = 0; position < commandEngine->ServiceCount; ++position)
+    {
+        ServiceEntry * service = commandEngine->RegisteredServices[commandEngine->ServiceOrder[position]];
+        if (*ServiceState(commandEngine, commandEngine->ServiceOrder[position]) != Stopped
+                && !IsServiceBlocked(commandEngine, commandEngine->ServiceOrder[position]))
+        {
+            commandEngine->ServiceCredits[position] = service->Weight != 0 ? service->Weight : 1;
+            commandEngine->ReadyServices[position >> 5] |= 1UL << (position & 0x1F);
+        }
+    }
+}
 
-    while(argc < MAX_CMD_ARGS) {
-        while ((*pRawString == ' ') || (*pRawString == '\t')) {
-            ++pRawString;
-            if (++i >= strsize) {
-                return (argc);
-            }
+static byte NextReadyService(CommandEngine* commandEngine)
+{
+    byte word = 0;
+    for(word = 0; word < COMMANDS_SERVICE_BITMAP_WORDS; ++word)
+    {
+        unsigned long bits = commandEngine->ReadyServices[word];
+        if (bits != 0)
+        {
+            return (word << 5) + LowestBit(bits);
+        }
+    }
+
+    return 0xFF;
+}
+
+static void ExecuteService(CommandEngine* commandEngine)
+{
+    if (commandEngine->ServiceCount == 0)
+    {
+        return;
+    }
+
+#if COMMANDS_TIMER_WHEEL_SLOTS > 0
+    AdvanceTimerWheel(commandEngine);
+#endif
+#ifdef COMMANDS_ENABLE_MAILBOXES
+    WakeWaitingServices(commandEngine);
+#endif
+
+    byte position = NextReadyService(commandEngine);
+    if (position == 0xFF)
+    {
+#if COMMANDS_TIMER_WHEEL_SLOTS > 0
+        if (commandEngine->AwakeServices == 0)
+        {
+            return;
         }
+#endif
+        StartServiceRound(commandEngine);
+        position = NextReadyService(commandEngine);
 
-        if (*pRawString == '\0') {
-            argv[argc] = NULL;
-            return (argc);
+        if (position == 0xFF)
+        {
+            return;
         }
+    }
+
+    byte index = commandEngine->ServiceOrder[position];
+    RunService(commandEngine, index);
+
+    // A woken service joins again at the start of the next round
+    --commandEngine->ServiceCredits[position];
+    if (commandEngine->ServiceCredits[position] == 0
+            || *ServiceState(commandEngine, index) == Stopped
+            || IsServiceBlocked(commandEngine, index))
+    {
+        commandEngine->ReadyServices[position >> 5] &= ~(1UL << (position & 0x1F));
+    }
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Sleeping services
+////////////////////////////////////////////////////////////////////////////////
+
+// Sleeping services are kept in a hashed timer wheel: one list per slot,
+// linked through NextSleepingService, hashed by the low bits of the deadline.
+// Each elapsed tick only visits its own slot, and services that need more
+// turns of the wheel stay in the list. BlockedServices has a bit for each
+// service in the wheel, and the round-robin scheduler only scans the others.
+// AwakeServices counts them, so while all of them sleep the priority
+// scheduler does not start a round.
+
+void SleepService(CommandEngine* commandEngine, unsigned long ticks)
+{
+#if COMMANDS_TIMER_WHEEL_SLOTS > 0
+    byte index = commandEngine->CurrentService;
+    if (index >= COMMANDS_MAX_SERVICES || commandEngine->GetTicks == NULL || ticks == 0)
+    {
+        return;
+    }
+
+    if (IsServiceSleeping(commandEngine, index))
+    {
+        return;
+    }
+
+    unsigned long deadline = commandEngine->GetTicks() + ticks;
+    byte slot = deadline & (COMMANDS_TIMER_WHEEL_SLOTS - 1);
+
+    commandEngine->ServiceDeadlines[index] = deadline;
+    commandEngine->NextSleepingService[index] = commandEngine->TimerWheel[slot];
+    commandEngine->TimerWheel[slot] = index;
+    commandEngine->BlockedServices[index >> 5] |= 1UL << (index & 0x1F);
+    --commandEngine->AwakeServices;
+#endif
+}
+
+byte IsServiceSleeping(CommandEngine* commandEngine, byte serviceIndex)
+{
+#if COMMANDS_TIMER_WHEEL_SLOTS > 0
+    return serviceIndex < COMMANDS_MAX_SERVICES
+        && (commandEngine->BlockedServices[serviceIndex >> 5] & (1UL << (serviceIndex & 0x1F))) != 0;
+#else
+    return false;
+#endif
+}
+
+#if COMMANDS_TIMER_WHEEL_SLOTS > 0
+static void InitializeTimerWheel(CommandEngine* commandEngine)
+{
+    byte i = 0;
+    for(i = 0; i < COMMANDS_TIMER_WHEEL_SLOTS; ++i)
+    {
+        commandEngine->TimerWheel[i] = NoService;
+    }
+
+    for(i = 0; i < COMMANDS_SERVICE_BITMAP_WORDS; ++i)
+    {
+        commandEngine->BlockedServices[i] = 0;
+    }
+
+    commandEngine->AwakeServices = commandEngine->ServiceCount;
+
+    commandEngine->LastTick = commandEngine->GetTicks != NULL ? commandEngine->GetTicks() : 0;
+}
+
+static void AdvanceTimerWheel(CommandEngine* commandEngine)
+{
+    if (commandEngine->GetTicks == NULL)
+    {
+        return;
+    }
+
+    unsigned long now = commandEngine->GetTicks();
+    unsigned long elapsed = now - commandEngine->LastTick;
+    if (elapsed > COMMANDS_TIMER_WHEEL_SLOTS)
+    {
+        elapsed = COMMANDS_TIMER_WHEEL_SLOTS;
+    }
 
-        argv[argc++] = pRawString;
+    while (elapsed > 0)
+    {
+        byte slot = (now - elapsed + 1) & (COMMANDS_TIMER_WHEEL_SLOTS - 1);
+        byte * link = &commandEngine->TimerWheel[slot];
 
-        while (*pRawString && (*pRawString != ' ') && (*pRawString != '\t')) {
-            ++pRawString;
+        while (*link != NoService)
+        {
+            byte index = *link;
+            if ((long)(commandEngine->ServiceDeadlines[index] - now) <= 0)
+            {
+                *link = commandEngine->NextSleepingService[index];
+                commandEngine->BlockedServices[index >> 5] &= ~(1UL << (index & 0x1F));
+                ++commandEngine->AwakeServices;
+            }
+            else
+            {
+                link = &commandEngine->NextSleepingService[index];
+            }
         }
 
-        if (*pRawString == '\0') {
-            argv[argc] = NULL;
-            return (argc);
+        --elapsed;
+    }
+
+    commandEngine->LastTick = now;
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Mailboxes
+////////////////////////////////////////////////////////////////////////////////
+
+// Head and Tail run freely and are masked on access, so a full mailbox is
+// told apart from an empty one without a spare slot. A waiting service is in
+// WaitingServices, which the schedulers skip, until the engine sees a message
+// in its mailbox. This needs no wake-up from the producer, so interrupts
+// never write to the engine.
+
+byte PostToMailbox(Mailbox* mailbox, Message message)
+{
+    byte head = mailbox->Head;
+    byte depth = head - mailbox->Tail;
+
+    if (depth == mailbox->Capacity)
+    {
+        ++mailbox->Dropped;
+        return false;
+    }
+
+    // The slot is only reused once the consumer has read it, and the
+    // message lands before the head publishes it
+    COMMANDS_ACQUIRE_BARRIER();
+    mailbox->Messages[head & (mailbox->Capacity - 1)] = message;
+    COMMANDS_RELEASE_BARRIER();
+    mailbox->Head = head + 1;
+
+    if (depth + 1 > mailbox->HighWater)
+    {
+        mailbox->HighWater = depth + 1;
+    }
+
+    return true;
+}
+
+byte TakeFromMailbox(Mailbox* mailbox, Message* message)
+{
+    byte tail = mailbox->Tail;
+
+    if (tail == mailbox->Head)
+    {
+        return false;
+    }
+
+    COMMANDS_ACQUIRE_BARRIER();
+    *message = mailbox->Messages[tail & (mailbox->Capacity - 1)];
+    COMMANDS_RELEASE_BARRIER();
+    mailbox->Tail = tail + 1;
+
+    return true;
+}
+
+byte GetMailboxDepth(const Mailbox* mailbox)
+{
+    return mailbox->Head - mailbox->Tail;
+}
+
+byte PublishToTopic(const Topic* topic, Message message)
+{
+    Mailbox ** subscriber = topic->Subscribers;
+    byte received = 0;
+
+    for(; *subscriber != NULL; ++subscriber)
+    {
+        if (PostToMailbox(*subscriber, message))
+        {
+            ++received;
         }
+    }
+
+    return received;
+}
+
+void WaitForMessage(CommandEngine* commandEngine, Mailbox* mailbox)
+{
+#ifdef COMMANDS_ENABLE_MAILBOXES
+    byte index = commandEngine->CurrentService;
+    if (index >= COMMANDS_MAX_SERVICES)
+    {
+        return;
+    }
+
+    commandEngine->WaitingMailboxes[index] = mailbox;
+    commandEngine->WaitingServices[index >> 5] |= 1UL << (index & 0x1F);
+#endif
+}
+
+byte IsServiceWaiting(CommandEngine* commandEngine, byte serviceIndex)
+{
+#ifdef COMMANDS_ENABLE_MAILBOXES
+    return serviceIndex < COMMANDS_MAX_SERVICES
+        && commandEngine->WaitingMailboxes[serviceIndex] != NULL
+        && GetMailboxDepth(commandEngine->WaitingMailboxes[serviceIndex]) == 0;
+#else
+    return false;
+#endif
+}
+
+#ifdef COMMANDS_ENABLE_MAILBOXES
+static void InitializeMailboxes(CommandEngine* commandEngine)
+{
+    byte i = 0;
+    for(i = 0; i < COMMANDS_MAX_SERVICES; ++i)
+    {
+        commandEngine->WaitingMailboxes[i] = NULL;
+    }
 
-        *pRawString++ = '\0';
+    for(i = 0; i < COMMANDS_SERVICE_BITMAP_WORDS; ++i)
+    {
+        commandEngine->WaitingServices[i] = 0;
     }
+}
+
+// Only the mailboxes of the waiting services are looked at, and a service
+// leaves WaitingServices once its mailbox has a message
+static void WakeWaitingServices(CommandEngine* commandEngine)
+{
+    byte word = 0;
+    for(word = 0; word < COMMANDS_SERVICE_BITMAP_WORDS; ++word)
+    {
+        unsigned long bits = commandEngine->WaitingServices[word];
+        while (bits != 0)
+        {
+            byte bit = LowestBit(bits);
+            byte index = (word << 5) + bit;
+
+            bits &= bits - 1;
+            if (GetMailboxDepth(commandEngine->WaitingMailboxes[index]) > 0)
+            {
+                commandEngine->WaitingServices[word] &= ~(1UL << bit);
+            }
+        }
+    }
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Idle
+////////////////////////////////////////////////////////////////////////////////
+
+byte IsEngineIdle(CommandEngine* commandEngine)
+{
+    return GetIdleTicks(commandEngine) != 0;
+}
+
+// Returns 0 when there is work to do, otherwise the ticks until the first
+// sleeping service wakes
+static unsigned long GetIdleTicks(CommandEngine* commandEngine)
+{
+    unsigned long ticks = IDLE_FOREVER;
+    byte i = 0;
+
+    if (HasPendingWork(commandEngine))
+    {
+        return 0;
+    }
+
+    if (commandEngine->RunningApplication != NULL && commandEngine->RunningApplication->Run != NULL)
+    {
+        return 0;
+    }
+
+#if COMMANDS_MAX_JOBS > 0
+    for(i = 0; i < COMMANDS_MAX_JOBS; ++i)
+    {
+        if (commandEngine->Jobs[i] != NULL && commandEngine->Jobs[i]->Run != NULL)
+        {
+            return 0;
+        }
+    }
+#endif
+
+    if (commandEngine->ServicesDisabled)
+    {
+        return ticks;
+    }
+
+    for(i = 0; i < commandEngine->ServiceCount; ++i)
+    {
+        if (*ServiceState(commandEngine, i) == Stopped
+                || IsServiceWaiting(commandEngine, i))
+        {
+            continue;
+        }
+
+        if (!IsServiceSleeping(commandEngine, i))
+        {
+            return 0;
+        }
+
+#if COMMANDS_TIMER_WHEEL_SLOTS > 0
+        long remaining = (long)(commandEngine->ServiceDeadlines[i] - commandEngine->GetTicks());
+        if (remaining <= 0)
+        {
+            // Woken on the next pass of the timer wheel
+            return 0;
+        }
+
+        if ((unsigned long)remaining < ticks)
+        {
+            ticks = remaining;
+        }
+#endif
+    }
+
+    return ticks;
+}
+
+static void EnterIdle(CommandEngine* commandEngine)
+{
+    // An interrupt may have brought work since the loop checked
+    unsigned long ticks = GetIdleTicks(commandEngine);
+    if (ticks == 0)
+    {
+        return;
+    }
+
+#if COMMANDS_TRACE_SIZE > 0
+    RecordTrace(commandEngine, IdleStartTrace, 0);
+#endif
+#ifdef COMMANDS_ENABLE_STATISTICS
+    if (commandEngine->GetCycles == NULL)
+    {
+        commandEngine->OnIdle(ticks, commandEngine);
+    }
+    else
+    {
+        unsigned long start = commandEngine->GetCycles();
+        commandEngine->OnIdle(ticks, commandEngine);
+        unsigned long end = commandEngine->GetCycles();
+
+        RecordStatistics(&commandEngine->IdleStatistics, start, end, true);
+        commandEngine->BusyCycles += start - commandEngine->LastIdleEnd;
+        commandEngine->IdleCycles += end - start;
+        commandEngine->LastIdleEnd = end;
+
+        // Halved before either can overflow, whatever the width of a long
+        if ((commandEngine->BusyCycles | commandEngine->IdleCycles) & ~(ULONG_MAX >> 1))
+        {
+            commandEngine->BusyCycles >>= 1;
+            commandEngine->IdleCycles >>= 1;
+        }
+    }
+#else
+    commandEngine->OnIdle(ticks, commandEngine);
+#endif
+#if COMMANDS_TRACE_SIZE > 0
+    RecordTrace(commandEngine, IdleEndTrace, 0);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Jobs
+////////////////////////////////////////////////////////////////////////////////
+
+// A job is an application that runs without the terminal: it gets no input
+// and its Run is called in the service phase. Its OnStart, Run and OnClose
+// are called with CurrentJob set, which tags what they write.
+
+ApplicationEntry* GetJob(CommandEngine* commandEngine, byte job)
+{
+#if COMMANDS_MAX_JOBS > 0
+    if (job == 0 || job > COMMANDS_MAX_JOBS)
+    {
+        return (ApplicationEntry*) NULL;
+    }
+
+    return commandEngine->Jobs[job - 1];
+#else
+    return (ApplicationEntry*) NULL;
+#endif
+}
+
+byte ForegroundJob(CommandEngine* commandEngine, byte job)
+{
+#if COMMANDS_MAX_JOBS > 0
+    ApplicationEntry * application = GetJob(commandEngine, job);
+    if (application == NULL || commandEngine->RunningApplication != NULL)
+    {
+        return false;
+    }
+
+    commandEngine->Jobs[job - 1] = NULL;
+    commandEngine->RunningApplication = application;
+#ifdef COMMANDS_CONST_REGISTRIES
+    commandEngine->ApplicationState = commandEngine->JobStates[job - 1];
+#endif
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+byte KillJob(CommandEngine* commandEngine, byte job)
+{
+#if COMMANDS_MAX_JOBS > 0
+    if (GetJob(commandEngine, job) == NULL)
+    {
+        return false;
+    }
+
+    EndJob(commandEngine, job, "Killed ");
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+#if COMMANDS_MAX_JOBS > 0
+
+static byte GetJobNumber(CommandEngine* commandEngine, ApplicationEntry* application)
+{
+    byte i = 0;
+    for(i = 0; i < COMMANDS_MAX_JOBS; ++i)
+    {
+        if (commandEngine->Jobs[i] == application)
+        {
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+// A trailing "&" token is removed from the line, so it is not an argument
+static bool TakeBackgroundToken(CommandEngine* commandEngine)
+{
+    unsigned short end = commandEngine->BufferPosition;
+    while (end > 0 && commandEngine->CommandBuffer[end - 1] == ' ')
+    {
+        --end;
+    }
+
+    if (end < 2
+            || commandEngine->CommandBuffer[end - 1] != '&'
+            || commandEngine->CommandBuffer[end - 2] != ' ')
+    {
+        return false;
+    }
+
+    commandEngine->BufferPosition = end - 1;
+    commandEngine->CommandBuffer[commandEngine->BufferPosition] = NULL;
+    --commandEngine->TokenCount;
+
+    return true;
+}
+
+static bool StartJob(CommandEngine* commandEngine, ApplicationEntry* application)
+{
+    if (GetJobNumber(commandEngine, application) != 0)
+    {
+        WriteErrorOutput(commandEngine, CMD_CRLF "Already running as a job" CMD_CRLF);
+        return false;
+    }
+
+    byte job = GetJobNumber(commandEngine, (ApplicationEntry*) NULL);
+    if (job == 0)
+    {
+        WriteErrorOutput(commandEngine, CMD_CRLF "No free job slot" CMD_CRLF);
+        return false;
+    }
+
+    commandEngine->Jobs[job - 1] = application;
+    commandEngine->JobAtLineStart[job - 1] = true;
+
+    WriteOutput(commandEngine, CMD_CRLF);
+    commandEngine->CurrentJob = job;
+    WriteOutput(commandEngine, application->Name);
+    WriteOutput(commandEngine, CMD_CRLF);
+    commandEngine->CurrentJob = 0;
+
+    return true;
+}
+
+static void ExecuteJob(CommandEngine* commandEngine)
+{
+    byte i = 0;
+    for(i = 0; i < COMMANDS_MAX_JOBS; ++i)
+    {
+        byte job = commandEngine->NextJob + 1;
+
+        ++commandEngine->NextJob;
+        if (commandEngine->NextJob == COMMANDS_MAX_JOBS)
+        {
+            commandEngine->NextJob = 0;
+        }
+
+        ApplicationEntry * application = commandEngine->Jobs[job - 1];
+        if (application != NULL)
+        {
+            if (application->Run != NULL)
+            {
+                commandEngine->CurrentJob = job;
+                byte * state = ApplicationState(commandEngine, application, job);
+                *state = application->Run(*state, commandEngine);
+                commandEngine->CurrentJob = 0;
+            }
+
+            return;
+        }
+    }
+}
+
+static void EndJob(CommandEngine* commandEngine, byte job, const char* status)
+{
+    ApplicationEntry * application = commandEngine->Jobs[job - 1];
+    byte currentJob = commandEngine->CurrentJob;
+
+    commandEngine->CurrentJob = job;
+
+    if (application->OnClose != NULL)
+    {
+        application->OnClose(commandEngine);
+    }
+
+    if (!commandEngine->JobAtLineStart[job - 1])
+    {
+        WriteOutput(commandEngine, CMD_CRLF);
+    }
+
+    WriteOutput(commandEngine, status);
+    WriteOutput(commandEngine, application->Name);
+    WriteOutput(commandEngine, CMD_CRLF);
+
+    commandEngine->CurrentJob = currentJob;
+    commandEngine->Jobs[job - 1] = NULL;
+}
+
+// Lines are written in pieces, each one tagged with "[n] "
+static void WriteJobOutput(CommandEngine* commandEngine, const char* string)
+{
+    byte job = commandEngine->CurrentJob;
+    char piece[JobOutputPieceSize + 1];
+    char number[NUMBER_BUFFER_SIZE];
+
+    // What follows is written untagged
+    commandEngine->CurrentJob = 0;
+
+    while (*string != NULL)
+    {
+        if (commandEngine->JobAtLineStart[job - 1])
+        {
+            WriteOutput(commandEngine, "[");
+            WriteOutput(commandEngine, UnsignedToString(job, number));
+            WriteOutput(commandEngine, "] ");
+        }
+
+        const char * end = string;
+        while (*end != NULL && *end != '\n')
+        {
+            ++end;
+        }
+
+        if (*end == NULL)
+        {
+            WriteOutput(commandEngine, string);
+            commandEngine->JobAtLineStart[job - 1] = false;
+            break;
+        }
+
+        // The line ends inside the string, so it is copied out
+        ++end;
+        while (string < end)
+        {
+            byte length = 0;
+            while (string < end && length < JobOutputPieceSize)
+            {
+                piece[length] = *string;
+                ++length;
+                ++string;
+            }
+
+            piece[length] = NULL;
+            WriteOutput(commandEngine, piece);
+        }
+
+        commandEngine->JobAtLineStart[job - 1] = true;
+    }
+
+    commandEngine->CurrentJob = job;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Pipes
+////////////////////////////////////////////////////////////////////////////////
+
+// A "|" token splits the line in a command and a filter. The filter is looked
+// up and its arguments are terminated in place, in the part of the buffer
+// after the "|", while the command keeps the tokens before it.
+
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+
+static bool IsSeparator(CommandEngine* commandEngine, unsigned short position)
+{
+    return position >= commandEngine->BufferPosition
+        || commandEngine->CommandBuffer[position] == ' ';
+}
+
+// Returns false, after writing the error, when the line is not a valid pipe
+static bool SplitPipe(CommandEngine* commandEngine, const Filter** filter)
+{
+    byte * buffer = commandEngine->CommandBuffer;
+    unsigned short pipe = 0;
+    unsigned short tokens = 0;
+
+#ifdef COMMANDS_ENABLE_QUOTES
+    bool quoted = false;
+#endif
+
+    for(pipe = 0; pipe < commandEngine->BufferPosition; ++pipe)
+    {
+#ifdef COMMANDS_ENABLE_QUOTES
+        // The tokens of a quoted line are counted again by TokenizeQuotes
+        if (buffer[pipe] == '\\')
+        {
+            ++pipe;
+            continue;
+        }
+
+        if (buffer[pipe] == '"')
+        {
+            quoted = !quoted;
+        }
+
+        if (quoted)
+        {
+            continue;
+        }
+#endif
+        if (buffer[pipe] != ' ' && (pipe == 0 || buffer[pipe - 1] == ' '))
+        {
+            if (buffer[pipe] == '|' && IsSeparator(commandEngine, pipe + 1))
+            {
+                break;
+            }
+
+            ++tokens;
+        }
+    }
+
+    if (pipe == commandEngine->BufferPosition)
+    {
+        return true;
+    }
+
+    unsigned short position = pipe + 1;
+    unsigned short name = 0;
+    unsigned short length = 0;
+    unsigned short count = 0;
+
+    commandEngine->PipeArguments[0] = NULL;
+
+    while (position < commandEngine->BufferPosition)
+    {
+        if (buffer[position] == ' ')
+        {
+            ++position;
+            continue;
+        }
+
+        unsigned short start = position;
+#ifdef COMMANDS_ENABLE_QUOTES
+        unsigned short end = 0;
+        position = ScanQuotedToken(commandEngine, position, commandEngine->BufferPosition, &end);
+#else
+        while (!IsSeparator(commandEngine, position))
+        {
+            ++position;
+        }
+
+        unsigned short end = position;
+#endif
+
+        if (count == 0)
+        {
+            name = start;
+            length = end - start;
+        }
+        else if (count <= MAX_CMD_ARGS)
+        {
+            commandEngine->PipeArguments[count - 1] = (char *)&buffer[start];
+            commandEngine->PipeArguments[count] = NULL;
+        }
+
+        buffer[end] = NULL;
+        ++position;
+        ++count;
+    }
+
+    if (tokens == 0 || count == 0)
+    {
+        WriteErrorOutput(commandEngine, CMD_CRLF "Usage: command | filter [arguments]" CMD_CRLF);
+        return false;
+    }
+
+    *filter = FindFilter(commandEngine, (const char *)&buffer[name], length);
+    if (*filter == NULL)
+    {
+        WriteErrorOutput(commandEngine, CMD_CRLF "Filter '");
+        WriteErrorOutput(commandEngine, (const char *)&buffer[name]);
+        WriteErrorOutput(commandEngine, "' not found" CMD_CRLF);
+        return false;
+    }
+
+    // The separator before the "|" closes the last token of the command
+    commandEngine->BufferPosition = pipe;
+    commandEngine->TokenCount = tokens;
+
+    return true;
+}
+
+static void StartPipe(CommandEngine* commandEngine, const Filter* filter)
+{
+    commandEngine->PipeFilter = filter;
+    commandEngine->PipeActive = false;
+    commandEngine->PipeLength = 0;
+    commandEngine->PipeContinued = false;
+    commandEngine->PipeData = 0;
+
+    if (filter != NULL)
+    {
+        // The filter output starts below the command line
+        WriteOutput(commandEngine, CMD_CRLF);
+    }
+}
+
+// Hands the buffered line, or a piece of it when ended is false, to the
+// filter, whose own output is not piped
+static void ReadPipeLine(CommandEngine* commandEngine, bool ended)
+{
+    byte piped = commandEngine->PipeActive;
+
+    commandEngine->PipeBuffer[commandEngine->PipeLength] = NULL;
+    commandEngine->PipeLength = 0;
+    commandEngine->PipeUnterminated = !ended;
+
+    if (commandEngine->PipeFilter->OnLine != NULL)
+    {
+        commandEngine->PipeActive = false;
+        commandEngine->PipeFilter->OnLine(commandEngine->PipeBuffer,
+            (const char **)commandEngine->PipeArguments, commandEngine);
+        commandEngine->PipeActive = piped;
+    }
+
+    commandEngine->PipeContinued = !ended;
+}
+
+static void WritePipe(CommandEngine* commandEngine, const char* string)
+{
+    for(; *string != NULL; ++string)
+    {
+        if (*string == '\n')
+        {
+            // Blank lines too, and the end of a line that filled the buffer
+            ReadPipeLine(commandEngine, true);
+        }
+        else if (*string != '\r')
+        {
+            commandEngine->PipeBuffer[commandEngine->PipeLength] = *string;
+            ++commandEngine->PipeLength;
+
+            if (commandEngine->PipeLength == COMMANDS_PIPE_BUFFER_SIZE)
+            {
+                ReadPipeLine(commandEngine, false);
+            }
+        }
+    }
+}
+
+static void EndPipe(CommandEngine* commandEngine)
+{
+    const Filter * filter = commandEngine->PipeFilter;
+
+    if (filter == NULL)
+    {
+        return;
+    }
+
+    // A last line without a line ending
+    if (commandEngine->PipeLength > 0 || commandEngine->PipeContinued)
+    {
+        ReadPipeLine(commandEngine, true);
+    }
+
+    commandEngine->PipeFilter = NULL;
+    if (filter->OnEnd != NULL)
+    {
+        filter->OnEnd((const char **)commandEngine->PipeArguments, commandEngine);
+    }
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Trace
+////////////////////////////////////////////////////////////////////////////////
+
+// The ring keeps the last COMMANDS_TRACE_SIZE events: TraceHead is where the
+// next one goes and TraceCount stops growing once the ring is full.
+
+byte ReadTrace(CommandEngine* commandEngine, unsigned short index, TraceRecord* record)
+{
+#if COMMANDS_TRACE_SIZE > 0
+    if (index >= commandEngine->TraceCount)
+    {
+        return false;
+    }
+
+    unsigned short oldest = commandEngine->TraceHead - commandEngine->TraceCount;
+    *record = commandEngine->Trace[(unsigned short)(oldest + index) & (COMMANDS_TRACE_SIZE - 1)];
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void PauseTrace(CommandEngine* commandEngine, byte paused)
+{
+#if COMMANDS_TRACE_SIZE > 0
+    commandEngine->TracePaused = paused;
+#endif
+}
+
+void ClearTrace(CommandEngine* commandEngine)
+{
+#if COMMANDS_TRACE_SIZE > 0
+    commandEngine->TraceHead = 0;
+    commandEngine->TraceCount = 0;
+#endif
+}
+
+#if COMMANDS_TRACE_SIZE > 0
+static void RecordTrace(CommandEngine* commandEngine, byte event, byte data)
+{
+    if (commandEngine->TracePaused)
+    {
+        return;
+    }
+
+    TraceRecord * record = &commandEngine->Trace[commandEngine->TraceHead & (COMMANDS_TRACE_SIZE - 1)];
+
+    record->Time = commandEngine->GetCycles != NULL
+        ? commandEngine->GetCycles()
+        : commandEngine->GetTicks != NULL
+            ? commandEngine->GetTicks()
+            : 0;
+    record->Event = event;
+    record->Data = data;
+
+    ++commandEngine->TraceHead;
+    if (commandEngine->TraceCount < COMMANDS_TRACE_SIZE)
+    {
+        ++commandEngine->TraceCount;
+    }
+}
+
+static byte TraceLength(const char* string)
+{
+    byte length = 0;
+    while (length < 0xFF && string[length] != NULL)
+    {
+        ++length;
+    }
+
+    return length;
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Statistics
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef COMMANDS_ENABLE_STATISTICS
+void WriteStatistics(CommandEngine* commandEngine, const ExecutionStatistics* statistics)
+{
+    char number[NUMBER_BUFFER_SIZE];
+
+    WriteOutput(commandEngine, "runs ");
+    WriteOutput(commandEngine, UnsignedToString(statistics->Invocations, number));
+    WriteOutput(commandEngine, ", cycles ");
+    WriteOutput(commandEngine, UnsignedToString(statistics->TotalCycles, number));
+    WriteOutput(commandEngine, " total / ");
+    WriteOutput(commandEngine, UnsignedToString(statistics->MaxCycles, number));
+    WriteOutput(commandEngine, " max, last at ");
+    WriteOutput(commandEngine, UnsignedToString(statistics->LastRun, number));
+}
+
+byte GetDutyCycle(CommandEngine* commandEngine)
+{
+    unsigned long busy = commandEngine->BusyCycles;
+
+    if (commandEngine->GetCycles != NULL)
+    {
+        // Including the cycles since the last call of OnIdle
+        busy += commandEngine->GetCycles() - commandEngine->LastIdleEnd;
+    }
+
+    unsigned long total = busy + commandEngine->IdleCycles;
+    if (total < busy || total == 0)
+    {
+        // Overflowed, OnIdle has not been called for a while
+        return 100;
+    }
+
+    unsigned long percent = total <= ULONG_MAX / 100
+        ? busy * 100 / total
+        : busy / (total / 100);
+
+    return percent < 100 ? percent : 100;
+}
+
+static void ResetStatistics(CommandEngine* commandEngine)
+{
+    ExecutionStatistics empty = { 0, 0, 0, 0 };
+    byte i = 0;
+
+    commandEngine->IdleStatistics = empty;
+    commandEngine->IdleCycles = 0;
+    commandEngine->BusyCycles = 0;
+    commandEngine->LastIdleEnd = commandEngine->GetCycles != NULL ? commandEngine->GetCycles() : 0;
+
+    for(i = 0; i < COMMANDS_MAX_SERVICES; ++i)
+    {
+        commandEngine->ServiceStatistics[i] = empty;
+    }
+
+    for(i = 0; i < COMMANDS_MAX_COMMANDS; ++i)
+    {
+        commandEngine->CommandStatistics[i] = empty;
+    }
+}
+
+// Resumable commands are recorded once per step, but counted as one invocation
+static void RecordStatistics(ExecutionStatistics* statistics, unsigned long start, unsigned long end, bool invocation)
+{
+    unsigned long cycles = end - start;
+
+    if (invocation)
+    {
+        ++statistics->Invocations;
+        statistics->LastRun = start;
+    }
+
+    statistics->TotalCycles += cycles;
+
+    if (cycles > statistics->MaxCycles)
+    {
+        statistics->MaxCycles = cycles;
+    }
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Output
+////////////////////////////////////////////////////////////////////////////////
+
+void WriteOutput(CommandEngine* commandEngine, const char* string)
+{
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+    string = WriteOutputPart(commandEngine, string);
+
+    if (string != NULL)
+    {
+        // The ring is full and the transport blocked, the rest waits in the
+        // spill and the producers wait for it
+        SpillOutput(commandEngine, string);
+    }
+#else
+    WriteOutputPart(commandEngine, string);
+#endif
+}
+
+// Writes string, returning what did not fit in the ring while the transport
+// is blocked, NULL once all of it is written
+static const char* WriteOutputPart(CommandEngine* commandEngine, const char* string)
+{
+#if COMMANDS_OUTPUT_CACHE_SIZE > 0
+    if (commandEngine->OutputCapturing)
+    {
+        RenderOutput(commandEngine, string);
+    }
+#endif
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+    if (commandEngine->PipeActive)
+    {
+        WritePipe(commandEngine, string);
+        return NULL;
+    }
+#endif
+#if COMMANDS_MAX_JOBS > 0
+    if (commandEngine->CurrentJob != 0)
+    {
+        WriteJobOutput(commandEngine, string);
+        return NULL;
+    }
+#endif
+
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+    if (commandEngine->WriteToOutput == NULL && commandEngine->WriteToOutputNonBlocking == NULL)
+    {
+        return NULL;
+    }
+
+#if COMMANDS_FRAME_PAYLOAD_SIZE > 0
+    if (commandEngine->FramedMode)
+    {
+        AppendFrame(commandEngine, OutputFrame, string);
+        return NULL;
+    }
+#endif
+
+    return QueueOutputString(commandEngine, string);
+#else
+    if (commandEngine->WriteToOutput == NULL)
+    {
+        return NULL;
+    }
+
+#if COMMANDS_TRACE_SIZE > 0
+    RecordTrace(commandEngine, WriteStartTrace, TraceLength(string));
+#endif
+    commandEngine->WriteToOutput(string);
+#if COMMANDS_TRACE_SIZE > 0
+    RecordTrace(commandEngine, WriteEndTrace, 0);
+#endif
+
+    return NULL;
+#endif
+}
+
+void WriteErrorOutput(CommandEngine* commandEngine, const char* string)
+{
+#if COMMANDS_OUTPUT_CACHE_SIZE > 0
+    // Output with errors is not static, it is not cached
+    commandEngine->OutputRendering = false;
+    commandEngine->OutputCapturing = false;
+#endif
+#ifdef COMMANDS_ENABLE_SCRIPTS
+    if (commandEngine->ScriptRunning && commandEngine->ScriptLineStatus == ScriptLineOk)
+    {
+        commandEngine->ScriptLineStatus = ScriptLineError;
+    }
+#endif
+#if COMMANDS_FRAME_PAYLOAD_SIZE > 0
+    if (commandEngine->FramedMode)
+    {
+        if (commandEngine->FrameStatus == FrameStatusOk)
+        {
+            commandEngine->FrameStatus = FrameStatusError;
+        }
+
+        AppendFrame(commandEngine, ErrorFrame, string);
+        return;
+    }
+#endif
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+    if (commandEngine->WriteError == NULL && commandEngine->WriteToOutputNonBlocking != NULL)
+    {
+        // Queued behind the output, on the same transport
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+        byte piped = commandEngine->PipeActive;
+        commandEngine->PipeActive = false;
+        WriteOutput(commandEngine, string);
+        commandEngine->PipeActive = piped;
+#else
+        WriteOutput(commandEngine, string);
+#endif
+
+        return;
+    }
+#endif
+
+    if (commandEngine->WriteError == NULL)
+    {
+        return;
+    }
+
+    // Errors are not buffered, so anything written before them goes out first
+    FlushOutput(commandEngine);
+#if COMMANDS_TRACE_SIZE > 0
+    RecordTrace(commandEngine, WriteStartTrace, TraceLength(string));
+#endif
+    commandEngine->WriteError(string);
+#if COMMANDS_TRACE_SIZE > 0
+    RecordTrace(commandEngine, WriteEndTrace, 0);
+#endif
+}
+
+void FlushOutput(CommandEngine* commandEngine)
+{
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+    while (commandEngine->OutputCount > 0 && !IsOutputBlocked(commandEngine))
+    {
+        WriteOutputChunk(commandEngine);
+    }
+#endif
+}
+
+void InvalidateOutputCache(CommandEngine* commandEngine, const Command* command)
+{
+#if COMMANDS_OUTPUT_CACHE_SIZE > 0
+    unsigned short start = 0;
+    unsigned short j = 0;
+    byte i = 0;
+
+    // A rendering in progress is placed after the cached outputs, which may
+    // move, and may already hold the output being invalidated
+    commandEngine->OutputRendering = false;
+    commandEngine->OutputCapturing = false;
+
+    if (command == NULL)
+    {
+        commandEngine->CachedCount = 0;
+        commandEngine->OutputCacheUsed = 0;
+        return;
+    }
+
+    for(i = 0; i < commandEngine->CachedCount; ++i)
+    {
+        unsigned short length = commandEngine->CachedLengths[i];
+
+        if (commandEngine->CachedCommands[i] != command)
+        {
+            start += length;
+            continue;
+        }
+
+        // The outputs after it move down
+        for(j = start; j + length < commandEngine->OutputCacheUsed; ++j)
+        {
+            commandEngine->OutputCache[j] = commandEngine->OutputCache[j + length];
+        }
+
+        for(; i + 1 < commandEngine->CachedCount; ++i)
+        {
+            commandEngine->CachedCommands[i] = commandEngine->CachedCommands[i + 1];
+            commandEngine->CachedLengths[i] = commandEngine->CachedLengths[i + 1];
+        }
+
+        commandEngine->OutputCacheUsed -= length;
+        --commandEngine->CachedCount;
+        return;
+    }
+#endif
+}
+
+void NotifyOutputReady(CommandEngine* commandEngine)
+{
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+    ++commandEngine->OutputReadySignal;
+#endif
+}
+
+#if COMMANDS_OUTPUT_CACHE_SIZE > 0
+// Returns the output to replay, or NULL to run the command, which is then
+// rendered when it is not cached yet. Output of piped command lines is not
+// rendered, the filters write through WriteOutput while it runs.
+static const char* StartCachedOutput(CommandEngine* commandEngine, const Command* command)
+{
+    unsigned short start = 0;
+    byte i = 0;
+
+    for(i = 0; i < commandEngine->CachedCount; ++i)
+    {
+        if (commandEngine->CachedCommands[i] == command)
+        {
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+            // A blocked transport would drop what does not fit in the ring,
+            // the command writes it step by step instead
+            if (commandEngine->WriteToOutputNonBlocking != NULL
+                    && !ReserveOutput(commandEngine, commandEngine->CachedLengths[i] - 1))
+            {
+                return (const char*) NULL;
+            }
+#endif
+
+            return &commandEngine->OutputCache[start];
+        }
+
+        start += commandEngine->CachedLengths[i];
+    }
+
+    commandEngine->RenderedLength = 0;
+    commandEngine->OutputRendering = commandEngine->CachedCount < COMMANDS_OUTPUT_CACHE_ENTRIES
+        && commandEngine->OutputCacheUsed < COMMANDS_OUTPUT_CACHE_SIZE
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+        && commandEngine->PipeFilter == NULL
+#endif
+        ;
+
+    return (const char*) NULL;
+}
+
+static void RenderOutput(CommandEngine* commandEngine, const char* string)
+{
+    // Room is kept for the terminator
+    unsigned short position = commandEngine->OutputCacheUsed + commandEngine->RenderedLength;
+
+    for(; *string != NULL; ++string)
+    {
+        if (position == COMMANDS_OUTPUT_CACHE_SIZE - 1)
+        {
+            commandEngine->OutputRendering = false;
+            commandEngine->OutputCapturing = false;
+            return;
+        }
+
+        commandEngine->OutputCache[position] = *string;
+        ++position;
+    }
+
+    commandEngine->RenderedLength = position - commandEngine->OutputCacheUsed;
+}
+
+static void EndRendering(CommandEngine* commandEngine, const Command* command)
+{
+    if (!commandEngine->OutputRendering)
+    {
+        return;
+    }
+
+    unsigned short length = commandEngine->RenderedLength + 1;
+
+    commandEngine->OutputCache[commandEngine->OutputCacheUsed + commandEngine->RenderedLength] = NULL;
+    commandEngine->CachedCommands[commandEngine->CachedCount] = command;
+    commandEngine->CachedLengths[commandEngine->CachedCount] = length;
+    commandEngine->OutputCacheUsed += length;
+    ++commandEngine->CachedCount;
+
+    commandEngine->OutputRendering = false;
+}
+#endif
+
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+unsigned short ReadOutput(CommandEngine* commandEngine, char* destination, unsigned short length)
+{
+    unsigned short i = 0;
+
+    for(i = 0; i < length && commandEngine->OutputCount > 0; ++i)
+    {
+        destination[i] = commandEngine->OutputBuffer[commandEngine->OutputHead];
+
+        ++commandEngine->OutputHead;
+        if (commandEngine->OutputHead == COMMANDS_OUTPUT_BUFFER_SIZE)
+        {
+            commandEngine->OutputHead = 0;
+        }
+
+        --commandEngine->OutputCount;
+
+        if (commandEngine->OutputCount == 0)
+        {
+            RefillOutput(commandEngine);
+        }
+    }
+
+    RefillOutput(commandEngine);
+
+    if (commandEngine->OutputCount == 0)
+    {
+        commandEngine->OutputBlocked = false;
+    }
+
+    return i;
+}
+
+static bool IsOutputBlocked(CommandEngine* commandEngine)
+{
+    // A signal raised while the writer was running also unblocks
+    return commandEngine->OutputBlocked
+        && commandEngine->OutputBlockedSignal == commandEngine->OutputReadySignal;
+}
+
+// Makes room for length characters after the spill, writing chunks while
+// the transport accepts them
+static bool ReserveOutput(CommandEngine* commandEngine, unsigned short length)
+{
+    while (commandEngine->SpillCount > 0
+            || COMMANDS_OUTPUT_BUFFER_SIZE - commandEngine->OutputCount < length)
+    {
+        if (WriteOutputChunk(commandEngine) == 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void SpillOutput(CommandEngine* commandEngine, const char* string)
+{
+    ++commandEngine->OutputStalls;
+
+    while (*string != NULL)
+    {
+        SpillCharacter(commandEngine, *string);
+        ++string;
+    }
+}
+
+static void SpillCharacter(CommandEngine* commandEngine, char value)
+{
+#if COMMANDS_OUTPUT_SPILL_SIZE > 0
+    if (commandEngine->SpillCount < COMMANDS_OUTPUT_SPILL_SIZE)
+    {
+        unsigned short tail = commandEngine->SpillHead + commandEngine->SpillCount;
+        if (tail >= COMMANDS_OUTPUT_SPILL_SIZE)
+        {
+            tail -= COMMANDS_OUTPUT_SPILL_SIZE;
+        }
+
+        commandEngine->OutputSpill[tail] = value;
+        ++commandEngine->SpillCount;
+
+        return;
+    }
+#endif
+
+    ++commandEngine->OutputDropped;
+}
+
+// Moves the spilled output to the ring as far as it fits
+static void RefillOutput(CommandEngine* commandEngine)
+{
+#if COMMANDS_OUTPUT_SPILL_SIZE > 0
+    while (commandEngine->SpillCount > 0 && commandEngine->OutputCount < COMMANDS_OUTPUT_BUFFER_SIZE)
+    {
+        QueueOutput(commandEngine, commandEngine->OutputSpill[commandEngine->SpillHead]);
+
+        ++commandEngine->SpillHead;
+        if (commandEngine->SpillHead == COMMANDS_OUTPUT_SPILL_SIZE)
+        {
+            commandEngine->SpillHead = 0;
+        }
+
+        --commandEngine->SpillCount;
+    }
+#endif
+}
+
+// Queues what fits of string, returning the rest, NULL once all of it is
+// queued
+static const char* QueueOutputString(CommandEngine* commandEngine, const char* string)
+{
+    while (*string != NULL)
+    {
+        if (!ReserveOutput(commandEngine, 1))
+        {
+            return string;
+        }
+
+        QueueOutput(commandEngine, *string);
+        ++string;
+    }
+
+    return NULL;
+}
+
+static void QueueOutput(CommandEngine* commandEngine, char value)
+{
+    unsigned short tail = commandEngine->OutputHead + commandEngine->OutputCount;
+    if (tail >= COMMANDS_OUTPUT_BUFFER_SIZE)
+    {
+        tail -= COMMANDS_OUTPUT_BUFFER_SIZE;
+    }
+
+    commandEngine->OutputBuffer[tail] = value;
+    ++commandEngine->OutputCount;
+}
+
+// Returns how many characters the writer took
+static unsigned short WriteOutputChunk(CommandEngine* commandEngine)
+{
+    unsigned short length = 0;
+
+    if (commandEngine->WriteToOutputNonBlocking != NULL)
+    {
+        if (IsOutputBlocked(commandEngine))
+        {
+            return 0;
+        }
+
+        // The writer is handed the ring directly, up to its wrap point
+        length = COMMANDS_OUTPUT_BUFFER_SIZE - commandEngine->OutputHead;
+        if (length > commandEngine->OutputCount)
+        {
+            length = commandEngine->OutputCount;
+        }
+
+        if (length > COMMANDS_OUTPUT_CHUNK_SIZE)
+        {
+            length = COMMANDS_OUTPUT_CHUNK_SIZE;
+        }
+
+        if (length == 0)
+        {
+            return 0;
+        }
+
+        byte signal = commandEngine->OutputReadySignal;
+#if COMMANDS_TRACE_SIZE > 0
+        RecordTrace(commandEngine, WriteStartTrace, length <= 0xFF ? length : 0xFF);
+#endif
+        unsigned short accepted = commandEngine->WriteToOutputNonBlocking(
+            &commandEngine->OutputBuffer[commandEngine->OutputHead], length);
+#if COMMANDS_TRACE_SIZE > 0
+        RecordTrace(commandEngine, WriteEndTrace, accepted <= 0xFF ? accepted : 0xFF);
+#endif
+
+        if (accepted > length)
+        {
+            accepted = length;
+        }
+
+        commandEngine->OutputBlocked = accepted < length;
+        commandEngine->OutputBlockedSignal = signal;
+
+        commandEngine->OutputHead += accepted;
+        if (commandEngine->OutputHead == COMMANDS_OUTPUT_BUFFER_SIZE)
+        {
+            commandEngine->OutputHead = 0;
+        }
+
+        commandEngine->OutputCount -= accepted;
+        RefillOutput(commandEngine);
+
+        return accepted;
+    }
+
+    while (length < COMMANDS_OUTPUT_CHUNK_SIZE && commandEngine->OutputCount > 0)
+    {
+        commandEngine->OutputChunk[length] = commandEngine->OutputBuffer[commandEngine->OutputHead];
+        ++length;
+
+        ++commandEngine->OutputHead;
+        if (commandEngine->OutputHead == COMMANDS_OUTPUT_BUFFER_SIZE)
+        {
+            commandEngine->OutputHead = 0;
+        }
+
+        --commandEngine->OutputCount;
+    }
+
+    if (length > 0)
+    {
+        commandEngine->OutputChunk[length] = NULL;
+#if COMMANDS_TRACE_SIZE > 0
+        RecordTrace(commandEngine, WriteStartTrace, length <= 0xFF ? length : 0xFF);
+#endif
+        commandEngine->WriteToOutput(commandEngine->OutputChunk);
+#if COMMANDS_TRACE_SIZE > 0
+        RecordTrace(commandEngine, WriteEndTrace, 0);
+#endif
+    }
+
+    return length;
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Framed mode
+////////////////////////////////////////////////////////////////////////////////
+
+// Requests are decoded as their bytes arrive: a command frame is tokenized
+// into the command buffer like typed keystrokes, without echo, and parsed
+// once its CRC matches. Responses are staged in FramePayload, without ANSI
+// sequences, and queued in the output ring one whole frame at a time.
+
+#define AnsiText (0)
+#define AnsiEscape (1)
+#define AnsiControlSequence (2)
+
+byte SetFramedMode(CommandEngine* commandEngine, byte enabled)
+{
+#if COMMANDS_FRAME_PAYLOAD_SIZE > 0
+    if (enabled && commandEngine->WriteToOutputNonBlocking == NULL)
+    {
+        return false;
+    }
+
+    CloseFrame(commandEngine, true);
+
+    commandEngine->FramedMode = enabled;
+    commandEngine->FrameDecoderStatus = FrameSyncStatus;
+    commandEngine->FrameRequestPending = false;
+    commandEngine->AnsiStatus = AnsiText;
+
+    if (!enabled)
+    {
+        commandEngine->KeystrokeReceived = true;
+        commandEngine->KeyInputStatus = ReadyToShowPromptStatus;
+    }
+
+    return enabled;
+#else
+    return false;
+#endif
+}
+
+#if COMMANDS_FRAME_PAYLOAD_SIZE > 0
+
+static unsigned short UpdateCrc(unsigned short crc, byte value)
+{
+    byte i = 0;
+
+    crc ^= (unsigned short)value << 8;
+    for(i = 0; i < 8; ++i)
+    {
+        crc = crc & 0x8000
+            ? (crc << 1) ^ 0x1021
+            : crc << 1;
+    }
+
+    return crc;
+}
+
+static bool IsFrameBusy(CommandEngine* commandEngine)
+{
+    return commandEngine->ParsedCommand != NULL
+        || commandEngine->KeyInputStatus != ReadyForKeyInputStatus
+        || commandEngine->FrameRequestPending;
+}
+
+static void ReceiveFrame(CommandEngine* commandEngine, bool valid)
+{
+    FrameStatus refusal = commandEngine->FrameRefusal;
+
+    if (!valid)
+    {
+        refusal = FrameStatusBadCrc;
+    }
+    else if (refusal == FrameStatusOk
+            && commandEngine->FrameType != CommandFrame
+            && commandEngine->FrameType != HumanModeFrame)
+    {
+        refusal = FrameStatusUnsupported;
+    }
+
+    if (refusal != FrameStatusOk)
+    {
+        if (!IsFrameBusy(commandEngine))
+        {
+            ResetCommandBuffer(commandEngine);
+        }
+
+        SendDone(commandEngine, refusal, true);
+        return;
+    }
+
+    if (commandEngine->FrameType == HumanModeFrame)
+    {
+        SendDone(commandEngine, FrameStatusOk, true);
+        SetFramedMode(commandEngine, false);
+        return;
+    }
+
+    commandEngine->FrameRequestPending = true;
+    commandEngine->FrameStatus = FrameStatusOk;
+    commandEngine->KeyInputStatus = ReadyToParseStatus;
+}
+
+static void DecodeFrame(CommandEngine* commandEngine, byte value)
+{
+    switch(commandEngine->FrameDecoderStatus)
+    {
+        case FrameTypeStatus:
+            commandEngine->FrameType = value;
+            commandEngine->FrameCrc = UpdateCrc(commandEngine->FrameCrc, value);
+            commandEngine->FrameDecoderStatus = FrameLengthStatus;
+
+            break;
+        case FrameLengthStatus:
+            commandEngine->FrameLength = value;
+            commandEngine->FramePosition = 0;
+            commandEngine->FrameCrc = UpdateCrc(commandEngine->FrameCrc, value);
+            commandEngine->FrameRefusal = IsFrameBusy(commandEngine)
+                ? FrameStatusBusy
+                : FrameStatusOk;
+
+            if (commandEngine->FrameRefusal == FrameStatusOk && commandEngine->FrameType == CommandFrame)
+            {
+                ResetCommandBuffer(commandEngine);
+            }
+
+            commandEngine->FrameDecoderStatus = value > 0
+                ? FramePayloadStatus
+                : FrameCrcHighStatus;
+
+            break;
+        case FramePayloadStatus:
+            commandEngine->FrameCrc = UpdateCrc(commandEngine->FrameCrc, value);
+
+            if (commandEngine->FrameRefusal == FrameStatusOk && commandEngine->FrameType == CommandFrame)
+            {
+                if (commandEngine->BufferPosition < commandEngine->CommandBufferSize - 1)
+                {
+                    TokenizeKeystroke(commandEngine, value);
+                    commandEngine->CommandBuffer[commandEngine->BufferPosition] = value;
+                    ++commandEngine->BufferPosition;
+                    commandEngine->CommandBuffer[commandEngine->BufferPosition] = NULL;
+                }
+                else
+                {
+                    commandEngine->FrameRefusal = FrameStatusTooLong;
+                }
+            }
+
+            ++commandEngine->FramePosition;
+            if (commandEngine->FramePosition == commandEngine->FrameLength)
+            {
+                commandEngine->FrameDecoderStatus = FrameCrcHighStatus;
+            }
+
+            break;
+        case FrameCrcHighStatus:
+            commandEngine->FrameReceivedCrc = (unsigned short)value << 8;
+            commandEngine->FrameDecoderStatus = FrameCrcLowStatus;
+
+            break;
+        case FrameCrcLowStatus:
+            commandEngine->FrameReceivedCrc |= value;
+            commandEngine->FrameDecoderStatus = FrameSyncStatus;
+
+            ReceiveFrame(commandEngine, commandEngine->FrameReceivedCrc == commandEngine->FrameCrc);
+
+            break;
+        default:
+            // Anything between frames is skipped
+            if (value == FRAME_START)
+            {
+                commandEngine->FrameCrc = 0xFFFF;
+                commandEngine->FrameDecoderStatus = FrameTypeStatus;
+            }
+
+            break;
+    }
+}
+
+// Escape sequences can be split across writes, so their state is kept
+static bool IsAnsiSequence(CommandEngine* commandEngine, char value)
+{
+    switch(commandEngine->AnsiStatus)
+    {
+        case AnsiEscape:
+            commandEngine->AnsiStatus = value == '['
+                ? AnsiControlSequence
+                : AnsiText;
+
+            return true;
+        case AnsiControlSequence:
+            if (value >= 0x40 && value <= 0x7E)
+            {
+                commandEngine->AnsiStatus = AnsiText;
+            }
+
+            return true;
+        default:
+            if (value == ESC_ASCII)
+            {
+                commandEngine->AnsiStatus = AnsiEscape;
+                return true;
+            }
+
+            return false;
+    }
+}
+
+// Queues a whole frame, or with spill set puts it in the spill when the ring
+// cannot take it, as a write would be
+static bool SendFrame(CommandEngine* commandEngine, byte type, const char* payload, byte length, bool spill)
+{
+    char frame[COMMANDS_FRAME_PAYLOAD_SIZE + 5];
+    unsigned short crc = 0xFFFF;
+    unsigned short i = 0;
+
+    frame[0] = (char)FRAME_START;
+    frame[1] = type;
+    frame[2] = length;
+
+    for(i = 0; i < length; ++i)
+    {
+        frame[i + 3] = payload[i];
+    }
+
+    for(i = 1; i < length + 3; ++i)
+    {
+        crc = UpdateCrc(crc, frame[i]);
+    }
+
+    frame[length + 3] = crc >> 8;
+    frame[length + 4] = crc & 0xFF;
+
+    // Frames are queued whole or not at all
+    if (ReserveOutput(commandEngine, length + 5))
+    {
+        for(i = 0; i < length + 5; ++i)
+        {
+            QueueOutput(commandEngine, frame[i]);
+        }
+
+        return true;
+    }
+
+    if (!spill)
+    {
+        return false;
+    }
+
+    ++commandEngine->OutputStalls;
+
+    if (COMMANDS_OUTPUT_SPILL_SIZE - commandEngine->SpillCount < length + 5)
+    {
+        // A part of a frame would not decode
+        commandEngine->OutputDropped += length + 5;
+        return true;
+    }
+
+    for(i = 0; i < length + 5; ++i)
+    {
+        SpillCharacter(commandEngine, frame[i]);
+    }
+
+    return true;
+}
+
+static void AppendFrame(CommandEngine* commandEngine, byte type, const char* string)
+{
+    if (commandEngine->FramePayloadType != type)
+    {
+        CloseFrame(commandEngine, true);
+        commandEngine->FramePayloadType = type;
+    }
+
+    while (*string != NULL)
+    {
+        if (!IsAnsiSequence(commandEngine, *string))
+        {
+            if (commandEngine->FramePayloadLength == COMMANDS_FRAME_PAYLOAD_SIZE)
+            {
+                CloseFrame(commandEngine, true);
+            }
+
+            commandEngine->FramePayload[commandEngine->FramePayloadLength] = *string;
+            ++commandEngine->FramePayloadLength;
+        }
+
+        ++string;
+    }
+}
+
+// Returns false while the frame is pending, as the ring could not take it;
+// the loop retries it. With spill set the frame is not kept pending, as its
+// payload is needed again.
+static bool CloseFrame(CommandEngine* commandEngine, bool spill)
+{
+    if (commandEngine->FramePayloadLength > 0)
+    {
+        if (!SendFrame(commandEngine, commandEngine->FramePayloadType,
+                commandEngine->FramePayload, commandEngine->FramePayloadLength, spill))
+        {
+            return false;
+        }
+
+        commandEngine->FramePayloadLength = 0;
+    }
+
+    return true;
+}
+
+static bool SendDone(CommandEngine* commandEngine, FrameStatus status, bool spill)
+{
+    char payload = status;
+
+    return CloseFrame(commandEngine, spill)
+        && SendFrame(commandEngine, DoneFrame, &payload, 1, spill);
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Scripts
+////////////////////////////////////////////////////////////////////////////////
+
+// Script lines are tokenized into the command buffer like framed requests,
+// then parsed and executed on the spot instead of going through the loop. A
+// resumable command runs one step per call, the rest of its line is left to
+// the next call of RunScript or to DoTasks.
+
+byte StartScript(CommandEngine* commandEngine, byte continueOnError, byte* statuses, unsigned short statusSize)
+{
+#ifdef COMMANDS_ENABLE_SCRIPTS
+    if (commandEngine->Status == InitializeStatus)
+    {
+        DoTasks(commandEngine);
+    }
+
+    if (commandEngine->Status == ReadyForInputStatus)
+    {
+        // Resets the command buffer, which is then left to the script
+        DoTasks(commandEngine);
+    }
+
+    if (commandEngine->ScriptRunning
+            || commandEngine->RunningApplication != NULL
+            || commandEngine->ParsedCommand != NULL
+            || commandEngine->BufferPosition != 0
+#if COMMANDS_FRAME_PAYLOAD_SIZE > 0
+            || commandEngine->FramedMode
+#endif
+            )
+    {
+        return false;
+    }
+
+    ResetCommandBuffer(commandEngine);
+
+    commandEngine->ScriptStatuses = statuses;
+    commandEngine->ScriptStatusSize = statuses != NULL ? statusSize : 0;
+    commandEngine->Script.Lines = 0;
+    commandEngine->Script.Failed = 0;
+    commandEngine->Script.FirstFailed = 0;
+    commandEngine->ScriptRunning = true;
+    commandEngine->ScriptStopped = false;
+    commandEngine->ScriptContinueOnError = continueOnError != 0;
+    commandEngine->ScriptLineTooLong = false;
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+unsigned short RunScript(CommandEngine* commandEngine, const char* script, unsigned short length)
+{
+#ifdef COMMANDS_ENABLE_SCRIPTS
+    unsigned short i = 0;
+
+    if (!commandEngine->ScriptRunning)
+    {
+        return 0;
+    }
+
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+    if (IsScriptOutputPending(commandEngine))
+    {
+        return 0;
+    }
+#endif
+
+    if (commandEngine->ParsedCommand != NULL)
+    {
+        ContinueScriptLine(commandEngine);
+    }
+
+    if (script == NULL)
+    {
+        // The end of the script, its last line may have no line ending
+        if (commandEngine->ParsedCommand != NULL)
+        {
+            return 0;
+        }
+
+        if (!commandEngine->ScriptStopped
+                && (commandEngine->BufferPosition > 0 || commandEngine->ScriptLineTooLong))
+        {
+            StartScriptLine(commandEngine);
+        }
+
+        return 1;
+    }
+
+    for(i = 0; i < length && !commandEngine->ScriptStopped; ++i)
+    {
+        if (commandEngine->ParsedCommand != NULL)
+        {
+            return i;
+        }
+
+        unsigned char value = (unsigned char)script[i];
+
+        if (value == '\n')
+        {
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+            if (IsScriptOutputPending(commandEngine))
+            {
+                return i;
+            }
+#endif
+            StartScriptLine(commandEngine);
+            continue;
+        }
+
+        if (value == '\t')
+        {
+            value = ' ';
+        }
+
+        // Line endings of either kind, and other control characters, are skipped
+        if (value < ' ')
+        {
+            continue;
+        }
+
+        if (commandEngine->BufferPosition < commandEngine->CommandBufferSize - 1)
+        {
+            TokenizeKeystroke(commandEngine, value);
+            commandEngine->CommandBuffer[commandEngine->BufferPosition] = value;
+            ++commandEngine->BufferPosition;
+            commandEngine->CommandBuffer[commandEngine->BufferPosition] = NULL;
+        }
+        else
+        {
+            commandEngine->ScriptLineTooLong = true;
+        }
+    }
+
+    return length;
+#else
+    return 0;
+#endif
+}
+
+byte IsScriptLineRunning(CommandEngine* commandEngine)
+{
+#ifdef COMMANDS_ENABLE_SCRIPTS
+    return commandEngine->ScriptRunning && commandEngine->ParsedCommand != NULL;
+#else
+    return false;
+#endif
+}
+
+byte EndScript(CommandEngine* commandEngine, ScriptSummary* summary)
+{
+#ifdef COMMANDS_ENABLE_SCRIPTS
+    if (!commandEngine->ScriptRunning || commandEngine->ParsedCommand != NULL)
+    {
+        return false;
+    }
+
+    ResetCommandBuffer(commandEngine);
+    commandEngine->ScriptRunning = false;
+    FlushOutput(commandEngine);
+
+    if (summary != NULL)
+    {
+        *summary = commandEngine->Script;
+    }
+
+    return commandEngine->Script.Failed == 0;
+#else
+    return false;
+#endif
+}
+
+#ifdef COMMANDS_ENABLE_SCRIPTS
+
+static void StartScriptLine(CommandEngine* commandEngine)
+{
+    ++commandEngine->Script.Lines;
+    commandEngine->ScriptLineStatus = ScriptLineOk;
+
+    if (commandEngine->ScriptLineTooLong)
+    {
+        WriteErrorOutput(commandEngine, CMD_CRLF "Buffer overflow!" CMD_CRLF);
+        commandEngine->ScriptLineStatus = ScriptLineTooLong;
+    }
+    else if (commandEngine->TokenCount > 0)
+    {
+        // Marks the command line as in use, as when it is typed
+        commandEngine->ParsedCommand = CheckCommand(commandEngine);
+
+        if (commandEngine->ParsedCommand != NULL)
+        {
+            ContinueScriptLine(commandEngine);
+            return;
+        }
+    }
+
+    EndScriptLine(commandEngine);
+}
+
+static void ContinueScriptLine(CommandEngine* commandEngine)
+{
+    if (ExecuteCommand(commandEngine, commandEngine->ParsedCommand))
+    {
+        commandEngine->ParsedCommand = NULL;
+        EndScriptLine(commandEngine);
+    }
+}
+
+static void EndScriptLine(CommandEngine* commandEngine)
+{
+    // Nothing is left for the loop: no prompt and no line to parse
+    ResetCommandBuffer(commandEngine);
+    commandEngine->KeyInputStatus = ReadyForKeyInputStatus;
+    commandEngine->ScriptLineTooLong = false;
+
+    byte status = commandEngine->ScriptLineStatus;
+    if (commandEngine->Script.Lines <= commandEngine->ScriptStatusSize)
+    {
+        commandEngine->ScriptStatuses[commandEngine->Script.Lines - 1] = status;
+    }
+
+    if (status != ScriptLineOk)
+    {
+        ++commandEngine->Script.Failed;
+        if (commandEngine->Script.FirstFailed == 0)
+        {
+            commandEngine->Script.FirstFailed = commandEngine->Script.Lines;
+        }
+
+        commandEngine->ScriptStopped = !commandEngine->ScriptContinueOnError;
+    }
+}
+
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+// Like in the loop, a line starts on an empty ring, so that what it writes
+// does not wait for the transport
+static bool IsScriptOutputPending(CommandEngine* commandEngine)
+{
+    FlushOutput(commandEngine);
+
+    return commandEngine->OutputCount > 0;
+}
+#endif
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Tokenizer
+////////////////////////////////////////////////////////////////////////////////
+
+// Tokens are tracked while keystrokes arrive, so a complete line is ready to
+// be dispatched without scanning it again. Only the first MAX_CMD_ARGS + 1
+// tokens (the name and its arguments) are kept, the rest are counted. The
+// count never saturates, so backspacing over tokens always undoes it. With
+// typed arguments, the rest are packed after the kept tokens once the line
+// is complete, each with its terminator, for the accessors to find.
+
+static void ResetCommandBuffer(CommandEngine* commandEngine)
+{
+    commandEngine->BufferPosition = 0;
+    commandEngine->CommandBuffer[commandEngine->BufferPosition] = NULL;
+    commandEngine->TokenCount = 0;
+#ifdef COMMANDS_ENABLE_QUOTES
+    commandEngine->QuotedLine = 0;
+#endif
+}
+
+static bool IsTokenOpen(CommandEngine* commandEngine)
+{
+    return commandEngine->BufferPosition > 0
+        && commandEngine->CommandBuffer[commandEngine->BufferPosition - 1] != ' '
+#ifdef COMMANDS_ENABLE_QUOTES
+        // Left behind a token that TokenizeQuotes shortened
+        && commandEngine->CommandBuffer[commandEngine->BufferPosition - 1] != NULL
+#endif
+        ;
+}
+
+static void TokenizeKeystroke(CommandEngine* commandEngine, unsigned char keystroke)
+{
+    unsigned short last = commandEngine->TokenCount - 1;
+
+#ifdef COMMANDS_ENABLE_QUOTES
+    if (keystroke == '"' || keystroke == '\\')
+    {
+        commandEngine->QuotedLine = 1;
+    }
+#endif
+
+    if (keystroke == ' ')
+    {
+        if (IsTokenOpen(commandEngine) && last <= MAX_CMD_ARGS)
+        {
+            commandEngine->TokenEnd[last] = commandEngine->BufferPosition;
+        }
+    }
+    else if (!IsTokenOpen(commandEngine))
+    {
+        if (commandEngine->TokenCount <= MAX_CMD_ARGS)
+        {
+            commandEngine->TokenStart[commandEngine->TokenCount] = commandEngine->BufferPosition;
+        }
+
+        ++commandEngine->TokenCount;
+    }
+}
+
+static void TokenizeBackspace(CommandEngine* commandEngine)
+{
+    unsigned short position = commandEngine->BufferPosition - 1;
+
+    // Removing the first character of a token removes the token. Removing a
+    // separator reopens the previous token, whose end is taken from the
+    // buffer position again.
+    if (commandEngine->CommandBuffer[position] != ' '
+            && (position == 0 || commandEngine->CommandBuffer[position - 1] == ' '))
+    {
+        --commandEngine->TokenCount;
+    }
+}
+
+static unsigned short TokenEnd(CommandEngine* commandEngine, byte token)
+{
+    if (token == commandEngine->TokenCount - 1 && IsTokenOpen(commandEngine))
+    {
+        return commandEngine->BufferPosition;
+    }
+
+    return commandEngine->TokenEnd[token];
+}
+
+#ifdef COMMANDS_ENABLE_QUOTES
+
+// Moves the token at position left, in place, without its quotes and
+// backslashes. Returns the position of the space outside quotes that ends
+// it, or end, and sets where the moved token ends.
+static unsigned short ScanQuotedToken(CommandEngine* commandEngine, unsigned short position, unsigned short end, unsigned short* tokenEnd)
+{
+    byte * buffer = commandEngine->CommandBuffer;
+    unsigned short write = position;
+    bool quoted = false;
+
+    for(; position < end; ++position)
+    {
+        if (buffer[position] == '\\' && position + 1 < end)
+        {
+            ++position;
+        }
+        else if (buffer[position] == '"')
+        {
+            quoted = !quoted;
+            continue;
+        }
+        else if (buffer[position] == ' ' && !quoted)
+        {
+            break;
+        }
+
+        buffer[write] = buffer[position];
+        ++write;
+    }
+
+    *tokenEnd = write;
+
+    // Nothing that was removed may be read as part of the line
+    while (write < position)
+    {
+        buffer[write] = NULL;
+        ++write;
+    }
+
+    return position;
+}
+
+// Replaces the tokens found while typing, which did not know about quotes
+static void TokenizeQuotes(CommandEngine* commandEngine)
+{
+    unsigned short position = 0;
+    unsigned short end = 0;
+#ifdef COMMANDS_ENABLE_TYPED_ARGUMENTS
+    unsigned short packed = 0;
+#endif
+
+    commandEngine->TokenCount = 0;
+
+    while (position < commandEngine->BufferPosition)
+    {
+        if (commandEngine->CommandBuffer[position] == ' ')
+        {
+            ++position;
+            continue;
+        }
+
+        unsigned short start = position;
+        unsigned short token = commandEngine->TokenCount;
+        if (token <= MAX_CMD_ARGS)
+        {
+            commandEngine->TokenStart[token] = start;
+        }
+
+        position = ScanQuotedToken(commandEngine, position, commandEngine->BufferPosition, &end);
+
+        if (token <= MAX_CMD_ARGS)
+        {
+            commandEngine->TokenEnd[token] = end;
+#ifdef COMMANDS_ENABLE_TYPED_ARGUMENTS
+            packed = end + 1;
+#endif
+        }
+#ifdef COMMANDS_ENABLE_TYPED_ARGUMENTS
+        else
+        {
+            // Its spaces may be quoted, so it is packed now. Its terminator
+            // can take the place of the separator after it, which is passed.
+            PackArgument(commandEngine, start, end, &packed);
+            ++position;
+        }
+#endif
+
+        ++commandEngine->TokenCount;
+    }
+}
+
+#endif
+
+#ifdef COMMANDS_ENABLE_TYPED_ARGUMENTS
+
+// Moves the token from start to end to packed, which is never after it, and
+// terminates it
+static void PackArgument(CommandEngine* commandEngine, unsigned short start, unsigned short end, unsigned short* packed)
+{
+    byte * buffer = commandEngine->CommandBuffer;
+
+    while (start < end)
+    {
+        buffer[*packed] = buffer[start];
+        ++*packed;
+        ++start;
+    }
+
+    buffer[*packed] = NULL;
+    ++*packed;
+}
+
+// The tokens past MAX_CMD_ARGS + 1 of a line without quotes are separated by
+// spaces
+static void PackExtraArguments(CommandEngine* commandEngine)
+{
+    byte * buffer = commandEngine->CommandBuffer;
+    unsigned short position = 0;
+    unsigned short packed = 0;
+
+    if (commandEngine->TokenCount <= MAX_CMD_ARGS + 1)
+    {
+        return;
+    }
+
+    position = commandEngine->TokenEnd[MAX_CMD_ARGS] + 1;
+    packed = position;
+
+    while (position < commandEngine->BufferPosition)
+    {
+        if (buffer[position] == ' ')
+        {
+            ++position;
+            continue;
+        }
+
+        unsigned short start = position;
+        while (position < commandEngine->BufferPosition && buffer[position] != ' ')
+        {
+            ++position;
+        }
+
+        // Its terminator can take the place of the separator, which is passed
+        PackArgument(commandEngine, start, position, &packed);
+        ++position;
+    }
+}
+
+// Arguments past MAX_CMD_ARGS follow the kept tokens, one after the other
+static const char* FindArgument(CommandEngine* commandEngine, byte index)
+{
+    if (index >= GetArgumentCount(commandEngine))
+    {
+        return (const char*) NULL;
+    }
+
+    if (index < MAX_CMD_ARGS)
+    {
+        return commandEngine->Arguments[index];
+    }
+
+    const char * argument = (const char *)&commandEngine->CommandBuffer[commandEngine->TokenEnd[MAX_CMD_ARGS] + 1];
+    byte i = 0;
+    for(i = MAX_CMD_ARGS; i < index; ++i)
+    {
+        while (*argument != NULL)
+        {
+            ++argument;
+        }
+
+        ++argument;
+    }
+
+    return argument;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Dispatch
+////////////////////////////////////////////////////////////////////////////////
+
+// Entries are numbered from 1: first the registered commands,
+// then the registered applications. 0 means "not found".
+
+static bool NameEquals(const char * name, unsigned short length, const char * registeredName)
+{
+    unsigned short i = 0;
+    for(i = 0; i < length; ++i)
+    {
+        if (registeredName[i] != name[i])
+        {
+            return false;
+        }
+    }
+
+    return registeredName[length] == NULL;
+}
+
+#if COMMANDS_DISPATCH_INDEX_SIZE > 0 || COMMANDS_COMPLETION_SIZE > 0
+static const char * EntryName(CommandEngine* commandEngine, unsigned short entry)
+{
+    return entry <= commandEngine->CommandCount
+        ? commandEngine->RegisteredCommands[entry - 1]->Name
+        : commandEngine->RegisteredApplications[entry - commandEngine->CommandCount - 1]->Name;
+}
+#endif
+
+#if COMMANDS_DISPATCH_INDEX_SIZE > 0
+
+static unsigned short HashName(const char * name, unsigned short length)
+{
+    unsigned short hash = 0;
+    unsigned short i = 0;
+    for(i = 0; i < length; ++i)
+    {
+        hash = (hash << 5) - hash + (byte)name[i];
+    }
+
+    return hash;
+}
+
+static void IndexEntry(CommandEngine* commandEngine, unsigned short entry)
+{
+    const char * name = EntryName(commandEngine, entry);
+    unsigned short length = 0;
+    while(name[length] != NULL)
+    {
+        ++length;
+    }
+
+    unsigned short slot = HashName(name, length) & (COMMANDS_DISPATCH_INDEX_SIZE - 1);
+
+    while(commandEngine->DispatchIndex[slot] != 0)
+    {
+        // Keep the first registration of a name, as the linear scan does
+        if (NameEquals(name, length, EntryName(commandEngine, commandEngine->DispatchIndex[slot])))
+        {
+            return;
+        }
+
+        slot = (slot + 1) & (COMMANDS_DISPATCH_INDEX_SIZE - 1);
+    }
+
+    commandEngine->DispatchIndex[slot] = (byte)entry;
+}
+
+#endif
+
+#if COMMANDS_COMPLETION_SIZE > 0
+
+// Returns 0 when name starts with prefix, otherwise the order of the two
+static signed char ComparePrefix(const char * name, const char * prefix, unsigned short length)
+{
+    unsigned short i = 0;
+    for(i = 0; i < length; ++i)
+    {
+        if (name[i] != prefix[i])
+        {
+            return (byte)name[i] < (byte)prefix[i] ? -1 : 1;
+        }
+    }
+
+    return 0;
+}
+
+// Orders a name before its extensions
+static signed char CompareNames(const char * name, const char * other)
+{
+    while (*name != NULL && *name == *other)
+    {
+        ++name;
+        ++other;
+    }
+
+    if (*name == *other)
+    {
+        return 0;
+    }
+
+    return (byte)*name < (byte)*other ? -1 : 1;
+}
+
+static byte SharedLength(const char * name, const char * other)
+{
+    byte length = 0;
+    while (name[length] != NULL && name[length] == other[length] && length < 0xFF)
+    {
+        ++length;
+    }
+
+    return length;
+}
+
+// Insertion sort, run once. Equal names keep their registration order.
+static void SortEntries(CommandEngine* commandEngine, unsigned short entryCount)
+{
+    commandEngine->SortedCount = 0;
+    if (entryCount > COMMANDS_COMPLETION_SIZE)
+    {
+        return;
+    }
+
+    unsigned short entry = 0;
+    for(entry = 1; entry <= entryCount; ++entry)
+    {
+        const char * name = EntryName(commandEngine, entry);
+        byte position = commandEngine->SortedCount;
+
+        while (position > 0
+                && CompareNames(EntryName(commandEngine, commandEngine->SortedEntries[position - 1]), name) > 0)
+        {
+            commandEngine->SortedEntries[position] = commandEngine->SortedEntries[position - 1];
+            --position;
+        }
+
+        commandEngine->SortedEntries[position] = (byte)entry;
+        ++commandEngine->SortedCount;
+    }
+}
+
+// Abbreviations are for lines typed at the terminal. Framed requests and
+// scripts come from programs, which give whole names, so that a command
+// registered later cannot change what they run.
+static bool IsLineTyped(CommandEngine* commandEngine)
+{
+#if COMMANDS_FRAME_PAYLOAD_SIZE > 0
+    if (commandEngine->FramedMode)
+    {
+        return false;
+    }
+#endif
+#ifdef COMMANDS_ENABLE_SCRIPTS
+    if (commandEngine->ScriptRunning)
+    {
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+// Returns how many entries start with the prefix, from position first
+static byte FindPrefix(CommandEngine* commandEngine, const char* prefix, unsigned short length, byte* first)
+{
+    byte low = 0;
+    byte high = commandEngine->SortedCount;
+
+    while (low < high)
+    {
+        byte middle = (low + high) >> 1;
+        if (ComparePrefix(EntryName(commandEngine, commandEngine->SortedEntries[middle]), prefix, length) < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    *first = low;
+
+    byte count = 0;
+    while (low + count < commandEngine->SortedCount
+            && ComparePrefix(EntryName(commandEngine, commandEngine->SortedEntries[low + count]), prefix, length) == 0)
+    {
+        ++count;
+    }
+
+    return count;
+}
+
+// The shortest abbreviation of the entry at this position that is unique.
+// A name that starts another one can only be typed whole.
+static byte UniquePrefixLength(CommandEngine* commandEngine, byte position)
+{
+    const char * name = EntryName(commandEngine, commandEngine->SortedEntries[position]);
+    byte shared = 0;
+
+    if (position > 0)
+    {
+        shared = SharedLength(name, EntryName(commandEngine, commandEngine->SortedEntries[position - 1]));
+    }
+
+    if (position + 1 < commandEngine->SortedCount)
+    {
+        byte next = SharedLength(name, EntryName(commandEngine, commandEngine->SortedEntries[position + 1]));
+        if (next > shared)
+        {
+            shared = next;
+        }
+    }
+
+    return name[shared] != NULL ? shared + 1 : shared;
+}
+
+// Writes the matching names, with their unique abbreviation in bold, and
+// the line being typed again below them
+static void ListCompletions(CommandEngine* commandEngine, byte first, byte count)
+{
+    char abbreviation[0x20];
+    byte i = 0;
+
+    WriteOutput(commandEngine, CMD_CRLF);
+
+    for(i = first; i < first + count; ++i)
+    {
+        const char * name = EntryName(commandEngine, commandEngine->SortedEntries[i]);
+        byte length = UniquePrefixLength(commandEngine, i);
+        byte j = 0;
+
+        if (length > sizeof(abbreviation) - 1)
+        {
+            length = sizeof(abbreviation) - 1;
+        }
+
+        for(j = 0; j < length; ++j)
+        {
+            abbreviation[j] = name[j];
+        }
+
+        abbreviation[length] = NULL;
+
+        WriteOutput(commandEngine, CMD_MAKEBOLD);
+        WriteOutput(commandEngine, abbreviation);
+        WriteOutput(commandEngine, CMD_CLEARATTRIBUTES);
+        WriteOutput(commandEngine, name + length);
+        WriteOutput(commandEngine, "  ");
+    }
+
+    WriteOutput(commandEngine, CMD_CRLF);
+
+    if (commandEngine->Prompt != NULL)
+    {
+        WriteOutput(commandEngine, commandEngine->Prompt);
+    }
+
+    WriteOutput(commandEngine, (const char *)commandEngine->CommandBuffer);
+}
+
+// Completes the name being typed up to the prefix shared by all the entries
+// it matches, followed by a space when there is only one. When there is
+// nothing to add, the matching entries are listed instead.
+static void CompleteCommand(CommandEngine* commandEngine)
+{
+    // Arguments are not completed
+    if (commandEngine->TokenCount > 1
+            || (commandEngine->TokenCount == 1 && !IsTokenOpen(commandEngine)))
+    {
+        return;
+    }
+
+    unsigned short start = commandEngine->TokenCount == 0
+        ? commandEngine->BufferPosition
+        : commandEngine->TokenStart[0];
+    unsigned short length = commandEngine->BufferPosition - start;
+    byte first = 0;
+    byte count = FindPrefix(commandEngine, (const char *)&commandEngine->CommandBuffer[start], length, &first);
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    // Sorted names, so the first and the last match bound what they share
+    const char * name = EntryName(commandEngine, commandEngine->SortedEntries[first]);
+    unsigned short shared = SharedLength(name,
+        EntryName(commandEngine, commandEngine->SortedEntries[first + count - 1]));
+
+    if (shared == length && count > 1)
+    {
+        ListCompletions(commandEngine, first, count);
+        return;
+    }
+
+    for(; length < shared; ++length)
+    {
+        if (commandEngine->BufferPosition >= commandEngine->CommandBufferSize - 1)
+        {
+            return;
+        }
+
+        InsertKeystroke(commandEngine, name[length]);
+    }
+
+    if (count == 1 && commandEngine->BufferPosition < commandEngine->CommandBufferSize - 1)
+    {
+        InsertKeystroke(commandEngine, ' ');
+    }
+}
+
+#endif
+
+static void InitializeDispatch(CommandEngine* commandEngine)
+{
+    commandEngine->CommandCount = 0;
+#ifdef COMMANDS_CONST_REGISTRIES
+    // Counted here only when the registries come without their counts
+    commandEngine->CommandCount = commandEngine->RegisteredCommandCount;
+    if (commandEngine->CommandCount == 0)
+#endif
+    while(commandEngine->RegisteredCommands[commandEngine->CommandCount] != NULL)
+    {
+        ++commandEngine->CommandCount;
+    }
+
+#if COMMANDS_DISPATCH_INDEX_SIZE > 0 || COMMANDS_COMPLETION_SIZE > 0
+    unsigned short entryCount = commandEngine->CommandCount;
+#ifdef COMMANDS_CONST_REGISTRIES
+    entryCount += commandEngine->RegisteredApplicationCount;
+    if (entryCount == commandEngine->CommandCount)
+#endif
+    while(commandEngine->RegisteredApplications[entryCount - commandEngine->CommandCount] != NULL)
+    {
+        ++entryCount;
+    }
+#endif
+#if COMMANDS_COMPLETION_SIZE > 0
+    SortEntries(commandEngine, entryCount);
+#endif
+#if COMMANDS_DISPATCH_INDEX_SIZE > 0
+    unsigned short i = 0;
+    for(i = 0; i < COMMANDS_DISPATCH_INDEX_SIZE; ++i)
+    {
+        commandEngine->DispatchIndex[i] = 0;
+    }
+
+    // An empty slot must always remain to terminate the probing
+    commandEngine->DispatchIndexReady = entryCount < COMMANDS_DISPATCH_INDEX_SIZE && entryCount < 0xFF;
+    if (!commandEngine->DispatchIndexReady)
+    {
+        return;
+    }
+
+    for(i = 1; i <= entryCount; ++i)
+    {
+        IndexEntry(commandEngine, i);
+    }
+#endif
+}
+
+static unsigned short FindEntry(CommandEngine* commandEngine, const char* name, unsigned short length)
+{
+    unsigned short i = 0;
+
+#if COMMANDS_DISPATCH_INDEX_SIZE > 0
+    if (commandEngine->DispatchIndexReady)
+    {
+        unsigned short slot = HashName(name, length) & (COMMANDS_DISPATCH_INDEX_SIZE - 1);
+
+        while(commandEngine->DispatchIndex[slot] != 0)
+        {
+            if (NameEquals(name, length, EntryName(commandEngine, commandEngine->DispatchIndex[slot])))
+            {
+                return commandEngine->DispatchIndex[slot];
+            }
+
+            slot = (slot + 1) & (COMMANDS_DISPATCH_INDEX_SIZE - 1);
+        }
+
+        return 0;
+    }
+#endif
+
+    for(i = 0; commandEngine->RegisteredCommands[i] != NULL; ++i)
+    {
+        if (NameEquals(name, length, commandEngine->RegisteredCommands[i]->Name))
+        {
+            return i + 1;
+        }
+    }
+
+    for(i = 0; commandEngine->RegisteredApplications[i] != NULL; ++i)
+    {
+        if (NameEquals(name, length, commandEngine->RegisteredApplications[i]->Name))
+        {
+            return commandEngine->CommandCount + i + 1;
+        }
+    }
+
+    return 0;
+}
+
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+static const Filter* FindFilter(CommandEngine* commandEngine, const char* name, unsigned short length)
+{
+    const Filter * const * filters = commandEngine->RegisteredFilters;
+
+    if (filters == NULL)
+    {
+        return (Filter*) NULL;
+    }
+
+    for(; *filters != NULL; ++filters)
+    {
+        if (NameEquals(name, length, (*filters)->Name))
+        {
+            return *filters;
+        }
+    }
+
+    return (Filter*) NULL;
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Arguments
+////////////////////////////////////////////////////////////////////////////////
+
+byte GetArgumentCount(CommandEngine* commandEngine)
+{
+    if (commandEngine->TokenCount > 0x100)
+    {
+        return 0xFF;
+    }
+
+    return commandEngine->TokenCount > 0 ? commandEngine->TokenCount - 1 : 0;
+}
+
+#ifdef COMMANDS_ENABLE_TYPED_ARGUMENTS
+
+// Negative values are returned in two's complement
+static bool ParseInteger(const char* text, unsigned long* value)
+{
+    bool negative = *text == '-';
+    unsigned long limit = negative ? (unsigned long)LONG_MAX + 1 : (unsigned long)LONG_MAX;
+    unsigned long result = 0;
+
+    if (*text == '-' || *text == '+')
+    {
+        ++text;
+    }
+
+    if (*text == NULL)
+    {
+        return false;
+    }
+
+    for(; *text != NULL; ++text)
+    {
+        if (*text < '0' || *text > '9')
+        {
+            return false;
+        }
+
+        byte digit = *text - '0';
+        if (result > (limit - digit) / 10)
+        {
+            return false;
+        }
+
+        result = result * 10 + digit;
+    }
+
+    *value = negative ? 0UL - result : result;
+    return true;
+}
+
+static bool ParseHex(const char* text, unsigned long* value)
+{
+    unsigned long result = 0;
+    byte digits = 0;
+
+    if (text[0] == '0' && (text[1] == 'x' || text[1] == 'X'))
+    {
+        text += 2;
+    }
+
+    for(; *text != NULL; ++text)
+    {
+        byte digit = 0;
+        if (*text >= '0' && *text <= '9')
+        {
+            digit = *text - '0';
+        }
+        else if (*text >= 'a' && *text <= 'f')
+        {
+            digit = *text - 'a' + 10;
+        }
+        else if (*text >= 'A' && *text <= 'F')
+        {
+            digit = *text - 'A' + 10;
+        }
+        else
+        {
+            return false;
+        }
+
+        if (result > ULONG_MAX >> 4)
+        {
+            return false;
+        }
+
+        result = (result << 4) | digit;
+        ++digits;
+    }
+
+    if (digits == 0)
+    {
+        return false;
+    }
+
+    *value = result;
+    return true;
+}
+
+static bool ParseBoolean(const char* text, unsigned long* value)
+{
+    // False and true alternate
+    static const char * const names[] = { "0", "1", "off", "on", "no", "yes", "false", "true" };
+    byte i = 0;
+
+    for(i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+    {
+        const char * name = names[i];
+        const char * position = text;
+
+        while (*name != NULL && *name == *position)
+        {
+            ++name;
+            ++position;
+        }
+
+        if (*name == NULL && *position == NULL)
+        {
+            *value = i & 1;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool ParseArgument(const char* text, byte type, unsigned long* value)
+{
+    return type == IntegerArgument
+        ? ParseInteger(text, value)
+        : type == HexArgument
+            ? ParseHex(text, value)
+            : ParseBoolean(text, value);
+}
+
+// Arguments are parsed on first access, and again only when they are read
+// as another type. Those past MAX_CMD_ARGS are parsed on every access.
+static bool ReadArgument(CommandEngine* commandEngine, byte index, byte type, unsigned long* value)
+{
+    const char * text = FindArgument(commandEngine, index);
+
+    if (text == NULL)
+    {
+        return false;
+    }
+
+    if (index >= MAX_CMD_ARGS)
+    {
+        return ParseArgument(text, type, value);
+    }
+
+    if ((commandEngine->ArgumentTypes[index] & ~InvalidArgument) != type)
+    {
+        bool valid = ParseArgument(text, type, &commandEngine->ArgumentValues[index]);
+
+        commandEngine->ArgumentTypes[index] = valid ? type : type | InvalidArgument;
+    }
+
+    if (commandEngine->ArgumentTypes[index] & InvalidArgument)
+    {
+        return false;
+    }
+
+    *value = commandEngine->ArgumentValues[index];
+    return true;
+}
+
+byte GetIntegerArgument(CommandEngine* commandEngine, byte index, long* value)
+{
+    unsigned long parsed = 0;
+    if (!ReadArgument(commandEngine, index, IntegerArgument, &parsed))
+    {
+        return false;
+    }
+
+    *value = (long)parsed;
+    return true;
+}
+
+byte GetHexArgument(CommandEngine* commandEngine, byte index, unsigned long* value)
+{
+    return ReadArgument(commandEngine, index, HexArgument, value);
+}
+
+byte GetBooleanArgument(CommandEngine* commandEngine, byte index, byte* value)
+{
+    unsigned long parsed = 0;
+    if (!ReadArgument(commandEngine, index, BooleanArgument, &parsed))
+    {
+        return false;
+    }
+
+    *value = (byte)parsed;
+    return true;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Helper methods
+////////////////////////////////////////////////////////////////////////////////
+char* UnsignedToString(unsigned long value, char* buffer)
+{
+    char * p = buffer + NUMBER_BUFFER_SIZE - 1;
+    *p = NULL;
+
+    do
+    {
+        --p;
+        *p = '0' + (value % 10);
+        value /= 10;
+    } while (value != 0 && p > buffer);
 
-    return (0);
+    return p;
 }
 
 #endif
\ No newline at end of file
@@ -17,6 +17,202 @@ extern "C" {
 #define COMMANDS_BUFFER_SIZE 0x1F
 #endif
 
+// Define COMMANDS_ENABLE_QUOTES to let an argument hold spaces between double
+// quotes, and any character after a backslash. Lines that use them are
+// tokenized again when complete, removing the quotes in place.
+// #define COMMANDS_ENABLE_QUOTES
+
+// Define COMMANDS_ENABLE_TYPED_ARGUMENTS to read arguments as integers, hex
+// numbers or booleans. Each one is parsed on first access and the value is
+// kept until the command ends; those past MAX_CMD_ARGS are parsed each time.
+// #define COMMANDS_ENABLE_TYPED_ARGUMENTS
+
+// Size of the hash index used to dispatch commands and applications.
+// Must be a power of two and larger than the number of registered entries
+// (at most 254). Set to 0 to use a linear scan of the registries instead.
+#ifndef COMMANDS_DISPATCH_INDEX_SIZE
+#define COMMANDS_DISPATCH_INDEX_SIZE 0
+#endif
+
+// Largest number of commands and applications kept in the sorted index used
+// for Tab completion and unique abbreviations, up to 0xFF. The index is built
+// once and holds one byte per entry, the names stay where they are. With more
+// entries registered, both are off. Abbreviations are only taken from typed
+// lines, not from framed requests or scripts. Set to 0 to disable them.
+#ifndef COMMANDS_COMPLETION_SIZE
+#define COMMANDS_COMPLETION_SIZE 0
+#endif
+
+#if COMMANDS_COMPLETION_SIZE > 0xFF
+#error "The completion index holds at most 0xFF entries"
+#endif
+
+// Size of the ring buffer that coalesces output writes. It is flushed from
+// the WriteStatus state, at most COMMANDS_OUTPUT_CHUNK_SIZE characters per step.
+// Set to 0 to call the writer directly on every write.
+#ifndef COMMANDS_OUTPUT_BUFFER_SIZE
+#define COMMANDS_OUTPUT_BUFFER_SIZE 0
+#endif
+
+#ifndef COMMANDS_OUTPUT_CHUNK_SIZE
+#define COMMANDS_OUTPUT_CHUNK_SIZE 0x20
+#endif
+
+// With the output ring, WriteToOutputNonBlocking can be set instead of
+// WriteToOutput. It returns how many characters the transport accepted and
+// the rest stays in the ring. After a short write nothing is offered again
+// until NotifyOutputReady is called, and meanwhile the prompt, commands, the
+// running application and the echo of the input are paused; services keep
+// running. The output a command returns that does not fit in the ring is kept
+// until it does, and other writes that do not fit wait in the spill.
+// The engine does not start with WriteToOutputNonBlocking and no ring.
+// Errors go through the ring as well when WriteError is NULL.
+
+// Size of the buffer that keeps what a step, a service run or the echo writes
+// while the ring is full and the transport blocked, instead of waiting for the
+// transport inside the write. It moves to the ring as the ring makes room and
+// meanwhile services do not run either. What does not fit in the spill too is
+// dropped and counted in OutputDropped.
+#ifndef COMMANDS_OUTPUT_SPILL_SIZE
+#define COMMANDS_OUTPUT_SPILL_SIZE COMMANDS_OUTPUT_BUFFER_SIZE
+#endif
+
+// Size of the buffer that keeps the output of commands marked CacheOutput,
+// for up to COMMANDS_OUTPUT_CACHE_ENTRIES of them. The output is rendered on
+// the first call without arguments and replayed with one write afterwards,
+// until InvalidateOutputCache is called. Output that does not fit is not
+// cached. Set to 0 to disable the cache.
+#ifndef COMMANDS_OUTPUT_CACHE_SIZE
+#define COMMANDS_OUTPUT_CACHE_SIZE 0
+#endif
+
+#ifndef COMMANDS_OUTPUT_CACHE_ENTRIES
+#define COMMANDS_OUTPUT_CACHE_ENTRIES 4
+#endif
+
+// Largest payload of the frames written in framed mode, up to 0xFF. Framed
+// mode requires the output ring and WriteToOutputNonBlocking, as frames are
+// binary. Requests can be sent back to back with the input ring; without it
+// a request that arrives while another one runs is refused as busy.
+// Set to 0 to disable framed mode.
+#ifndef COMMANDS_FRAME_PAYLOAD_SIZE
+#define COMMANDS_FRAME_PAYLOAD_SIZE 0
+#endif
+
+#if COMMANDS_FRAME_PAYLOAD_SIZE > 0 && COMMANDS_OUTPUT_BUFFER_SIZE < COMMANDS_FRAME_PAYLOAD_SIZE + 5
+#error "Framed mode needs an output ring that holds a whole frame"
+#endif
+
+// Define COMMANDS_ENABLE_SCRIPTS to run newline-separated command lines back
+// to back, e.g. for provisioning, without echo, prompts or the loop states
+// between them.
+// #define COMMANDS_ENABLE_SCRIPTS
+
+// Size of the single-producer/single-consumer ring buffer between
+// AddKeystroke (e.g. a UART RX interrupt) and DoTasks, which processes at most
+// COMMANDS_INPUT_BATCH_SIZE keystrokes per call. Must be a power of two, up
+// to 0x80. Set to 0 to process keystrokes directly in AddKeystroke.
+#ifndef COMMANDS_INPUT_BUFFER_SIZE
+#define COMMANDS_INPUT_BUFFER_SIZE 0
+#endif
+
+#ifndef COMMANDS_INPUT_BATCH_SIZE
+#define COMMANDS_INPUT_BATCH_SIZE 0x10
+#endif
+
+// Barriers around the index that hands the entries of a ring between an
+// interrupt or another thread and DoTasks: the release one orders the writes
+// before the index is published, the acquire one orders the read of the
+// index before the entries are read. Defined as fences on GCC and Clang,
+// define them for other compilers; a compiler barrier is enough on a single
+// core.
+#ifndef COMMANDS_RELEASE_BARRIER
+#if defined(__GNUC__)
+#define COMMANDS_RELEASE_BARRIER() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define COMMANDS_ACQUIRE_BARRIER() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#else
+#define COMMANDS_RELEASE_BARRIER()
+#define COMMANDS_ACQUIRE_BARRIER()
+#endif
+#endif
+
+// Services run round-robin, one slot each per pass. Define
+// COMMANDS_PRIORITY_SCHEDULER to run them by Priority (highest first), with
+// Weight slots per round, for up to COMMANDS_MAX_SERVICES services. The
+// timer wheel and mailboxes also keep their services in bitmaps of that
+// size. With more registered than any of these keep, the engine reports it
+// and does not start.
+// #define COMMANDS_PRIORITY_SCHEDULER
+
+#ifndef COMMANDS_MAX_SERVICES
+#define COMMANDS_MAX_SERVICES 32
+#endif
+
+// Define COMMANDS_CONST_REGISTRIES to register const applications and
+// services, which the compiler can then keep in flash. Their State is only
+// the initial one: the engine keeps the current states, for up to
+// COMMANDS_MAX_SERVICES services, or it does not start. The counts of the
+// registries can be given with them, so they are not counted at startup;
+// a count left to 0 is counted. commands_registry.h generates registries,
+// and their counts, that work either way.
+// #define COMMANDS_CONST_REGISTRIES
+
+#define COMMANDS_SERVICE_BITMAP_WORDS ((COMMANDS_MAX_SERVICES + 31) / 32)
+
+// Number of applications that can run in the background at once, started
+// with a trailing "&" token or sent there with Ctrl-Z. Jobs run after the
+// services, one per pass, and each line they write is tagged with "[n] ".
+// Set to 0 to disable jobs.
+#ifndef COMMANDS_MAX_JOBS
+#define COMMANDS_MAX_JOBS 0
+#endif
+
+// Size of the line buffer between the two stages of a pipe, "command |
+// filter [arguments]". The filter reads the output of the command one line at
+// a time, blank lines included, and longer lines in pieces that are flagged
+// with PipeContinued and PipeUnterminated. Errors are not piped.
+// Set to 0 to disable pipes.
+#ifndef COMMANDS_PIPE_BUFFER_SIZE
+#define COMMANDS_PIPE_BUFFER_SIZE 0
+#endif
+
+// Number of slots in the timer wheel that wakes services put to sleep with
+// SleepService. Must be a power of two. Requires GetTicks to be set.
+// Set to 0 to disable sleeping services.
+#ifndef COMMANDS_TIMER_WHEEL_SLOTS
+#define COMMANDS_TIMER_WHEEL_SLOTS 0
+#endif
+
+// Define COMMANDS_ENABLE_MAILBOXES to let services wait with WaitForMessage
+// until a message is posted to a mailbox, instead of running every pass.
+// #define COMMANDS_ENABLE_MAILBOXES
+
+// Define COMMANDS_ENABLE_STATISTICS to record invocation counts and cycle
+// usage, read from GetCycles, for services and for the first
+// COMMANDS_MAX_COMMANDS registered commands.
+// #define COMMANDS_ENABLE_STATISTICS
+
+#ifndef COMMANDS_MAX_COMMANDS
+#define COMMANDS_MAX_COMMANDS 32
+#endif
+
+// Number of events kept in the trace ring, timestamped with GetCycles, or
+// GetTicks without it, for latency profiling. Must be a power of two. The
+// trace command dumps it in hex, to be decoded by tools/commands_trace.c.
+// Without the input ring keystrokes are traced in AddKeystroke, which must
+// then run in the same context as DoTasks. Set to 0 to disable tracing.
+#ifndef COMMANDS_TRACE_SIZE
+#define COMMANDS_TRACE_SIZE 0
+#endif
+
+// When OnIdle is set, the engine detects passes with nothing to do: no
+// input, output or command pending, no application or job with a Run step
+// and every service stopped, sleeping or waiting for a message. OnIdle is
+// then called with the ticks until the next sleeping service wakes, or
+// IDLE_FOREVER, and can enter a low-power mode until an interrupt. It should
+// check IsEngineIdle again with interrupts disabled before sleeping, so that
+// a keystroke that has just arrived is not slept through.
+
 #ifndef NULL
 #define NULL (0)
 #endif
@@ -26,6 +222,7 @@ extern "C" {
 #define RETURN_ASCII (0x0D)
 #define BACKSPACE_ASCII (0x7F)
 #define CTRL_C_ASCII (0x03)                 // ETX, End Of Text
+#define CTRL_Z_ASCII (0x1A)                 // SUB, Substitute
 
 #define CMD_CRLF "\r\n"
 #define CMD_CLEARSCREEN "\x1B[2J\x1B[;H"
@@ -38,17 +235,30 @@ extern "C" {
 
 #define TO_HEX(i) ((i) <= 9 ? '0' + (i) : 'A' - 10 + (i))
 
+// Enough for an unsigned long in decimal, including the terminator: each
+// byte takes less than 3 digits
+#define NUMBER_BUFFER_SIZE (sizeof(unsigned long) * 3 + 1)
+
+#define IDLE_FOREVER (0xFFFFFFFFUL)
+
 struct CommandEngine;
 
 typedef unsigned char byte;
 
 typedef void (*WriterMethodType)(const char *string);
+typedef unsigned short (*NonBlockingWriterMethodType)(const char *data, unsigned short length);
+typedef unsigned long (*TickSourceMethodType)(void);
+typedef unsigned long (*CycleCounterMethodType)(void);
 typedef byte* (*CommandExecuteMethodType)(const char* args[], struct CommandEngine* commandEngine);
+typedef unsigned short (*CommandResumeMethodType)(unsigned short cursor, const char* args[], struct CommandEngine* commandEngine);
 typedef void (*ApplicationOnStartMethodType)(const char* args[], struct CommandEngine* commandEngine);
 typedef void (*ApplicationOnInputMethodType)(const char input, struct CommandEngine* commandEngine);
 typedef void (*ApplicationOnCloseMethodType)(struct CommandEngine* commandEngine);
 typedef byte (*ApplicationOnStateExecuteMethodType)(byte step, struct CommandEngine* commandEngine);
 typedef byte (*ServiceStateExecuteMethodType)(byte state, void* data, struct CommandEngine* commandEngine);
+typedef void (*FilterLineMethodType)(const char* line, const char* args[], struct CommandEngine* commandEngine);
+typedef void (*FilterEndMethodType)(const char* args[], struct CommandEngine* commandEngine);
+typedef void (*IdleMethodType)(unsigned long ticks, struct CommandEngine* commandEngine);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Structures
@@ -59,12 +269,13 @@ typedef enum {
     InitializeStatus = 0x00,
     ReadyForInputStatus,
     LoopStatus,
-    WriteStatus, // TODO
+    WriteStatus,
     ParseForCommandStatus,
     ExecuteCommandStatus,
     ExecuteApplicationStatus,
     ExecuteServicesStatus,
     ExecuteServicesBetweenParseAndExecuteStatus,
+    IdleStatus,
 } CommandEngineStatus;
 
 typedef enum {
@@ -73,10 +284,74 @@ typedef enum {
     ReadyToShowPromptStatus,
 } KeyInputStatus;
 
+// In framed mode every frame is FRAME_START, a FrameType, the payload length,
+// the payload and a CRC-16/CCITT (0x1021, from 0xFFFF) of the type, length
+// and payload, most significant byte first. Each request is answered by
+// OutputFrame and ErrorFrame frames and a DoneFrame with a FrameStatus.
+#define FRAME_START (0xA5)
+
+typedef enum {
+    // Requests
+    CommandFrame = 'C',
+    HumanModeFrame = 'H',
+    // Responses
+    OutputFrame = 'O',
+    ErrorFrame = 'E',
+    DoneFrame = 'D',
+} FrameType;
+
+typedef enum {
+    FrameStatusOk = 0x00,
+    FrameStatusNotFound,
+    FrameStatusError,
+    FrameStatusBadCrc,
+    FrameStatusTooLong,
+    FrameStatusBusy,
+    FrameStatusUnsupported,
+} FrameStatus;
+
+typedef enum {
+    FrameSyncStatus = 0x00,
+    FrameTypeStatus,
+    FrameLengthStatus,
+    FramePayloadStatus,
+    FrameCrcHighStatus,
+    FrameCrcLowStatus,
+} FrameDecoderStatus;
+
+// Status of each line of a script
+typedef enum {
+    ScriptLineOk = 0x00,
+    ScriptLineNotFound,
+    ScriptLineError,
+    ScriptLineTooLong,
+    ScriptLineUnsupported,
+} ScriptLineStatus;
+
+typedef struct ScriptSummary {
+    // Lines read, blank ones included
+    unsigned short Lines;
+    unsigned short Failed;
+    // Number of the first line that failed, from 1, or 0
+    unsigned short FirstFailed;
+} ScriptSummary;
+
+//Resumable command wellknown cursors
+typedef enum {
+    CommandStarting = 0x0000,
+    CommandCompleted = 0xFFFF,
+} CommandCursorStatus;
+
 typedef struct Command {
     const char * Name;
     CommandExecuteMethodType Execute;
     const char * HelpText;
+    // Used instead of Execute when set. It is called once per step, starting
+    // with CommandStarting, and returns the next cursor or CommandCompleted.
+    CommandResumeMethodType Resume;
+    // Set when the output depends only on the registries, or on state that
+    // calls InvalidateOutputCache when it changes
+    byte CacheOutput;
 } Command;
 
 typedef struct Application {
@@ -102,27 +377,282 @@ typedef struct Service {
     ServiceStateExecuteMethodType Run;
     byte State;
     void * Data;
+    // Scheduling, used by COMMANDS_PRIORITY_SCHEDULER
+    byte Priority;
+    byte Weight;
 } Service;
 
+#ifdef COMMANDS_CONST_REGISTRIES
+typedef const Application ApplicationEntry;
+typedef const Service ServiceEntry;
+#else
+typedef Application ApplicationEntry;
+typedef Service ServiceEntry;
+#endif
+
+// The downstream stage of a pipe. OnLine is called for each line the command
+// writes, without its line ending, and OnEnd once the command completes.
+// A line longer than COMMANDS_PIPE_BUFFER_SIZE is given in pieces: the
+// engine's PipeContinued is set for all but the first, PipeUnterminated for
+// all but the last, which can be empty. Either can be NULL. What they write
+// goes to the output.
+typedef struct Filter {
+    const char * Name;
+    const char * HelpText;
+    FilterLineMethodType OnLine;
+    FilterEndMethodType OnEnd;
+} Filter;
+
+// A message is a word: an event code, a value or an index into the data of
+// the integrator
+typedef unsigned long Message;
+
+// A fixed-capacity queue that needs no lock, as it has a single producer and
+// a single consumer. Services never preempt each other, so any of them can
+// post to the same mailbox, but an interrupt that posts must be its only
+// producer. Capacity must be a power of two, up to 0x80.
+typedef struct Mailbox {
+    const char * Name;
+    Message * Messages;
+    const byte Capacity;
+    // Private fields
+    // Written only by the producer
+    volatile byte Head;
+    volatile byte HighWater;
+    volatile unsigned short Dropped;
+    // Written only by the consumer
+    volatile byte Tail;
+} Mailbox;
+
+// Publishing to a topic posts the message to each of its subscribers
+typedef struct Topic {
+    const char * Name;
+    Mailbox ** Subscribers;
+} Topic;
+
+// Events recorded in the trace ring, with what their data holds
+typedef enum {
+    KeystrokeTrace = 0x01,      // The keystroke
+    StateTrace,                 // The status entered, except LoopStatus and ExecuteServicesStatus
+    CommandStartTrace,          // The index of the command
+    CommandEndTrace,            // The index of the command
+    ServiceStartTrace,          // The index of the service
+    ServiceEndTrace,            // The index of the service
+    WriteStartTrace,            // The length written, up to 0xFF
+    WriteEndTrace,
+    IdleStartTrace,
+    IdleEndTrace,
+} TraceEvent;
+
+typedef struct TraceRecord {
+    unsigned long Time;
+    byte Event;
+    byte Data;
+} TraceRecord;
+
+typedef struct ExecutionStatistics {
+    unsigned long Invocations;
+    unsigned long TotalCycles;
+    unsigned long MaxCycles;
+    // Cycle counter value at the start of the last run
+    unsigned long LastRun;
+} ExecutionStatistics;
+
 typedef struct CommandEngine {
     byte *CommandBuffer;
     const unsigned int CommandBufferSize;
-    const Command** RegisteredCommands;
-    Application** RegisteredApplications;
-    Service** RegisteredServices;
+    const Command* const* RegisteredCommands;
+    ApplicationEntry* const* RegisteredApplications;
+    ServiceEntry* const* RegisteredServices;
     WriterMethodType WriteToOutput;
     WriterMethodType WriteError;
     const char* Prompt;
     const char* Intro;
+    TickSourceMethodType GetTicks;
+    CycleCounterMethodType GetCycles;
+    NonBlockingWriterMethodType WriteToOutputNonBlocking;
+    const Filter* const* RegisteredFilters;
+    Mailbox* const* RegisteredMailboxes;
+    IdleMethodType OnIdle;
+#ifdef COMMANDS_CONST_REGISTRIES
+    unsigned short RegisteredCommandCount;
+    byte RegisteredApplicationCount;
+    byte RegisteredServiceCount;
+#endif
     // Private fields
     unsigned short BufferPosition;
     CommandEngineStatus Status;
     KeyInputStatus KeyInputStatus;
-    Application* RunningApplication;
+    ApplicationEntry* RunningApplication;
     byte ServiceCount;
+#ifdef COMMANDS_CONST_REGISTRIES
+    byte ServiceStates[COMMANDS_MAX_SERVICES];
+    byte ApplicationState;
+#endif
     byte ServiceRunning;
+    byte CurrentService;
     const Command * ParsedCommand;
+    unsigned short ParsedCommandIndex;
+    unsigned short CommandCursor;
+    char EchoBuffer[2];
+    char* Arguments[MAX_CMD_ARGS + 1];
+    unsigned short TokenStart[MAX_CMD_ARGS + 1];
+    unsigned short TokenEnd[MAX_CMD_ARGS + 1];
+    // Every token of the line, never saturated so that backspaces undo it
+    unsigned short TokenCount;
+    unsigned short CommandCount;
     byte KeystrokeReceived : 1;
+    // Set on the sessions of a multiplexer that leave services to the first
+    byte ServicesDisabled : 1;
+    byte ConfigurationRejected : 1;
+#ifdef COMMANDS_ENABLE_QUOTES
+    byte QuotedLine : 1;
+#endif
+#ifdef COMMANDS_ENABLE_TYPED_ARGUMENTS
+    // Values of the arguments already parsed, of the type in ArgumentTypes
+    unsigned long ArgumentValues[MAX_CMD_ARGS];
+    byte ArgumentTypes[MAX_CMD_ARGS];
+#endif
+#if COMMANDS_DISPATCH_INDEX_SIZE > 0
+    byte DispatchIndexReady : 1;
+    byte DispatchIndex[COMMANDS_DISPATCH_INDEX_SIZE];
+#endif
+#if COMMANDS_COMPLETION_SIZE > 0
+    // Entries sorted by name, so the names sharing a prefix are adjacent
+    byte SortedEntries[COMMANDS_COMPLETION_SIZE];
+    byte SortedCount;
+#endif
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+    unsigned short OutputHead;
+    unsigned short OutputCount;
+    char OutputBuffer[COMMANDS_OUTPUT_BUFFER_SIZE];
+    char OutputChunk[COMMANDS_OUTPUT_CHUNK_SIZE + 1];
+    // Writes that did not fit in the ring while the transport was blocked
+    unsigned short OutputStalls;
+    // Characters that did not fit in the spill either
+    unsigned short OutputDropped;
+    unsigned short SpillHead;
+    unsigned short SpillCount;
+#if COMMANDS_OUTPUT_SPILL_SIZE > 0
+    char OutputSpill[COMMANDS_OUTPUT_SPILL_SIZE];
+#endif
+    // The rest of the output returned by a command step
+    const char* PendingOutput;
+    byte OutputBlocked;
+    byte OutputBlockedSignal;
+    // Written only by NotifyOutputReady
+    volatile byte OutputReadySignal;
+#endif
+#if COMMANDS_FRAME_PAYLOAD_SIZE > 0
+    byte FramedMode;
+    FrameDecoderStatus FrameDecoderStatus;
+    byte FrameType;
+    byte FrameLength;
+    byte FramePosition;
+    // FrameStatusOk, or the reason the incoming frame is refused
+    FrameStatus FrameRefusal;
+    unsigned short FrameCrc;
+    unsigned short FrameReceivedCrc;
+    byte FrameRequestPending;
+    FrameStatus FrameStatus;
+    byte AnsiStatus;
+    byte FramePayloadType;
+    byte FramePayloadLength;
+    char FramePayload[COMMANDS_FRAME_PAYLOAD_SIZE];
+#endif
+#ifdef COMMANDS_ENABLE_SCRIPTS
+    byte* ScriptStatuses;
+    unsigned short ScriptStatusSize;
+    ScriptSummary Script;
+    byte ScriptLineStatus;
+    byte ScriptRunning : 1;
+    byte ScriptStopped : 1;
+    byte ScriptContinueOnError : 1;
+    byte ScriptLineTooLong : 1;
+#endif
+#if COMMANDS_MAX_JOBS > 0
+    ApplicationEntry* Jobs[COMMANDS_MAX_JOBS];
+    byte JobAtLineStart[COMMANDS_MAX_JOBS];
+#ifdef COMMANDS_CONST_REGISTRIES
+    byte JobStates[COMMANDS_MAX_JOBS];
+#endif
+    // Jobs are numbered from 1, 0 when no job is running
+    byte CurrentJob;
+    byte NextJob;
+#endif
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+    const Filter* PipeFilter;
+    char* PipeArguments[MAX_CMD_ARGS + 1];
+    // Set while the command of the pipe runs, so only its output is filtered
+    byte PipeActive;
+    unsigned short PipeLength;
+    char PipeBuffer[COMMANDS_PIPE_BUFFER_SIZE + 1];
+    // Read by OnLine: its line continues an earlier piece, or goes on in the
+    // next one
+    byte PipeContinued : 1;
+    byte PipeUnterminated : 1;
+    // Free for the filter, 0 when the pipe starts
+    unsigned long PipeData;
+#endif
+#ifdef COMMANDS_PRIORITY_SCHEDULER
+    byte ServiceOrder[COMMANDS_MAX_SERVICES];
+    byte ServiceCredits[COMMANDS_MAX_SERVICES];
+    unsigned long ReadyServices[COMMANDS_SERVICE_BITMAP_WORDS];
+#endif
+#if COMMANDS_TIMER_WHEEL_SLOTS > 0
+    unsigned long LastTick;
+    unsigned long BlockedServices[COMMANDS_SERVICE_BITMAP_WORDS];
+    // Services not in the timer wheel, the priority scheduler does not start
+    // a round at 0
+    byte AwakeServices;
+    unsigned long ServiceDeadlines[COMMANDS_MAX_SERVICES];
+    byte NextSleepingService[COMMANDS_MAX_SERVICES];
+    byte TimerWheel[COMMANDS_TIMER_WHEEL_SLOTS];
+#endif
+#ifdef COMMANDS_ENABLE_MAILBOXES
+    // The mailbox each service waits on, NULL when it is not waiting
+    Mailbox* WaitingMailboxes[COMMANDS_MAX_SERVICES];
+    // Services waiting on an empty mailbox, skipped by the schedulers
+    unsigned long WaitingServices[COMMANDS_SERVICE_BITMAP_WORDS];
+#endif
+#ifdef COMMANDS_ENABLE_STATISTICS
+    ExecutionStatistics ServiceStatistics[COMMANDS_MAX_SERVICES];
+    ExecutionStatistics CommandStatistics[COMMANDS_MAX_COMMANDS];
+    // Calls of OnIdle and the cycles spent in them
+    ExecutionStatistics IdleStatistics;
+    // Cycles in and out of OnIdle, halved together before they overflow
+    unsigned long IdleCycles;
+    unsigned long BusyCycles;
+    unsigned long LastIdleEnd;
+#endif
+#if COMMANDS_TRACE_SIZE > 0
+    TraceRecord Trace[COMMANDS_TRACE_SIZE];
+    unsigned short TraceHead;
+    unsigned short TraceCount;
+    byte TracePaused;
+#endif
+#if COMMANDS_OUTPUT_CACHE_SIZE > 0
+    // Rendered outputs, one after the other, each with its terminator
+    char OutputCache[COMMANDS_OUTPUT_CACHE_SIZE];
+    const Command* CachedCommands[COMMANDS_OUTPUT_CACHE_ENTRIES];
+    unsigned short CachedLengths[COMMANDS_OUTPUT_CACHE_ENTRIES];
+    unsigned short OutputCacheUsed;
+    unsigned short RenderedLength;
+    byte CachedCount;
+    // Rendering lasts over the steps of a resumable command, capturing only
+    // while the command runs, not the services in between
+    byte OutputRendering : 1;
+    byte OutputCapturing : 1;
+#endif
+#if COMMANDS_INPUT_BUFFER_SIZE > 0
+    // Written only by the producer
+    volatile byte InputHead;
+    volatile byte InputOverruns;
+    // Written only by DoTasks
+    volatile byte InputTail;
+    byte InputOverrunsSeen;
+    byte InputBuffer[COMMANDS_INPUT_BUFFER_SIZE];
+#endif
 } CommandEngine;
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -131,11 +661,113 @@ typedef struct CommandEngine {
 
 // Basic command engine API
 void DoTasks(CommandEngine* commandEngine);
+byte DoTasksUntilIdle(CommandEngine* commandEngine, unsigned short maxSteps);
 void AddKeystroke(CommandEngine* commandEngine, unsigned char keystroke);
+unsigned short AddKeystrokes(CommandEngine* commandEngine, const byte* keystrokes, unsigned short length);
+
+// Argument API
+// Number of arguments of the running command, including those past
+// MAX_CMD_ARGS that are not in its arguments, up to 0xFF
+byte GetArgumentCount(CommandEngine* commandEngine);
+#ifdef COMMANDS_ENABLE_TYPED_ARGUMENTS
+// Arguments are numbered from 0, up to GetArgumentCount, those past
+// MAX_CMD_ARGS included. These return false when the argument is missing or
+// not of that type: a long in decimal, an unsigned long in hex with or
+// without 0x, or one of 0/1, off/on, no/yes and false/true.
+byte GetIntegerArgument(CommandEngine* commandEngine, byte index, long* value);
+byte GetHexArgument(CommandEngine* commandEngine, byte index, unsigned long* value);
+byte GetBooleanArgument(CommandEngine* commandEngine, byte index, byte* value);
+#endif
 
 // Application API
+// Closes the application in the foreground, or the job that calls it
 void CloseApplication(CommandEngine* commandEngine);
 
+// Job API
+// Jobs are numbered from 1. GetJob returns NULL for a free slot.
+ApplicationEntry* GetJob(CommandEngine* commandEngine, byte job);
+byte ForegroundJob(CommandEngine* commandEngine, byte job);
+byte KillJob(CommandEngine* commandEngine, byte job);
+
+// Framed mode API
+// Switches between the terminal and framed mode, returns whether framed
+// mode is now on
+byte SetFramedMode(CommandEngine* commandEngine, byte enabled);
+
+// Script API
+// Lines are run as they are completed, so the script can be given whole or
+// in chunks. A line fails when its command is not found, it starts an
+// application, which needs the terminal, or an error is written. Unless
+// continueOnError, the first line that fails ends the script. The status of
+// line n is stored in statuses[n - 1], for up to statusSize lines.
+// StartScript returns false while a command line is in progress.
+// RunScript returns how many characters it took. It stops after the line
+// of a resumable command, which runs a step per call of RunScript or
+// DoTasks, or while the transport is blocked; the caller gives the rest
+// again after DoTasks. Called with NULL, it starts the last line if it has
+// no line ending, returning 1 once done. Keystrokes wait until EndScript.
+byte StartScript(CommandEngine* commandEngine, byte continueOnError, byte* statuses, unsigned short statusSize);
+unsigned short RunScript(CommandEngine* commandEngine, const char* script, unsigned short length);
+byte IsScriptLineRunning(CommandEngine* commandEngine);
+// Returns true when no line failed, false as well while a line is running,
+// in which case the script is not ended
+byte EndScript(CommandEngine* commandEngine, ScriptSummary* summary);
+
+// Service API
+void SleepService(CommandEngine* commandEngine, unsigned long ticks);
+byte IsServiceSleeping(CommandEngine* commandEngine, byte serviceIndex);
+byte GetServiceState(CommandEngine* commandEngine, byte serviceIndex);
+
+// Mailbox API
+// PostToMailbox returns false, and counts the message as dropped, when the
+// mailbox is full. TakeFromMailbox returns false when it is empty.
+byte PostToMailbox(Mailbox* mailbox, Message message);
+byte TakeFromMailbox(Mailbox* mailbox, Message* message);
+byte GetMailboxDepth(const Mailbox* mailbox);
+// Returns the number of subscribers that received the message
+byte PublishToTopic(const Topic* topic, Message message);
+// The calling service is not run again until the mailbox holds a message
+void WaitForMessage(CommandEngine* commandEngine, Mailbox* mailbox);
+byte IsServiceWaiting(CommandEngine* commandEngine, byte serviceIndex);
+
+// Idle API
+byte IsEngineIdle(CommandEngine* commandEngine);
+
+// Helper API
+// Formats value in decimal into a buffer of NUMBER_BUFFER_SIZE characters
+// and returns the first digit
+char* UnsignedToString(unsigned long value, char* buffer);
+
+#ifdef COMMANDS_ENABLE_STATISTICS
+// Statistics API
+void WriteStatistics(CommandEngine* commandEngine, const ExecutionStatistics* statistics);
+// Percentage of the cycles spent outside of OnIdle
+byte GetDutyCycle(CommandEngine* commandEngine);
+#endif
+
+// Trace API
+// Copies the recorded events from the oldest one, returns false past the last
+byte ReadTrace(CommandEngine* commandEngine, unsigned short index, TraceRecord* record);
+// Nothing is recorded while paused, e.g. while the trace is dumped
+void PauseTrace(CommandEngine* commandEngine, byte paused);
+void ClearTrace(CommandEngine* commandEngine);
+
+// Output API
+void WriteOutput(CommandEngine* commandEngine, const char* string);
+void WriteErrorOutput(CommandEngine* commandEngine, const char* string);
+void FlushOutput(CommandEngine* commandEngine);
+// Drops the cached output of a command, or of all of them when NULL, to be
+// rendered again on its next call
+void InvalidateOutputCache(CommandEngine* commandEngine, const Command* command);
+// Called by the transport (e.g. a UART TX interrupt) when it can accept
+// data again after a short write of WriteToOutputNonBlocking
+void NotifyOutputReady(CommandEngine* commandEngine);
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+// Takes up to length characters of queued output, for output that is pulled
+// instead of written. A blocked engine resumes once everything was taken.
+unsigned short ReadOutput(CommandEngine* commandEngine, char* destination, unsigned short length);
+#endif
+
 #ifdef	__cplusplus
 }
 #endif
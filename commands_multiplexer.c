@@ -0,0 +1,175 @@
+#ifndef COMMANDS_MULTIPLEXER_C
+#define	COMMANDS_MULTIPLEXER_C
+
+#include <stdbool.h>
+
+#include "commands.h"
+#include "commands_multiplexer.h"
+
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+
+////////////////////////////////////////////////////////////////////////////////
+// Private methods declarations
+////////////////////////////////////////////////////////////////////////////////
+
+#define NoSession (0xFF)
+
+static void InitializeMultiplexer(CommandMultiplexer* multiplexer);
+static void WriteMultiplexedOutput(CommandMultiplexer* multiplexer);
+
+////////////////////////////////////////////////////////////////////////////////
+// Public methods
+////////////////////////////////////////////////////////////////////////////////
+
+void DoMultiplexerTasks(CommandMultiplexer* multiplexer)
+{
+    byte i = 0;
+
+    if (multiplexer->SessionCount == 0)
+    {
+        InitializeMultiplexer(multiplexer);
+    }
+
+    for(i = 0; i < multiplexer->SessionCount; ++i)
+    {
+        DoTasks(multiplexer->Sessions[i]);
+    }
+
+    WriteMultiplexedOutput(multiplexer);
+}
+
+void AddMultiplexedKeystroke(CommandMultiplexer* multiplexer, unsigned char keystroke)
+{
+    if (multiplexer->SessionCount == 0)
+    {
+        InitializeMultiplexer(multiplexer);
+    }
+
+    if (multiplexer->InputEscaped)
+    {
+        multiplexer->InputEscaped = false;
+
+        if (keystroke != MULTIPLEXER_ESCAPE)
+        {
+            // Unknown sessions are ignored
+            byte session = keystroke - '0';
+            if (session < multiplexer->SessionCount)
+            {
+                multiplexer->InputSession = session;
+            }
+
+            return;
+        }
+    }
+    else if (keystroke == MULTIPLEXER_ESCAPE)
+    {
+        multiplexer->InputEscaped = true;
+        return;
+    }
+
+    AddKeystroke(multiplexer->Sessions[multiplexer->InputSession], keystroke);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Private methods
+////////////////////////////////////////////////////////////////////////////////
+
+// Never accepts anything, the multiplexer takes the output with ReadOutput
+static unsigned short HoldOutput(const char* data, unsigned short length)
+{
+    return 0;
+}
+
+static void InitializeMultiplexer(CommandMultiplexer* multiplexer)
+{
+    byte i = 0;
+
+    for(i = 0; i < COMMANDS_MAX_SESSIONS && multiplexer->Sessions[i] != NULL; ++i)
+    {
+        // Errors go through the ring too, to reach the right session
+        multiplexer->Sessions[i]->WriteToOutput = NULL;
+        multiplexer->Sessions[i]->WriteError = NULL;
+        multiplexer->Sessions[i]->WriteToOutputNonBlocking = HoldOutput;
+        multiplexer->Sessions[i]->ServicesDisabled = i > 0;
+    }
+
+    multiplexer->SessionCount = i;
+    multiplexer->InputSession = 0;
+    multiplexer->OutputSession = NoSession;
+    multiplexer->NextSession = 0;
+}
+
+static void WriteMultiplexedOutput(CommandMultiplexer* multiplexer)
+{
+    while (true)
+    {
+        if (multiplexer->PendingLength > 0)
+        {
+            unsigned short accepted = multiplexer->WriteToTransport(
+                &multiplexer->Pending[multiplexer->PendingStart], multiplexer->PendingLength);
+
+            if (accepted > multiplexer->PendingLength)
+            {
+                accepted = multiplexer->PendingLength;
+            }
+
+            multiplexer->PendingStart += accepted;
+            multiplexer->PendingLength -= accepted;
+
+            if (multiplexer->PendingLength > 0)
+            {
+                // The transport is full, the rest goes on the next call
+                return;
+            }
+        }
+
+        // One chunk per session in turn, so that each gets its share
+        byte session = NoSession;
+        byte i = 0;
+        for(i = 0; i < multiplexer->SessionCount && session == NoSession; ++i)
+        {
+            if (multiplexer->Sessions[multiplexer->NextSession]->OutputCount > 0)
+            {
+                session = multiplexer->NextSession;
+            }
+
+            ++multiplexer->NextSession;
+            if (multiplexer->NextSession == multiplexer->SessionCount)
+            {
+                multiplexer->NextSession = 0;
+            }
+        }
+
+        if (session == NoSession)
+        {
+            return;
+        }
+
+        unsigned short length = 0;
+        if (session != multiplexer->OutputSession)
+        {
+            multiplexer->Pending[length++] = MULTIPLEXER_ESCAPE;
+            multiplexer->Pending[length++] = '0' + session;
+            multiplexer->OutputSession = session;
+        }
+
+        unsigned short count = ReadOutput(multiplexer->Sessions[session], multiplexer->Chunk, COMMANDS_OUTPUT_CHUNK_SIZE);
+        unsigned short j = 0;
+        for(j = 0; j < count; ++j)
+        {
+            if (multiplexer->Chunk[j] == MULTIPLEXER_ESCAPE)
+            {
+                multiplexer->Pending[length++] = MULTIPLEXER_ESCAPE;
+            }
+
+            multiplexer->Pending[length++] = multiplexer->Chunk[j];
+        }
+
+        multiplexer->PendingStart = 0;
+        multiplexer->PendingLength = length;
+    }
+}
+
+#endif
+
+#endif
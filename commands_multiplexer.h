@@ -0,0 +1,64 @@
+
+#ifndef COMMANDS_MULTIPLEXER_H
+#define	COMMANDS_MULTIPLEXER_H
+
+#include "commands.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////
+
+// Several sessions, each a CommandEngine with its own command line, running
+// application and key input state, share one transport. In both directions
+// MULTIPLEXER_ESCAPE followed by '0' + n switches to session n, and a
+// doubled MULTIPLEXER_ESCAPE stands for the character itself.
+//
+// The sessions are usually built on the same registries. Only the first one
+// runs the services. Their output is pulled from their output rings, one
+// chunk per session in turn, so the output ring is required. What a step
+// writes past the ring waits in the spill of its session until the ring is
+// read. The writers of the sessions are set by the multiplexer.
+
+#define MULTIPLEXER_ESCAPE (0x10)           // DLE, Data Link Escape
+
+#ifndef COMMANDS_MAX_SESSIONS
+#define COMMANDS_MAX_SESSIONS 8
+#endif
+
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+
+typedef struct CommandMultiplexer {
+    CommandEngine** Sessions;
+    NonBlockingWriterMethodType WriteToTransport;
+    // Private fields
+    byte SessionCount;
+    byte InputSession;
+    byte InputEscaped;
+    byte OutputSession;
+    byte NextSession;
+    unsigned short PendingStart;
+    unsigned short PendingLength;
+    // A session switch and a chunk where every character is escaped
+    char Pending[2 + 2 * COMMANDS_OUTPUT_CHUNK_SIZE];
+    char Chunk[COMMANDS_OUTPUT_CHUNK_SIZE];
+} CommandMultiplexer;
+
+////////////////////////////////////////////////////////////////////////////////
+// Public methods
+////////////////////////////////////////////////////////////////////////////////
+
+void DoMultiplexerTasks(CommandMultiplexer* multiplexer);
+void AddMultiplexedKeystroke(CommandMultiplexer* multiplexer, unsigned char keystroke);
+
+#endif
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* COMMANDS_MULTIPLEXER_H */
+
@@ -0,0 +1,87 @@
+
+#ifndef COMMANDS_REGISTRY_H
+#define	COMMANDS_REGISTRY_H
+
+#include "commands.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////
+
+// Registries generated from X-macro lists, instead of pointer arrays kept
+// in step with a hand written count. Each list takes the macro to apply to
+// its entries:
+//
+//   #define MY_COMMANDS(X) X(HelpCommand) X(ClearCommand)
+//   #define MY_APPLICATIONS(X) X(shell)
+//   #define MY_SERVICES(X) X(blink) X(logger)
+//
+//   COMMANDS_REGISTRY(my, MY_COMMANDS, MY_APPLICATIONS, MY_SERVICES)
+//
+// declares the NULL-terminated myCommands, myApplications and myServices and
+// the constants myCommandCount, myApplicationCount and myServiceCount. An
+// empty list is COMMANDS_REGISTRY_NONE. COMMANDS_REGISTRY_ENGINE(my) sets
+// them in the designated initializer of a CommandEngine:
+//
+//   CommandEngine engine = { .CommandBuffer = buffer,
+//       .CommandBufferSize = sizeof(buffer), COMMANDS_REGISTRY_ENGINE(my),
+//       .WriteToOutput = WriteUart };
+//
+// The arrays are const, so the compiler keeps them in flash. Declaring the
+// applications and services as ApplicationEntry and ServiceEntry keeps them
+// there too under COMMANDS_CONST_REGISTRIES. The build fails when there are
+// more services than COMMANDS_MAX_SERVICES, with those registries or the
+// priority scheduler.
+
+#define COMMANDS_REGISTRY_NONE(X)
+#define COMMANDS_REGISTRY_ENTRY(entry) &entry,
+#define COMMANDS_REGISTRY_COUNT(entry) + 1
+
+#if defined(COMMANDS_CONST_REGISTRIES) || defined(COMMANDS_PRIORITY_SCHEDULER)
+#define COMMANDS_REGISTRY_CHECK(prefix) \
+    typedef char prefix##ServicesFit[prefix##ServiceCount <= COMMANDS_MAX_SERVICES ? 1 : -1];
+#else
+#define COMMANDS_REGISTRY_CHECK(prefix)
+#endif
+
+#ifdef COMMANDS_CONST_REGISTRIES
+#define COMMANDS_REGISTRY_COUNTS(prefix) \
+    , .RegisteredCommandCount = prefix##CommandCount, \
+    .RegisteredApplicationCount = prefix##ApplicationCount, \
+    .RegisteredServiceCount = prefix##ServiceCount
+#else
+#define COMMANDS_REGISTRY_COUNTS(prefix)
+#endif
+
+#define COMMANDS_REGISTRY(prefix, commands, applications, services) \
+    enum { \
+        prefix##CommandCount = 0 commands(COMMANDS_REGISTRY_COUNT), \
+        prefix##ApplicationCount = 0 applications(COMMANDS_REGISTRY_COUNT), \
+        prefix##ServiceCount = 0 services(COMMANDS_REGISTRY_COUNT) \
+    }; \
+    COMMANDS_REGISTRY_CHECK(prefix) \
+    static const Command* const prefix##Commands[] = { \
+        commands(COMMANDS_REGISTRY_ENTRY) NULL \
+    }; \
+    static ApplicationEntry* const prefix##Applications[] = { \
+        applications(COMMANDS_REGISTRY_ENTRY) NULL \
+    }; \
+    static ServiceEntry* const prefix##Services[] = { \
+        services(COMMANDS_REGISTRY_ENTRY) NULL \
+    };
+
+#define COMMANDS_REGISTRY_ENGINE(prefix) \
+    .RegisteredCommands = prefix##Commands, \
+    .RegisteredApplications = prefix##Applications, \
+    .RegisteredServices = prefix##Services \
+    COMMANDS_REGISTRY_COUNTS(prefix)
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* COMMANDS_REGISTRY_H */
@@ -0,0 +1,183 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "commands.h"
+#include "command_help.h"
+
+// Engines on separate threads share only the constant registries: each runs
+// its own lines and checks every result it writes. Run by CTest in the
+// configurations of CMakeLists.txt.
+
+////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////
+
+#define TEST_THREADS 8
+#define TEST_LINES 2000
+#define TEST_BUFFER_SIZE 64
+#define TEST_OUTPUT_SIZE 4096
+#define TEST_STEPS 64
+
+////////////////////////////////////////////////////////////////////////////////
+// Output capture
+////////////////////////////////////////////////////////////////////////////////
+
+// The writers have no context, each thread captures the output of its engine
+static __thread char output[TEST_OUTPUT_SIZE];
+static __thread unsigned short outputLength;
+
+static void CaptureOutput(const char* string)
+{
+    while (*string != '\0' && outputLength < sizeof(output) - 1)
+    {
+        output[outputLength] = *string;
+        ++outputLength;
+        ++string;
+    }
+
+    output[outputLength] = '\0';
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Commands
+////////////////////////////////////////////////////////////////////////////////
+
+// Writes "= <sum>" of its arguments
+static byte* AddCommandImplementation(const char* args[], struct CommandEngine* commandEngine)
+{
+    char number[NUMBER_BUFFER_SIZE];
+    unsigned long sum = 0;
+
+    for(; *args != NULL; ++args)
+    {
+        sum += strtoul(*args, NULL, 10);
+    }
+
+    WriteOutput(commandEngine, CMD_CRLF "= ");
+    WriteOutput(commandEngine, UnsignedToString(sum, number));
+    WriteOutput(commandEngine, CMD_CRLF);
+
+    return NULL;
+}
+
+static const Command AddCommand = { "add", AddCommandImplementation, NULL };
+
+static const Command* registeredCommands[] = {
+    &HelpCommand,
+    &AddCommand,
+    NULL
+};
+
+static ApplicationEntry* noApplications[] = { NULL };
+static ServiceEntry* noServices[] = { NULL };
+
+////////////////////////////////////////////////////////////////////////////////
+// Workers
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct Worker {
+    pthread_t Thread;
+    unsigned Index;
+    unsigned Mismatches;
+} Worker;
+
+static void TypeLine(CommandEngine* commandEngine, const char* line)
+{
+    for(; *line != '\0'; ++line)
+    {
+        AddKeystroke(commandEngine, *line);
+        while (DoTasksUntilIdle(commandEngine, TEST_STEPS))
+        {
+        }
+    }
+}
+
+static void* RunWorker(void* argument)
+{
+    Worker * worker = argument;
+    byte buffer[TEST_BUFFER_SIZE];
+    CommandEngine commandEngine = {
+        .CommandBuffer = buffer, .CommandBufferSize = sizeof(buffer),
+        .RegisteredCommands = registeredCommands, .RegisteredApplications = noApplications,
+        .RegisteredServices = noServices, .WriteToOutput = CaptureOutput,
+        .WriteError = CaptureOutput, .Prompt = "> "
+    };
+    char line[TEST_BUFFER_SIZE];
+    char expected[TEST_BUFFER_SIZE];
+    unsigned i = 0;
+
+    // The first keystroke only shows the intro
+    TypeLine(&commandEngine, " ");
+
+    for(i = 0; i < TEST_LINES; ++i)
+    {
+        unsigned long first = worker->Index * 100000UL;
+
+        outputLength = 0;
+        output[0] = '\0';
+
+        // Other engines parse and dispatch meanwhile, between the lines too
+        if (i % 100 == 0)
+        {
+            TypeLine(&commandEngine, "help\r");
+            if (strstr(output, "Provides descriptions for commands.") == NULL)
+            {
+                ++worker->Mismatches;
+            }
+
+            outputLength = 0;
+            output[0] = '\0';
+        }
+
+        snprintf(line, sizeof(line), "add %lu %u\r", first, i);
+        snprintf(expected, sizeof(expected), CMD_CRLF "= %lu" CMD_CRLF "> ", first + i);
+        TypeLine(&commandEngine, line);
+
+        if (strstr(output, expected) == NULL)
+        {
+            ++worker->Mismatches;
+        }
+    }
+
+    return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(void)
+{
+    Worker workers[TEST_THREADS];
+    unsigned mismatches = 0;
+    unsigned i = 0;
+
+    for(i = 0; i < TEST_THREADS; ++i)
+    {
+        workers[i].Index = i;
+        workers[i].Mismatches = 0;
+
+        if (pthread_create(&workers[i].Thread, NULL, RunWorker, &workers[i]) != 0)
+        {
+            printf("commands_parallel_test.c: cannot start thread %u\n", i);
+            return 1;
+        }
+    }
+
+    for(i = 0; i < TEST_THREADS; ++i)
+    {
+        pthread_join(workers[i].Thread, NULL);
+
+        if (workers[i].Mismatches > 0)
+        {
+            printf("commands_parallel_test.c: engine %u: %u wrong results\n", i, workers[i].Mismatches);
+        }
+
+        mismatches += workers[i].Mismatches;
+    }
+
+    printf("%u engines, %u lines each, %u wrong results\n", TEST_THREADS, TEST_LINES, mismatches);
+    return mismatches != 0;
+}
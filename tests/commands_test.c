@@ -0,0 +1,1677 @@
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "commands.h"
+#include "command_filters.h"
+#include "command_jobs.h"
+#include "commands_multiplexer.h"
+#include "commands_registry.h"
+
+// Host tests of the engine, run by CTest. Each feature is tested when its
+// configuration, from the compile definitions of this executable, has it;
+// see CMakeLists.txt.
+
+////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////
+
+#define TEST_BUFFER_SIZE 1024
+#define TEST_OUTPUT_SIZE 8192
+#define TEST_STEPS 64
+
+#define CHECK(condition) Check((condition) != 0, #condition, __LINE__)
+
+static unsigned failures;
+static unsigned checks;
+
+static void Check(int passed, const char* condition, int line)
+{
+    ++checks;
+    if (!passed)
+    {
+        ++failures;
+        printf("commands_test.c:%d: failed: %s\n", line, condition);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Output capture
+////////////////////////////////////////////////////////////////////////////////
+
+static char output[TEST_OUTPUT_SIZE];
+static unsigned short outputLength;
+
+static void ClearOutput(void)
+{
+    outputLength = 0;
+    output[0] = '\0';
+}
+
+static unsigned short CaptureData(const char* data, unsigned short length)
+{
+    if (length > sizeof(output) - 1 - outputLength)
+    {
+        length = sizeof(output) - 1 - outputLength;
+    }
+
+    memcpy(&output[outputLength], data, length);
+    outputLength += length;
+    output[outputLength] = '\0';
+
+    return length;
+}
+
+static void CaptureOutput(const char* string)
+{
+    CaptureData(string, strlen(string));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Commands
+////////////////////////////////////////////////////////////////////////////////
+
+static char lastArguments[MAX_CMD_ARGS][32];
+static byte lastArgumentCount;
+static unsigned argsRuns;
+
+static byte* ArgsCommandImplementation(const char* args[], struct CommandEngine* commandEngine)
+{
+    byte i = 0;
+
+    ++argsRuns;
+    lastArgumentCount = GetArgumentCount(commandEngine);
+
+    for(i = 0; i < MAX_CMD_ARGS; ++i)
+    {
+        lastArguments[i][0] = '\0';
+    }
+
+    for(i = 0; i < MAX_CMD_ARGS && args[i] != NULL; ++i)
+    {
+        snprintf(lastArguments[i], sizeof(lastArguments[i]), "%s", args[i]);
+    }
+
+    return NULL;
+}
+
+static byte* LinesCommandImplementation(const char* args[], struct CommandEngine* commandEngine)
+{
+    WriteOutput(commandEngine, "alpha" CMD_CRLF "beta" CMD_CRLF CMD_CRLF "gamma" CMD_CRLF);
+    return NULL;
+}
+
+static byte* FailCommandImplementation(const char* args[], struct CommandEngine* commandEngine)
+{
+    WriteErrorOutput(commandEngine, "failed" CMD_CRLF);
+    return NULL;
+}
+
+#ifdef COMMANDS_ENABLE_TYPED_ARGUMENTS
+static long integerValue;
+static unsigned long hexValue;
+static byte booleanValue;
+static byte typedResults;
+
+static byte* TypedCommandImplementation(const char* args[], struct CommandEngine* commandEngine)
+{
+    long unused = 0;
+
+    typedResults = GetIntegerArgument(commandEngine, 0, &integerValue)
+        | GetHexArgument(commandEngine, 1, &hexValue) << 1
+        | GetBooleanArgument(commandEngine, 2, &booleanValue) << 2
+        | GetIntegerArgument(commandEngine, 1, &unused) << 3
+        | GetIntegerArgument(commandEngine, 2, &unused) << 4;
+
+    return NULL;
+}
+
+static long sumValue;
+static byte sumResult;
+
+// Adds all of its arguments, those past MAX_CMD_ARGS too
+static byte* SumCommandImplementation(const char* args[], struct CommandEngine* commandEngine)
+{
+    long value = 0;
+    byte i = 0;
+
+    sumValue = 0;
+    sumResult = 1;
+    for(i = 0; i < GetArgumentCount(commandEngine); ++i)
+    {
+        sumResult &= GetIntegerArgument(commandEngine, i, &value);
+        sumValue += value;
+    }
+
+    return NULL;
+}
+#endif
+
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+static char* Repeat(char* destination, char value, unsigned short count)
+{
+    memset(destination, value, count);
+    return destination + count;
+}
+
+// Lines longer than the pipe buffer: the text split by the end of the first
+// piece, found in the first piece, not found, and a line that fills the
+// buffer exactly
+static byte* LongCommandImplementation(const char* args[], struct CommandEngine* commandEngine)
+{
+    static char lines[4 * (COMMANDS_PIPE_BUFFER_SIZE + 16)];
+    char * position = lines;
+
+    position = Repeat(position, 'x', COMMANDS_PIPE_BUFFER_SIZE - 2);
+    strcpy(position, "needle");
+    position = Repeat(position + 6, 'y', 8);
+    strcpy(position, CMD_CRLF "needle");
+    position = Repeat(position + 8, 'z', COMMANDS_PIPE_BUFFER_SIZE);
+    strcpy(position, CMD_CRLF);
+    position = Repeat(position + 2, 'w', COMMANDS_PIPE_BUFFER_SIZE + 12);
+    strcpy(position, CMD_CRLF);
+    position = Repeat(position + 2, 'v', COMMANDS_PIPE_BUFFER_SIZE);
+    strcpy(position, CMD_CRLF);
+
+    WriteOutput(commandEngine, lines);
+    return NULL;
+}
+#endif
+
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+// Writes one and a half output rings in a single step
+static byte* FloodCommandImplementation(const char* args[], struct CommandEngine* commandEngine)
+{
+    static char half[COMMANDS_OUTPUT_BUFFER_SIZE / 2 + 1];
+    unsigned short i = 0;
+
+    for(i = 0; i < sizeof(half) - 1; ++i)
+    {
+        half[i] = 'a' + i % 26;
+    }
+
+    for(i = 0; i < 3; ++i)
+    {
+        WriteOutput(commandEngine, half);
+    }
+
+    return NULL;
+}
+#endif
+
+#if COMMANDS_OUTPUT_CACHE_SIZE > 0
+static unsigned renders;
+
+// Cached commands, which count how often they run
+static byte* CachedCommandImplementation(const char* args[], struct CommandEngine* commandEngine)
+{
+    ++renders;
+    WriteOutput(commandEngine, "rendered ");
+    WriteOutput(commandEngine, args[0] != NULL ? args[0] : "once");
+    WriteOutput(commandEngine, CMD_CRLF);
+    return NULL;
+}
+
+static byte* CachedFailCommandImplementation(const char* args[], struct CommandEngine* commandEngine)
+{
+    ++renders;
+    WriteOutput(commandEngine, "rendered" CMD_CRLF);
+    WriteErrorOutput(commandEngine, "failed" CMD_CRLF);
+    return NULL;
+}
+#endif
+
+#if COMMANDS_MAX_JOBS > 0
+static unsigned tickerRuns;
+static unsigned tickerCloses;
+
+// An application that runs on every pass until it is closed
+static void TickerStart(const char* args[], struct CommandEngine* commandEngine)
+{
+    WriteOutput(commandEngine, "started" CMD_CRLF);
+}
+
+static void TickerInput(const char input, struct CommandEngine* commandEngine)
+{
+}
+
+static byte TickerRun(byte step, struct CommandEngine* commandEngine)
+{
+    ++tickerRuns;
+    return step;
+}
+
+static void TickerClose(struct CommandEngine* commandEngine)
+{
+    ++tickerCloses;
+}
+
+static Application TickerApplication = { "ticker", NULL, TickerInput, TickerStart, TickerClose, TickerRun };
+#endif
+
+static const Command ArgsCommand = { "args", ArgsCommandImplementation, NULL };
+static const Command LinesCommand = { "lines", LinesCommandImplementation, NULL };
+static const Command FailCommand = { "fail", FailCommandImplementation, NULL };
+#ifdef COMMANDS_ENABLE_TYPED_ARGUMENTS
+static const Command TypedCommand = { "typed", TypedCommandImplementation, NULL };
+static const Command SumCommand = { "sum", SumCommandImplementation, NULL };
+#endif
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+static const Command LongCommand = { "long", LongCommandImplementation, NULL };
+#endif
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+static const Command FloodCommand = { "flood", FloodCommandImplementation, NULL };
+#endif
+#if COMMANDS_OUTPUT_CACHE_SIZE > 0
+static const Command CachedCommand = { "cached", CachedCommandImplementation, NULL, NULL, 1 };
+static const Command CachedFailCommand = { "cachedfail", CachedFailCommandImplementation, NULL, NULL, 1 };
+#endif
+
+static const Command* registeredCommands[] = {
+    &ArgsCommand,
+    &LinesCommand,
+    &FailCommand,
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+    &LongCommand,
+#endif
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+    &FloodCommand,
+#endif
+#if COMMANDS_OUTPUT_CACHE_SIZE > 0
+    &CachedCommand,
+    &CachedFailCommand,
+#endif
+#ifdef COMMANDS_ENABLE_TYPED_ARGUMENTS
+    &TypedCommand,
+    &SumCommand,
+#endif
+#if COMMANDS_MAX_JOBS > 0
+    &JobsCommand,
+    &ForegroundCommand,
+    &KillCommand,
+#endif
+    NULL
+};
+
+static ApplicationEntry* registeredApplications[] = {
+#if COMMANDS_MAX_JOBS > 0
+    &TickerApplication,
+#endif
+    NULL
+};
+
+static ApplicationEntry* noApplications[] = { NULL };
+static ServiceEntry* noServices[] = { NULL };
+static const Filter* registeredFilters[] = { &GrepFilter, &CountFilter, NULL };
+
+////////////////////////////////////////////////////////////////////////////////
+// Engine
+////////////////////////////////////////////////////////////////////////////////
+
+static byte buffer[TEST_BUFFER_SIZE];
+
+static CommandEngine terminalEngine = {
+    .CommandBuffer = buffer, .CommandBufferSize = sizeof(buffer),
+    .RegisteredCommands = registeredCommands, .RegisteredApplications = registeredApplications,
+    .RegisteredServices = noServices, .WriteToOutput = CaptureOutput,
+    .WriteError = CaptureOutput, .Prompt = "> ", .RegisteredFilters = registeredFilters
+};
+
+static void RunUntilIdle(CommandEngine* commandEngine)
+{
+    while (DoTasksUntilIdle(commandEngine, TEST_STEPS))
+    {
+    }
+}
+
+static void Type(CommandEngine* commandEngine, const char* keystrokes)
+{
+    for(; *keystrokes != '\0'; ++keystrokes)
+    {
+        AddKeystroke(commandEngine, *keystrokes);
+        RunUntilIdle(commandEngine);
+    }
+}
+
+static void TypeRepeated(CommandEngine* commandEngine, const char* keystrokes, unsigned count)
+{
+    unsigned i = 0;
+    for(i = 0; i < count; ++i)
+    {
+        Type(commandEngine, keystrokes);
+    }
+}
+
+static void StartEngine(CommandEngine* commandEngine)
+{
+    // The first keystroke only shows the intro
+    AddKeystroke(commandEngine, ' ');
+    RunUntilIdle(commandEngine);
+    ClearOutput();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Tokenizer
+////////////////////////////////////////////////////////////////////////////////
+
+static void TestTokenizer(void)
+{
+    unsigned runs = argsRuns;
+
+    Type(&terminalEngine, "args  one two   three\r");
+    CHECK(argsRuns == runs + 1);
+    CHECK(lastArgumentCount == 3);
+    CHECK(strcmp(lastArguments[0], "one") == 0);
+    CHECK(MAX_CMD_ARGS < 3 || strcmp(lastArguments[2], "three") == 0);
+
+    Type(&terminalEngine, "args\r");
+    CHECK(lastArgumentCount == 0);
+    CHECK(lastArguments[0][0] == '\0');
+
+    // Arguments past MAX_CMD_ARGS are counted, not kept
+    Type(&terminalEngine, "args a b c d e f g h i j\r");
+    CHECK(lastArgumentCount == 10);
+    CHECK(lastArguments[MAX_CMD_ARGS - 1][0] == 'a' + MAX_CMD_ARGS - 1);
+
+    // Blank lines run nothing
+    runs = argsRuns;
+    Type(&terminalEngine, "   \r");
+    CHECK(argsRuns == runs);
+}
+
+static void TestBackspace(void)
+{
+    char backspaces[2] = { BACKSPACE_ASCII, '\0' };
+
+    // Removing a separator reopens the token before it
+    Type(&terminalEngine, "args ab c");
+    TypeRepeated(&terminalEngine, backspaces, 2);
+    Type(&terminalEngine, "d\r");
+    CHECK(lastArgumentCount == 1);
+    CHECK(strcmp(lastArguments[0], "abd") == 0);
+
+    // Removing the first character of a token removes the token
+    Type(&terminalEngine, "args x y");
+    TypeRepeated(&terminalEngine, backspaces, 1);
+    Type(&terminalEngine, "\r");
+    CHECK(lastArgumentCount == 1);
+    CHECK(strcmp(lastArguments[0], "x") == 0);
+
+    // More tokens than a byte counts are undone one by one
+    Type(&terminalEngine, "args");
+    TypeRepeated(&terminalEngine, " a", 300);
+    TypeRepeated(&terminalEngine, backspaces, 600);
+    Type(&terminalEngine, " z\r");
+    CHECK(lastArgumentCount == 1);
+    CHECK(strcmp(lastArguments[0], "z") == 0);
+
+    Type(&terminalEngine, "args");
+    TypeRepeated(&terminalEngine, " a", 300);
+    Type(&terminalEngine, "\r");
+    CHECK(lastArgumentCount == 0xFF);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Dispatch
+////////////////////////////////////////////////////////////////////////////////
+
+// More than the dispatch index takes, so the linear scan runs past it
+#define TEST_DISPATCH_COMMANDS 256
+
+static char dispatchNames[TEST_DISPATCH_COMMANDS][8];
+static Command dispatchCommands[TEST_DISPATCH_COMMANDS];
+static const Command* dispatchRegistry[TEST_DISPATCH_COMMANDS + 2];
+static const Command* lastDispatched;
+
+static byte* DispatchedCommandImplementation(const char* args[], struct CommandEngine* commandEngine)
+{
+    lastDispatched = commandEngine->ParsedCommand;
+    return NULL;
+}
+
+// A second registration of a name, which is never dispatched
+static const Command DuplicateCommand = { "c1", DispatchedCommandImplementation, NULL };
+
+// Registers count commands and the duplicate, and types each name
+static void CheckDispatch(unsigned short count)
+{
+    static byte dispatchBuffer[TEST_BUFFER_SIZE];
+    CommandEngine dispatchEngine = {
+        .CommandBuffer = dispatchBuffer, .CommandBufferSize = sizeof(dispatchBuffer),
+        .RegisteredCommands = dispatchRegistry, .RegisteredApplications = noApplications,
+        .RegisteredServices = noServices, .WriteToOutput = CaptureOutput,
+        .WriteError = CaptureOutput, .Prompt = "> "
+    };
+    char line[16];
+    unsigned short mismatches = 0;
+    unsigned short i = 0;
+
+    for(i = 0; i < count; ++i)
+    {
+        dispatchRegistry[i] = &dispatchCommands[i];
+    }
+    dispatchRegistry[count] = &DuplicateCommand;
+    dispatchRegistry[count + 1] = NULL;
+
+    StartEngine(&dispatchEngine);
+#if COMMANDS_DISPATCH_INDEX_SIZE > 0
+    // An empty slot ends every probe, and entries are numbered in a byte
+    CHECK(dispatchEngine.DispatchIndexReady
+        == (count + 1 < COMMANDS_DISPATCH_INDEX_SIZE && count + 1 < 0xFF));
+#endif
+
+    for(i = 0; i < count; ++i)
+    {
+        lastDispatched = NULL;
+        snprintf(line, sizeof(line), "%s\r", dispatchNames[i]);
+        Type(&dispatchEngine, line);
+        mismatches += lastDispatched != &dispatchCommands[i];
+    }
+    CHECK(mismatches == 0);
+
+    // Neither a prefix nor a longer name is taken
+    lastDispatched = NULL;
+    Type(&dispatchEngine, "c\r");
+    Type(&dispatchEngine, "c10x\r");
+    CHECK(lastDispatched == NULL);
+    ClearOutput();
+}
+
+static void TestDispatch(void)
+{
+    unsigned short i = 0;
+
+    for(i = 0; i < TEST_DISPATCH_COMMANDS; ++i)
+    {
+        snprintf(dispatchNames[i], sizeof(dispatchNames[i]), "c%u", i);
+        dispatchCommands[i].Name = dispatchNames[i];
+        dispatchCommands[i].Execute = DispatchedCommandImplementation;
+    }
+
+    // With the index when it takes them, then one entry past its 254
+    CheckDispatch(253);
+    CheckDispatch(254);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Quotes and typed arguments
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef COMMANDS_ENABLE_QUOTES
+static void TestQuotes(void)
+{
+    Type(&terminalEngine, "args \"a b\" c\\\"d \"\"\r");
+    CHECK(lastArgumentCount == 3);
+    CHECK(strcmp(lastArguments[0], "a b") == 0);
+    CHECK(strcmp(lastArguments[1], "c\"d") == 0);
+    CHECK(MAX_CMD_ARGS < 3 || lastArguments[2][0] == '\0');
+
+    Type(&terminalEngine, "args x\\ y\r");
+    CHECK(lastArgumentCount == 1);
+    CHECK(strcmp(lastArguments[0], "x y") == 0);
+}
+#endif
+
+#ifdef COMMANDS_ENABLE_TYPED_ARGUMENTS
+static void TestTypedArguments(void)
+{
+    Type(&terminalEngine, "typed -12 0x1f yes\r");
+    CHECK(typedResults == 0x07);
+    CHECK(integerValue == -12);
+    CHECK(hexValue == 0x1F);
+    CHECK(booleanValue == 1);
+
+    char line[TEST_BUFFER_SIZE];
+    char hex[sizeof(unsigned long) * 2 + 1];
+
+    // The limits are those of a long and an unsigned long
+    snprintf(line, sizeof(line), "typed %ld %lx 0\r", LONG_MIN, ULONG_MAX);
+    Type(&terminalEngine, line);
+    CHECK(typedResults == 0x17);
+    CHECK(integerValue == LONG_MIN);
+    CHECK(hexValue == ULONG_MAX);
+
+    memset(hex, '0', sizeof(hex) - 1);
+    hex[sizeof(hex) - 1] = '\0';
+    snprintf(line, sizeof(line), "typed %lu f%s maybe\r", (unsigned long)LONG_MAX + 1, hex);
+    Type(&terminalEngine, line);
+    CHECK(typedResults == 0x00);
+
+    Type(&terminalEngine, "typed +7 FF off\r");
+    CHECK(typedResults == 0x07);
+    CHECK(integerValue == 7);
+    CHECK(hexValue == 0xFF);
+    CHECK(booleanValue == 0);
+
+    Type(&terminalEngine, "typed 1 10 1\r");
+    CHECK(typedResults == 0x1F);
+
+    // Arguments past MAX_CMD_ARGS are read as well
+    Type(&terminalEngine, "sum 1 2 3 4  5 6\r");
+    CHECK(sumResult && sumValue == 21);
+    Type(&terminalEngine, "sum 1 2 3 4 x\r");
+    CHECK(!sumResult);
+#ifdef COMMANDS_ENABLE_QUOTES
+    Type(&terminalEngine, "sum \"1\" 2 3 \"4\" \" 5\" 6\r");
+    CHECK(!sumResult);
+    Type(&terminalEngine, "sum 1 2 \"3\" \"4\" \"\"5 6\r");
+    CHECK(sumResult && sumValue == 21);
+#endif
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+    Type(&terminalEngine, "sum 1 2 3 4 5 | count\r");
+    CHECK(sumResult && sumValue == 15);
+#endif
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Pipes and completion
+////////////////////////////////////////////////////////////////////////////////
+
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+static int OutputContains(const char* text)
+{
+    return strstr(output, text) != NULL;
+}
+
+static void TestPipes(void)
+{
+    ClearOutput();
+    Type(&terminalEngine, "lines | grep et\r");
+    CHECK(OutputContains("beta" CMD_CRLF));
+    CHECK(!OutputContains("alpha"));
+    CHECK(!OutputContains("gamma"));
+
+    ClearOutput();
+    Type(&terminalEngine, "lines | count\r");
+    CHECK(OutputContains(CMD_CRLF "4" CMD_CRLF));
+
+    // The typed line holds the text too, so only what follows it is kept
+    char expected[COMMANDS_PIPE_BUFFER_SIZE + 16];
+    Type(&terminalEngine, "long | grep needle");
+    ClearOutput();
+    Type(&terminalEngine, "\r");
+    strcpy(Repeat(expected, 'y', 8), CMD_CRLF);
+    CHECK(OutputContains(expected));
+    CHECK(OutputContains(CMD_CRLF "edleyyyy"));
+    CHECK(!OutputContains("xxx"));
+    strcpy(Repeat(expected, 'z', COMMANDS_PIPE_BUFFER_SIZE), CMD_CRLF);
+    CHECK(OutputContains(expected));
+    CHECK(OutputContains("needlezzz"));
+    CHECK(!OutputContains("www"));
+    CHECK(!OutputContains("vvv"));
+
+    ClearOutput();
+    Type(&terminalEngine, "long | count\r");
+    CHECK(OutputContains(CMD_CRLF "4" CMD_CRLF));
+
+    // Each piece of the lines, without a text
+    ClearOutput();
+    Type(&terminalEngine, "long | grep\r");
+    strcpy(Repeat(expected, 'v', COMMANDS_PIPE_BUFFER_SIZE), CMD_CRLF);
+    CHECK(OutputContains(expected));
+    CHECK(OutputContains("xneedle"));
+
+    ClearOutput();
+    Type(&terminalEngine, "lines | nothing\r");
+    CHECK(OutputContains("Filter 'nothing' not found"));
+}
+#endif
+
+#if COMMANDS_COMPLETION_SIZE > 0
+static void TestCompletion(void)
+{
+    char tab[2] = { TAB_ASCII, '\0' };
+
+    // A unique prefix is completed with a space
+    Type(&terminalEngine, "ar");
+    Type(&terminalEngine, tab);
+    Type(&terminalEngine, "q\r");
+    CHECK(lastArgumentCount == 1);
+    CHECK(strcmp(lastArguments[0], "q") == 0);
+
+    // Unique abbreviations are run as the whole name
+    Type(&terminalEngine, "a r\r");
+    CHECK(lastArgumentCount == 1);
+    CHECK(strcmp(lastArguments[0], "r") == 0);
+
+    // Arguments are not completed
+    Type(&terminalEngine, "args l");
+    Type(&terminalEngine, tab);
+    Type(&terminalEngine, "\r");
+    CHECK(lastArgumentCount == 1);
+    CHECK(strcmp(lastArguments[0], "l") == 0);
+
+    // Nor are names that match nothing
+    unsigned runs = argsRuns;
+    Type(&terminalEngine, "x");
+    Type(&terminalEngine, tab);
+    Type(&terminalEngine, "\r");
+    CHECK(argsRuns == runs);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Framed mode
+////////////////////////////////////////////////////////////////////////////////
+
+#if COMMANDS_FRAME_PAYLOAD_SIZE > 0
+
+// Written independently of the engine, CRC-16/CCITT from 0xFFFF
+static unsigned short FrameCrc(const byte* data, unsigned short length)
+{
+    unsigned short crc = 0xFFFF;
+    unsigned short i = 0;
+    byte bit = 0;
+
+    for(i = 0; i < length; ++i)
+    {
+        crc ^= (unsigned short)data[i] << 8;
+        for(bit = 0; bit < 8; ++bit)
+        {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+static void SendRequest(CommandEngine* commandEngine, byte type, const char* payload, byte corrupt)
+{
+    byte frame[0x110];
+    byte length = strlen(payload);
+    unsigned short i = 0;
+
+    frame[0] = FRAME_START;
+    frame[1] = type;
+    frame[2] = length;
+    memcpy(&frame[3], payload, length);
+
+    unsigned short crc = FrameCrc(&frame[1], length + 2) ^ corrupt;
+    frame[length + 3] = crc >> 8;
+    frame[length + 4] = crc & 0xFF;
+
+    for(i = 0; i < length + 5; ++i)
+    {
+        AddKeystroke(commandEngine, frame[i]);
+        RunUntilIdle(commandEngine);
+    }
+}
+
+// Where the done frame of the last response ends in the output
+static unsigned short responseEnd;
+
+// Decodes the captured frames: the payloads of the output frames, joined,
+// and the status of the done frame, or 0xFF without one
+static byte DecodeResponse(char* text, unsigned short size)
+{
+    unsigned short position = 0;
+    unsigned short length = 0;
+    byte status = 0xFF;
+
+    text[0] = '\0';
+
+    while (position + 5 <= outputLength)
+    {
+        const byte * frame = (const byte *)&output[position];
+        byte payload = frame[2];
+
+        CHECK(frame[0] == FRAME_START);
+        CHECK(payload <= COMMANDS_FRAME_PAYLOAD_SIZE);
+        if (frame[0] != FRAME_START || position + payload + 5 > outputLength)
+        {
+            return 0xFE;
+        }
+
+        unsigned short crc = FrameCrc(&frame[1], payload + 2);
+        CHECK(frame[payload + 3] == crc >> 8 && frame[payload + 4] == (crc & 0xFF));
+
+        if (frame[1] == OutputFrame && length + payload < size)
+        {
+            memcpy(&text[length], &frame[3], payload);
+            length += payload;
+            text[length] = '\0';
+        }
+        else if (frame[1] == DoneFrame && payload == 1)
+        {
+            status = frame[3];
+        }
+
+        position += payload + 5;
+
+        if (frame[1] == DoneFrame)
+        {
+            break;
+        }
+    }
+
+    responseEnd = position;
+    return status;
+}
+
+static void TestFrames(void)
+{
+    static byte framedBuffer[TEST_BUFFER_SIZE];
+    CommandEngine framedEngine = {
+        .CommandBuffer = framedBuffer, .CommandBufferSize = sizeof(framedBuffer),
+        .RegisteredCommands = registeredCommands, .RegisteredApplications = noApplications,
+        .RegisteredServices = noServices, .Prompt = "> ",
+        .WriteToOutputNonBlocking = CaptureData
+    };
+    char text[256];
+    unsigned short i = 0;
+
+    StartEngine(&framedEngine);
+    CHECK(SetFramedMode(&framedEngine, 1));
+    RunUntilIdle(&framedEngine);
+
+    ClearOutput();
+    SendRequest(&framedEngine, CommandFrame, "args 1 2", 0);
+    CHECK(DecodeResponse(text, sizeof(text)) == FrameStatusOk);
+    CHECK(responseEnd == outputLength);
+    CHECK(lastArgumentCount == 2);
+    CHECK(strcmp(lastArguments[1], "2") == 0);
+
+    // Output longer than a payload is split across frames
+    ClearOutput();
+    SendRequest(&framedEngine, CommandFrame, "lines", 0);
+    CHECK(DecodeResponse(text, sizeof(text)) == FrameStatusOk);
+    CHECK(strcmp(text, "alpha" CMD_CRLF "beta" CMD_CRLF CMD_CRLF "gamma" CMD_CRLF) == 0);
+    CHECK(responseEnd == outputLength);
+
+    ClearOutput();
+    SendRequest(&framedEngine, CommandFrame, "fail", 0);
+    CHECK(DecodeResponse(text, sizeof(text)) == FrameStatusError);
+
+    ClearOutput();
+    SendRequest(&framedEngine, CommandFrame, "bogus", 0);
+    CHECK(DecodeResponse(text, sizeof(text)) == FrameStatusNotFound);
+
+#if COMMANDS_COMPLETION_SIZE > 0
+    // Requests give whole names
+    ClearOutput();
+    SendRequest(&framedEngine, CommandFrame, "ar 5", 0);
+    CHECK(DecodeResponse(text, sizeof(text)) == FrameStatusNotFound);
+#endif
+
+    ClearOutput();
+    unsigned runs = argsRuns;
+    SendRequest(&framedEngine, CommandFrame, "args 3", 1);
+    CHECK(DecodeResponse(text, sizeof(text)) == FrameStatusBadCrc);
+    CHECK(argsRuns == runs);
+
+    ClearOutput();
+    SendRequest(&framedEngine, 'X', "", 0);
+    CHECK(DecodeResponse(text, sizeof(text)) == FrameStatusUnsupported);
+
+    // Bytes between frames are skipped
+    ClearOutput();
+    for(i = 0; i < 3; ++i)
+    {
+        AddKeystroke(&framedEngine, 'n');
+    }
+    SendRequest(&framedEngine, CommandFrame, "args 4", 0);
+    CHECK(DecodeResponse(text, sizeof(text)) == FrameStatusOk);
+    CHECK(strcmp(lastArguments[0], "4") == 0);
+
+    ClearOutput();
+    // Answered in framed mode, then the prompt is back
+    SendRequest(&framedEngine, HumanModeFrame, "", 0);
+    CHECK(DecodeResponse(text, sizeof(text)) == FrameStatusOk);
+    CHECK(!framedEngine.FramedMode);
+    CHECK(strstr(&output[responseEnd], "> ") != NULL);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Services
+////////////////////////////////////////////////////////////////////////////////
+
+static byte serviceBuffer[TEST_BUFFER_SIZE];
+
+// The Data of each service, in the order they ran
+static char serviceRuns[64];
+static byte serviceRunCount;
+
+static void ClearServiceRuns(void)
+{
+    serviceRunCount = 0;
+    serviceRuns[0] = '\0';
+}
+
+static void RecordServiceRun(void* data)
+{
+    if (serviceRunCount < sizeof(serviceRuns) - 1)
+    {
+        serviceRuns[serviceRunCount] = *(const char*)data;
+        ++serviceRunCount;
+        serviceRuns[serviceRunCount] = '\0';
+    }
+}
+
+static byte RecordingServiceRun(byte state, void* data, struct CommandEngine* commandEngine)
+{
+    RecordServiceRun(data);
+    return state;
+}
+
+// Runs the given number of loop passes, each of which gives a service a slot
+static void RunServicePasses(CommandEngine* commandEngine, unsigned passes)
+{
+    while (passes > 0)
+    {
+        if (commandEngine->Status == ExecuteServicesStatus)
+        {
+            --passes;
+        }
+
+        DoTasks(commandEngine);
+    }
+}
+
+static void TestScheduling(void)
+{
+    static Service low = { "low", NULL, RecordingServiceRun, Starting, "L", 1, 1 };
+    static Service high = { "high", NULL, RecordingServiceRun, Starting, "H", 3, 2 };
+    static Service same = { "same", NULL, RecordingServiceRun, Starting, "S", 3, 0 };
+    static Service stopped = { "stopped", NULL, RecordingServiceRun, Stopped, "X", 9, 1 };
+    ServiceEntry* services[] = { &low, &high, &same, &stopped, NULL };
+    CommandEngine serviceEngine = {
+        .CommandBuffer = serviceBuffer, .CommandBufferSize = sizeof(serviceBuffer),
+        .RegisteredCommands = registeredCommands, .RegisteredApplications = noApplications,
+        .RegisteredServices = services
+    };
+
+    ClearServiceRuns();
+    RunServicePasses(&serviceEngine, 8);
+#ifdef COMMANDS_PRIORITY_SCHEDULER
+    // Highest priority first, equal ones in registration order, each for its
+    // Weight slots per round and a Weight of 0 for one
+    CHECK(strcmp(serviceRuns, "HHSLHHSL") == 0);
+#else
+    CHECK(strcmp(serviceRuns, "LHSLHSLH") == 0);
+#endif
+}
+
+#if COMMANDS_TIMER_WHEEL_SLOTS > 0
+static unsigned long ticks;
+
+static unsigned long GetTestTicks(void)
+{
+    return ticks;
+}
+
+// The Data of a sleeping service: its letter, first, and how long it sleeps
+typedef struct SleepingData {
+    char Letter;
+    unsigned long Ticks;
+} SleepingData;
+
+static byte SleepingServiceRun(byte state, void* data, struct CommandEngine* commandEngine)
+{
+    RecordServiceRun(data);
+    SleepService(commandEngine, ((SleepingData*)data)->Ticks);
+    return state;
+}
+
+static void TestSleepingServices(void)
+{
+    // The long sleep takes several turns of the wheel
+    static SleepingData shortSleep = { 'S', 5 };
+    static SleepingData longSleep = { 'W', 3 * COMMANDS_TIMER_WHEEL_SLOTS + 2 };
+    static Service shortSleeper = { "short", NULL, SleepingServiceRun, Starting, &shortSleep, 1, 1 };
+    static Service longSleeper = { "long", NULL, SleepingServiceRun, Starting, &longSleep, 1, 1 };
+    static Service awake = { "awake", NULL, RecordingServiceRun, Starting, "A", 1, 1 };
+    ServiceEntry* services[] = { &shortSleeper, &longSleeper, &awake, NULL };
+    CommandEngine serviceEngine = {
+        .CommandBuffer = serviceBuffer, .CommandBufferSize = sizeof(serviceBuffer),
+        .RegisteredCommands = registeredCommands, .RegisteredApplications = noApplications,
+        .RegisteredServices = services, .GetTicks = GetTestTicks
+    };
+    const unsigned long start = 1000;
+
+    ticks = start;
+    ClearServiceRuns();
+    RunServicePasses(&serviceEngine, 4);
+    CHECK(strcmp(serviceRuns, "SWAA") == 0);
+    CHECK(IsServiceSleeping(&serviceEngine, 0) && IsServiceSleeping(&serviceEngine, 1));
+    CHECK(!IsServiceSleeping(&serviceEngine, 2));
+
+    // Not a tick early
+    ticks = start + shortSleep.Ticks - 1;
+    ClearServiceRuns();
+    RunServicePasses(&serviceEngine, 3);
+    CHECK(strcmp(serviceRuns, "AAA") == 0);
+
+    ticks = start + shortSleep.Ticks;
+    ClearServiceRuns();
+    RunServicePasses(&serviceEngine, 3);
+    CHECK(strcmp(serviceRuns, "SAA") == 0);
+
+    // Passing its slot before its deadline does not wake a service
+    ClearServiceRuns();
+    for(ticks = start + shortSleep.Ticks + 1; ticks < start + longSleep.Ticks; ++ticks)
+    {
+        RunServicePasses(&serviceEngine, 2);
+    }
+    CHECK(strchr(serviceRuns, 'W') == NULL);
+    CHECK(strchr(serviceRuns, 'S') != NULL);
+
+    ClearServiceRuns();
+    RunServicePasses(&serviceEngine, 3);
+    CHECK(strchr(serviceRuns, 'W') != NULL);
+}
+#endif
+
+#ifdef COMMANDS_ENABLE_MAILBOXES
+static Message consumerMessages[4];
+static Mailbox consumerMailbox = { "consumer", consumerMessages, 4 };
+static Message monitorMessages[4];
+static Mailbox monitorMailbox = { "monitor", monitorMessages, 4 };
+static unsigned long consumed;
+
+// Takes every message of its mailbox, then waits for the next ones
+static byte ConsumingServiceRun(byte state, void* data, struct CommandEngine* commandEngine)
+{
+    Message message = 0;
+
+    RecordServiceRun(data);
+    while (TakeFromMailbox(&consumerMailbox, &message))
+    {
+        consumed += message;
+    }
+
+    WaitForMessage(commandEngine, &consumerMailbox);
+    return state;
+}
+
+static void TestMailboxes(void)
+{
+    static Service consumer = { "consumer", NULL, ConsumingServiceRun, Starting, "C", 1, 1 };
+    static Service awake = { "awake", NULL, RecordingServiceRun, Starting, "A", 1, 1 };
+    ServiceEntry* services[] = { &consumer, &awake, NULL };
+    Mailbox* subscribers[] = { &consumerMailbox, &monitorMailbox, NULL };
+    Topic topic = { "topic", subscribers };
+    CommandEngine serviceEngine = {
+        .CommandBuffer = serviceBuffer, .CommandBufferSize = sizeof(serviceBuffer),
+        .RegisteredCommands = registeredCommands, .RegisteredApplications = noApplications,
+        .RegisteredServices = services
+    };
+    Message message = 0;
+
+    ClearServiceRuns();
+    RunServicePasses(&serviceEngine, 4);
+    CHECK(strcmp(serviceRuns, "CAAA") == 0);
+    CHECK(IsServiceWaiting(&serviceEngine, 0));
+    CHECK(!IsServiceWaiting(&serviceEngine, 1));
+
+    // Every subscriber gets the message, the waiting service runs once
+    CHECK(PublishToTopic(&topic, 7) == 2);
+    CHECK(!IsServiceWaiting(&serviceEngine, 0));
+    ClearServiceRuns();
+    RunServicePasses(&serviceEngine, 3);
+    CHECK(strcmp(serviceRuns, "CAA") == 0);
+    CHECK(consumed == 7);
+    CHECK(IsServiceWaiting(&serviceEngine, 0));
+    CHECK(GetMailboxDepth(&monitorMailbox) == 1);
+
+    CHECK(PostToMailbox(&consumerMailbox, 1));
+    CHECK(PostToMailbox(&consumerMailbox, 2));
+    ClearServiceRuns();
+    RunServicePasses(&serviceEngine, 2);
+    CHECK(strcmp(serviceRuns, "CA") == 0);
+    CHECK(consumed == 10);
+
+    // A full mailbox drops and counts the message
+    CHECK(PostToMailbox(&monitorMailbox, 8));
+    CHECK(PostToMailbox(&monitorMailbox, 9));
+    CHECK(PostToMailbox(&monitorMailbox, 10));
+    CHECK(!PostToMailbox(&monitorMailbox, 11));
+    CHECK(monitorMailbox.Dropped == 1);
+    CHECK(PublishToTopic(&topic, 12) == 1);
+    CHECK(TakeFromMailbox(&monitorMailbox, &message) && message == 7);
+    CHECK(GetMailboxDepth(&monitorMailbox) == 3);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Registries
+////////////////////////////////////////////////////////////////////////////////
+
+// Runs three times, then stops
+static byte CountingServiceRun(byte state, void* data, struct CommandEngine* commandEngine)
+{
+    RecordServiceRun(data);
+    return state < 2 ? state + 1 : Stopped;
+}
+
+static ServiceEntry countingService = { "counting", NULL, CountingServiceRun, Starting, "C", 1, 1 };
+static ServiceEntry otherService = { "other", NULL, RecordingServiceRun, Starting, "O", 1, 1 };
+
+#define REGISTRY_COMMANDS(X) X(ArgsCommand) X(LinesCommand)
+#define REGISTRY_SERVICES(X) X(countingService) X(otherService)
+
+COMMANDS_REGISTRY(generated, REGISTRY_COMMANDS, COMMANDS_REGISTRY_NONE, REGISTRY_SERVICES)
+
+static unsigned short CountServiceRuns(char letter)
+{
+    unsigned short count = 0;
+    const char* run = serviceRuns;
+
+    for(; *run != '\0'; ++run)
+    {
+        count += *run == letter;
+    }
+
+    return count;
+}
+
+static void TestRegistries(void)
+{
+    CommandEngine generatedEngine = {
+        .CommandBuffer = serviceBuffer, .CommandBufferSize = sizeof(serviceBuffer),
+        COMMANDS_REGISTRY_ENGINE(generated), .WriteToOutput = CaptureOutput,
+        .WriteError = CaptureOutput, .Prompt = "> "
+    };
+
+    CHECK(generatedCommandCount == 2);
+    CHECK(generatedApplicationCount == 0);
+    CHECK(generatedServiceCount == 2);
+
+    ClearServiceRuns();
+    StartEngine(&generatedEngine);
+    RunServicePasses(&generatedEngine, 8);
+    CHECK(CountServiceRuns('C') == 3);
+    CHECK(GetServiceState(&generatedEngine, 0) == Stopped);
+    CHECK(GetServiceState(&generatedEngine, 1) == Starting);
+
+    Type(&generatedEngine, "lines\r");
+    CHECK(strstr(output, "gamma") != NULL);
+    ClearOutput();
+
+#ifdef COMMANDS_CONST_REGISTRIES
+    // The registered states are only the initial ones, each engine keeps its
+    // own, and the counts come with the registries
+    CommandEngine secondEngine = {
+        .CommandBuffer = buffer, .CommandBufferSize = sizeof(buffer),
+        COMMANDS_REGISTRY_ENGINE(generated)
+    };
+
+    CHECK(countingService.State == Starting);
+    CHECK(generatedEngine.RegisteredServiceCount == 2);
+    CHECK(generatedEngine.ServiceCount == 2);
+
+    ClearServiceRuns();
+    RunServicePasses(&secondEngine, 8);
+    CHECK(CountServiceRuns('C') == 3);
+    CHECK(GetServiceState(&secondEngine, 0) == Stopped);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Idle
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned idleCalls;
+static unsigned long lastIdleTicks;
+static unsigned long cycles;
+
+static unsigned long GetTestCycles(void)
+{
+    return cycles;
+}
+
+// Sleeps until the first service wakes, which takes 300 cycles
+static void RecordIdle(unsigned long idleTicks, struct CommandEngine* commandEngine)
+{
+    ++idleCalls;
+    lastIdleTicks = idleTicks;
+    cycles += 300;
+#if COMMANDS_TIMER_WHEEL_SLOTS > 0
+    if (idleTicks != IDLE_FOREVER)
+    {
+        ticks += idleTicks;
+    }
+#endif
+}
+
+#if COMMANDS_TIMER_WHEEL_SLOTS > 0
+static unsigned busyRuns;
+
+// Takes 100 cycles, then sleeps for 10 ticks
+static byte BusyServiceRun(byte state, void* data, struct CommandEngine* commandEngine)
+{
+    ++busyRuns;
+    cycles += 100;
+    SleepService(commandEngine, 10);
+    return state;
+}
+#endif
+
+static void TestIdle(void)
+{
+    static byte idleBuffer[TEST_BUFFER_SIZE];
+    CommandEngine idleEngine = {
+        .CommandBuffer = idleBuffer, .CommandBufferSize = sizeof(idleBuffer),
+        .RegisteredCommands = registeredCommands, .RegisteredApplications = noApplications,
+        .RegisteredServices = noServices, .WriteToOutput = CaptureOutput,
+        .WriteError = CaptureOutput, .Prompt = "> ", .OnIdle = RecordIdle,
+        .GetCycles = GetTestCycles
+    };
+    unsigned i = 0;
+
+    cycles = 0;
+    StartEngine(&idleEngine);
+
+    // Without services nothing wakes the engine but an interrupt
+    idleCalls = 0;
+    for(i = 0; i < 8; ++i)
+    {
+        DoTasks(&idleEngine);
+    }
+    CHECK(idleCalls > 0);
+    CHECK(lastIdleTicks == IDLE_FOREVER);
+    CHECK(IsEngineIdle(&idleEngine));
+
+    // A line to parse is work
+    AddKeystroke(&idleEngine, '\r');
+    CHECK(!IsEngineIdle(&idleEngine));
+    RunUntilIdle(&idleEngine);
+    CHECK(IsEngineIdle(&idleEngine));
+#ifdef COMMANDS_ENABLE_STATISTICS
+    CHECK(GetDutyCycle(&idleEngine) == 0);
+#endif
+
+#if COMMANDS_TIMER_WHEEL_SLOTS > 0
+    // OnIdle is given the ticks until the service wakes, and each run of the
+    // service takes a quarter of the cycles
+    static Service busy = { "busy", NULL, BusyServiceRun, Starting, NULL, 1, 1 };
+    ServiceEntry* services[] = { &busy, NULL };
+    CommandEngine serviceEngine = {
+        .CommandBuffer = serviceBuffer, .CommandBufferSize = sizeof(serviceBuffer),
+        .RegisteredCommands = registeredCommands, .RegisteredApplications = noApplications,
+        .RegisteredServices = services, .GetTicks = GetTestTicks, .OnIdle = RecordIdle,
+        .GetCycles = GetTestCycles
+    };
+
+    ticks = 5000;
+    cycles = 0;
+    idleCalls = 0;
+    busyRuns = 0;
+    while (idleCalls < 10)
+    {
+        DoTasks(&serviceEngine);
+    }
+    CHECK(busyRuns == 10);
+    CHECK(lastIdleTicks == 10);
+    CHECK(ticks == 5100);
+#ifdef COMMANDS_ENABLE_STATISTICS
+    CHECK(serviceEngine.IdleStatistics.Invocations == 10);
+    CHECK(GetDutyCycle(&serviceEngine) == 25);
+#endif
+#endif
+}
+
+// DoTasksUntilIdle runs no more than its budget of steps, and stops early
+// once only services are left
+static void TestStepBudget(void)
+{
+    static Service counted = { "counted", NULL, RecordingServiceRun, Starting, "C", 1, 1 };
+    ServiceEntry* services[] = { &counted, NULL };
+    CommandEngine budgetEngine = {
+        .CommandBuffer = serviceBuffer, .CommandBufferSize = sizeof(serviceBuffer),
+        .RegisteredCommands = registeredCommands, .RegisteredApplications = noApplications,
+        .RegisteredServices = services, .WriteToOutput = CaptureOutput,
+        .WriteError = CaptureOutput, .Prompt = "> "
+    };
+    const char* line = "lines\r";
+    CommandEngineStatus status = InitializeStatus;
+    unsigned calls = 0;
+    unsigned overspent = 0;
+
+    StartEngine(&budgetEngine);
+
+    // Idle, a single loop pass is taken
+    ClearServiceRuns();
+    CHECK(!DoTasksUntilIdle(&budgetEngine, TEST_STEPS));
+    CHECK(serviceRunCount == 1);
+
+    for(; *line != '\0'; ++line)
+    {
+        AddKeystroke(&budgetEngine, *line);
+    }
+
+    // Without a budget nothing runs
+    status = budgetEngine.Status;
+    CHECK(DoTasksUntilIdle(&budgetEngine, 0));
+    CHECK(budgetEngine.Status == status);
+
+    // A step at a time, each giving a service one slot at most, until the
+    // line has run
+    ClearServiceRuns();
+    while (DoTasksUntilIdle(&budgetEngine, 1))
+    {
+        ++calls;
+        overspent += serviceRunCount > calls;
+    }
+    CHECK(overspent == 0);
+    CHECK(calls > 1);
+    CHECK(strstr(output, "gamma") != NULL);
+    CHECK(strcmp(&output[outputLength - 2], "> ") == 0);
+    ClearOutput();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Jobs
+////////////////////////////////////////////////////////////////////////////////
+
+#if COMMANDS_MAX_JOBS > 0
+static void TestJobs(void)
+{
+    char ctrlZ[2] = { CTRL_Z_ASCII, '\0' };
+    unsigned runs = 0;
+    unsigned closes = tickerCloses;
+
+    // What a job writes is tagged with its number
+    ClearOutput();
+    Type(&terminalEngine, "ticker &\r");
+    CHECK(GetJob(&terminalEngine, 1) == &TickerApplication);
+    CHECK(terminalEngine.RunningApplication == NULL);
+    CHECK(strstr(output, "[1] ticker" CMD_CRLF "[1] started" CMD_CRLF "> ") != NULL);
+
+    // It runs in the background while the terminal takes other lines
+    runs = tickerRuns;
+    ClearOutput();
+    Type(&terminalEngine, "jobs\r");
+    CHECK(tickerRuns > runs);
+    CHECK(strstr(output, "[1] ") != NULL && strstr(output, "ticker") != NULL);
+
+    ClearOutput();
+    Type(&terminalEngine, "ticker &\r");
+    CHECK(strstr(output, "Already running as a job") != NULL);
+
+    // In the foreground it takes the terminal until Ctrl-Z sends it back
+    Type(&terminalEngine, "fg 1\r");
+    CHECK(terminalEngine.RunningApplication == &TickerApplication);
+    CHECK(GetJob(&terminalEngine, 1) == NULL);
+    runs = tickerRuns;
+    RunUntilIdle(&terminalEngine);
+    CHECK(tickerRuns > runs);
+
+    Type(&terminalEngine, ctrlZ);
+    CHECK(terminalEngine.RunningApplication == NULL);
+    CHECK(GetJob(&terminalEngine, 1) == &TickerApplication);
+
+    ClearOutput();
+    Type(&terminalEngine, "kill 1\r");
+    CHECK(strstr(output, "[1] Killed ticker" CMD_CRLF) != NULL);
+    CHECK(tickerCloses == closes + 1);
+    CHECK(GetJob(&terminalEngine, 1) == NULL);
+
+    runs = tickerRuns;
+    ClearOutput();
+    Type(&terminalEngine, "jobs\r");
+    CHECK(tickerRuns == runs);
+    CHECK(strstr(output, "No jobs are running.") != NULL);
+
+    ClearOutput();
+    Type(&terminalEngine, "kill 1\r");
+    CHECK(strstr(output, "No such job.") != NULL);
+    ClearOutput();
+    Type(&terminalEngine, "fg 2\r");
+    CHECK(strstr(output, "No such job.") != NULL);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Input ring
+////////////////////////////////////////////////////////////////////////////////
+
+#if COMMANDS_INPUT_BUFFER_SIZE > 0
+static unsigned short CountInOutput(const char* text)
+{
+    unsigned short count = 0;
+    const char* found = output;
+
+    while ((found = strstr(found, text)) != NULL)
+    {
+        ++count;
+        ++found;
+    }
+
+    return count;
+}
+
+static void TestInputRing(void)
+{
+    byte keystrokes[COMMANDS_INPUT_BUFFER_SIZE + 2];
+    unsigned short i = 0;
+
+    // Keystrokes past a full ring are dropped and counted, and reported once
+    ClearOutput();
+    for(i = 0; i < COMMANDS_INPUT_BUFFER_SIZE + 2; ++i)
+    {
+        AddKeystroke(&terminalEngine, 'x');
+    }
+    CHECK(terminalEngine.InputOverruns == 2);
+    RunUntilIdle(&terminalEngine);
+    CHECK(CountInOutput("Input overrun!") == 1);
+    CHECK(CountInOutput("x") == COMMANDS_INPUT_BUFFER_SIZE);
+
+    AddKeystroke(&terminalEngine, '\r');
+    RunUntilIdle(&terminalEngine);
+    ClearOutput();
+    Type(&terminalEngine, "\r");
+    CHECK(CountInOutput("Input overrun!") == 0);
+
+    // AddKeystrokes takes what fits, without counting the rest
+    memset(keystrokes, 'x', sizeof(keystrokes));
+    CHECK(AddKeystrokes(&terminalEngine, keystrokes, sizeof(keystrokes)) == COMMANDS_INPUT_BUFFER_SIZE);
+    CHECK(AddKeystrokes(&terminalEngine, keystrokes, sizeof(keystrokes)) == 0);
+    CHECK(terminalEngine.InputOverruns == 2);
+    ClearOutput();
+    RunUntilIdle(&terminalEngine);
+    CHECK(CountInOutput("x") == COMMANDS_INPUT_BUFFER_SIZE);
+    CHECK(CountInOutput("Input overrun!") == 0);
+
+    Type(&terminalEngine, "\r");
+    ClearOutput();
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Output ring
+////////////////////////////////////////////////////////////////////////////////
+
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+static void TestOutputRing(void)
+{
+    unsigned short queued = 0;
+    unsigned short largest = 0;
+    unsigned writes = 0;
+    unsigned otherWrites = 0;
+
+    Type(&terminalEngine, "flood");
+    AddKeystroke(&terminalEngine, '\r');
+    while (terminalEngine.Status != ExecuteCommandStatus)
+    {
+        DoTasks(&terminalEngine);
+    }
+
+    // The writer is only called once the ring is full, the rest of the
+    // output and the prompt wait in the ring
+    FlushOutput(&terminalEngine);
+    ClearOutput();
+    DoTasks(&terminalEngine);
+    queued = terminalEngine.OutputCount;
+    CHECK(queued > 0);
+    CHECK(outputLength + queued == 3 * (COMMANDS_OUTPUT_BUFFER_SIZE / 2) + strlen("> "));
+
+    // Then it is written from WriteStatus, a chunk per step
+    while (terminalEngine.OutputCount > 0)
+    {
+        CommandEngineStatus status = terminalEngine.Status;
+        unsigned short before = outputLength;
+
+        DoTasks(&terminalEngine);
+        if (outputLength != before)
+        {
+            writes += status == WriteStatus;
+            otherWrites += status != WriteStatus;
+            largest = outputLength - before > largest ? outputLength - before : largest;
+        }
+    }
+    CHECK(otherWrites == 0);
+    CHECK(largest <= COMMANDS_OUTPUT_CHUNK_SIZE);
+    CHECK(writes >= (queued + COMMANDS_OUTPUT_CHUNK_SIZE - 1) / COMMANDS_OUTPUT_CHUNK_SIZE);
+
+    RunUntilIdle(&terminalEngine);
+    CHECK(strcmp(&output[outputLength - 2], "> ") == 0);
+
+    // FlushOutput writes what is queued right away
+    ClearOutput();
+    WriteOutput(&terminalEngine, "queued");
+    CHECK(outputLength == 0);
+    FlushOutput(&terminalEngine);
+    CHECK(strcmp(output, "queued") == 0);
+    CHECK(terminalEngine.OutputCount == 0);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Output cache
+////////////////////////////////////////////////////////////////////////////////
+
+#if COMMANDS_OUTPUT_CACHE_SIZE > 0
+static void TestOutputCache(void)
+{
+    char first[64];
+
+    // Rendered on the first call, then replayed the same without running
+    renders = 0;
+    ClearOutput();
+    Type(&terminalEngine, "cached\r");
+    CHECK(renders == 1);
+    CHECK(strstr(output, "rendered once") != NULL);
+    CHECK(outputLength < sizeof(first));
+    strcpy(first, output);
+
+    ClearOutput();
+    Type(&terminalEngine, "cached\r");
+    CHECK(renders == 1);
+    CHECK(strcmp(output, first) == 0);
+
+    // A call with arguments always runs
+    ClearOutput();
+    Type(&terminalEngine, "cached twice\r");
+    CHECK(renders == 2);
+    CHECK(strstr(output, "rendered twice") != NULL);
+
+    // Rendered again once invalidated
+    InvalidateOutputCache(&terminalEngine, &CachedCommand);
+    Type(&terminalEngine, "cached\r");
+    Type(&terminalEngine, "cached\r");
+    CHECK(renders == 3);
+
+    // Output with an error is never cached, and the other outputs stay
+    ClearOutput();
+    Type(&terminalEngine, "cachedfail\r");
+    Type(&terminalEngine, "cachedfail\r");
+    CHECK(renders == 5);
+    CHECK(strstr(output, "failed") != NULL);
+    Type(&terminalEngine, "cached\r");
+    CHECK(renders == 5);
+
+    // All of them at once
+    InvalidateOutputCache(&terminalEngine, NULL);
+    ClearOutput();
+    Type(&terminalEngine, "cached\r");
+    CHECK(renders == 6);
+    CHECK(strcmp(output, first) == 0);
+    ClearOutput();
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Multiplexer
+////////////////////////////////////////////////////////////////////////////////
+
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+static void TestMultiplexer(void)
+{
+    static byte sessionBuffer[TEST_BUFFER_SIZE];
+    CommandEngine session = {
+        .CommandBuffer = sessionBuffer, .CommandBufferSize = sizeof(sessionBuffer),
+        .RegisteredCommands = registeredCommands, .RegisteredApplications = noApplications,
+        .RegisteredServices = noServices, .Prompt = "> "
+    };
+    CommandEngine* sessions[] = { &session, NULL };
+    CommandMultiplexer multiplexer = { sessions, CaptureData };
+    char expected[3 * (COMMANDS_OUTPUT_BUFFER_SIZE / 2) + 1];
+    const char * keystrokes = " flood\r";
+    unsigned short i = 0;
+
+    for(i = 0; i < sizeof(expected) - 1; ++i)
+    {
+        expected[i] = 'a' + i % (COMMANDS_OUTPUT_BUFFER_SIZE / 2) % 26;
+    }
+    expected[sizeof(expected) - 1] = '\0';
+
+    ClearOutput();
+    for(; *keystrokes != '\0'; ++keystrokes)
+    {
+        AddMultiplexedKeystroke(&multiplexer, *keystrokes);
+    }
+
+    // The session never writes, all of its output is taken with ReadOutput
+    for(i = 0; i < 16 * TEST_STEPS; ++i)
+    {
+        DoMultiplexerTasks(&multiplexer);
+    }
+
+    CHECK(session.OutputStalls > 0);
+    CHECK(session.OutputDropped == 0);
+    CHECK(session.OutputCount == 0 && session.SpillCount == 0);
+    CHECK(strstr(output, expected) != NULL);
+    CHECK(strcmp(&output[outputLength - 2], "> ") == 0);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Scripts
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef COMMANDS_ENABLE_SCRIPTS
+
+// Gives the script in chunks of the given size, as a transport would
+static byte RunWholeScript(CommandEngine* commandEngine, const char* script, unsigned short chunk,
+    byte continueOnError, byte* statuses, unsigned short statusSize, ScriptSummary* summary)
+{
+    unsigned short length = strlen(script);
+    unsigned short position = 0;
+
+    CHECK(StartScript(commandEngine, continueOnError, statuses, statusSize));
+
+    while (position < length)
+    {
+        unsigned short size = length - position < chunk ? length - position : chunk;
+        unsigned short taken = RunScript(commandEngine, &script[position], size);
+
+        position += taken;
+        if (taken < size)
+        {
+            DoTasks(commandEngine);
+        }
+    }
+
+    while (RunScript(commandEngine, NULL, 0) == 0)
+    {
+        DoTasks(commandEngine);
+    }
+
+    return EndScript(commandEngine, summary);
+}
+
+static void TestScripts(void)
+{
+    byte statuses[8];
+    ScriptSummary summary;
+
+    memset(statuses, 0xEE, sizeof(statuses));
+    CHECK(!RunWholeScript(&terminalEngine, "args a\nbogus\n\nfail\nargs b", 3, 1,
+        statuses, sizeof(statuses), &summary));
+    CHECK(summary.Lines == 5);
+    CHECK(summary.Failed == 2);
+    CHECK(summary.FirstFailed == 2);
+    CHECK(statuses[0] == ScriptLineOk);
+    CHECK(statuses[1] == ScriptLineNotFound);
+    CHECK(statuses[2] == ScriptLineOk);
+    CHECK(statuses[3] == ScriptLineError);
+    CHECK(statuses[4] == ScriptLineOk);
+    CHECK(statuses[5] == 0xEE);
+    CHECK(strcmp(lastArguments[0], "b") == 0);
+
+    // Without continueOnError, the first failure ends the script
+    unsigned runs = argsRuns;
+    CHECK(!RunWholeScript(&terminalEngine, "args c\r\nfail\r\nargs d\r\n", 64, 0,
+        statuses, sizeof(statuses), &summary));
+    CHECK(summary.Failed == 1);
+    CHECK(summary.FirstFailed == 2);
+    CHECK(argsRuns == runs + 1);
+    CHECK(strcmp(lastArguments[0], "c") == 0);
+
+    CHECK(RunWholeScript(&terminalEngine, "args e\nargs f\n", 1, 0, NULL, 0, &summary));
+    CHECK(summary.Lines == 2);
+    CHECK(summary.Failed == 0);
+    CHECK(strcmp(lastArguments[0], "f") == 0);
+
+#if COMMANDS_COMPLETION_SIZE > 0
+    // Scripts give whole names
+    CHECK(!RunWholeScript(&terminalEngine, "ar h\n", 64, 0, statuses, sizeof(statuses), &summary));
+    CHECK(statuses[0] == ScriptLineNotFound);
+#endif
+
+    // Keystrokes are taken again once the script ended
+    Type(&terminalEngine, "args g\r");
+    CHECK(strcmp(lastArguments[0], "g") == 0);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(void)
+{
+    StartEngine(&terminalEngine);
+
+    TestTokenizer();
+    TestBackspace();
+    TestDispatch();
+#ifdef COMMANDS_ENABLE_QUOTES
+    TestQuotes();
+#endif
+#ifdef COMMANDS_ENABLE_TYPED_ARGUMENTS
+    TestTypedArguments();
+#endif
+#if COMMANDS_PIPE_BUFFER_SIZE > 0
+    TestPipes();
+#endif
+#if COMMANDS_COMPLETION_SIZE > 0
+    TestCompletion();
+#endif
+#ifdef COMMANDS_ENABLE_SCRIPTS
+    TestScripts();
+#endif
+#if COMMANDS_FRAME_PAYLOAD_SIZE > 0
+    TestFrames();
+#endif
+    TestScheduling();
+#if COMMANDS_TIMER_WHEEL_SLOTS > 0
+    TestSleepingServices();
+#endif
+#ifdef COMMANDS_ENABLE_MAILBOXES
+    TestMailboxes();
+#endif
+    TestRegistries();
+    TestIdle();
+    TestStepBudget();
+#if COMMANDS_MAX_JOBS > 0
+    TestJobs();
+#endif
+#if COMMANDS_INPUT_BUFFER_SIZE > 0
+    TestInputRing();
+#endif
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+    TestOutputRing();
+#endif
+#if COMMANDS_OUTPUT_CACHE_SIZE > 0
+    TestOutputCache();
+#endif
+#if COMMANDS_OUTPUT_BUFFER_SIZE > 0
+    TestMultiplexer();
+#endif
+
+    printf("%u checks, %u failed\n", checks, failures);
+    return failures != 0;
+}
@@ -0,0 +1,328 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Load generator of commands_server. Opens sessions in steps, up to the
+// given number, and keeps one "add" command in flight on each of them. Each
+// step reports the commands per second, the latency from sending a command
+// to its prompt, and the results that did not add up.
+//
+//   commands_load [-s socket] [-n sessions] [-d seconds per step]
+
+////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////
+
+#define LOAD_SOCKET_PATH "/tmp/commands.sock"
+#define LOAD_SESSIONS 256
+#define LOAD_SECONDS 2
+#define LOAD_BUFFER_SIZE 512
+#define LOAD_EVENTS 64
+#define LOAD_PROMPT "> "
+
+typedef struct Client {
+    int Socket;
+    // Until the intro and the first prompt were received
+    int Started;
+    long Expected;
+    double SentAt;
+    char Received[LOAD_BUFFER_SIZE];
+    unsigned Length;
+} Client;
+
+typedef struct Step {
+    double* Samples;
+    unsigned long Count;
+    unsigned long Capacity;
+    unsigned long Wrong;
+} Step;
+
+////////////////////////////////////////////////////////////////////////////////
+// Measurement
+////////////////////////////////////////////////////////////////////////////////
+
+static double ReadSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int CompareSamples(const void* a, const void* b)
+{
+    double left = *(const double*)a;
+    double right = *(const double*)b;
+
+    return left < right ? -1 : left > right;
+}
+
+static void AddSample(Step* step, double latency)
+{
+    if (step->Count == step->Capacity)
+    {
+        step->Capacity = step->Capacity == 0 ? 4096 : step->Capacity * 2;
+        step->Samples = realloc(step->Samples, step->Capacity * sizeof(double));
+    }
+
+    step->Samples[step->Count] = latency;
+    ++step->Count;
+}
+
+static void WriteStep(unsigned sessions, Step* step, double elapsed)
+{
+    if (step->Count == 0)
+    {
+        printf("%8u %14s\n", sessions, "no commands");
+        return;
+    }
+
+    qsort(step->Samples, step->Count, sizeof(double), CompareSamples);
+
+    printf("%8u %14.0f %10.1f %10.1f %10.1f %10.1f %8lu\n",
+        sessions,
+        step->Count / elapsed,
+        step->Samples[step->Count / 2] * 1e6,
+        step->Samples[step->Count * 99 / 100] * 1e6,
+        step->Samples[step->Count * 999 / 1000] * 1e6,
+        step->Samples[step->Count - 1] * 1e6,
+        step->Wrong);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Clients
+////////////////////////////////////////////////////////////////////////////////
+
+static void SendCommand(Client* client)
+{
+    char line[64];
+    long a = rand() % 1000;
+    long b = rand() % 1000 - 500;
+    long c = rand() % 100000;
+    int length = snprintf(line, sizeof(line), "add %ld %ld %ld\r", a, b, c);
+
+    client->Expected = a + b + c;
+    client->Length = 0;
+    client->SentAt = ReadSeconds();
+
+    // A short line always fits in an idle socket
+    if (send(client->Socket, line, length, MSG_NOSIGNAL) != length)
+    {
+        fprintf(stderr, "Cannot send: %s\n", strerror(errno));
+        exit(1);
+    }
+}
+
+static int OpenClient(Client* client, const char* path, int epoll)
+{
+    struct sockaddr_un address;
+    struct epoll_event event;
+
+    memset(client, 0, sizeof(Client));
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+    client->Socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (client->Socket < 0
+            || connect(client->Socket, (struct sockaddr*)&address, sizeof(address)) < 0)
+    {
+        return 0;
+    }
+
+    event.events = EPOLLIN;
+    event.data.ptr = client;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, client->Socket, &event);
+
+    // The first keystroke only brings up the intro and the prompt
+    send(client->Socket, "\r", 1, MSG_NOSIGNAL);
+
+    return 1;
+}
+
+// Returns 1 when the prompt after the result of the last command arrived.
+// Without a step to record it in, waits for the data.
+static int ReadClient(Client* client, Step* step)
+{
+    ssize_t length = recv(client->Socket, &client->Received[client->Length],
+        LOAD_BUFFER_SIZE - 1 - client->Length, step != NULL ? MSG_DONTWAIT : 0);
+
+    if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return 0;
+    }
+
+    if (length <= 0)
+    {
+        fprintf(stderr, "Session closed by the server\n");
+        exit(1);
+    }
+
+    client->Length += length;
+    client->Received[client->Length] = '\0';
+
+    unsigned promptLength = sizeof(LOAD_PROMPT) - 1;
+    if (client->Length < promptLength
+            || strcmp(&client->Received[client->Length - promptLength], LOAD_PROMPT) != 0)
+    {
+        if (client->Length == LOAD_BUFFER_SIZE - 1)
+        {
+            // Keeps the end, where the result and the prompt are
+            memmove(client->Received, &client->Received[LOAD_BUFFER_SIZE / 2], LOAD_BUFFER_SIZE / 2);
+            client->Length = LOAD_BUFFER_SIZE / 2 - 1;
+        }
+
+        return 0;
+    }
+
+    if (!client->Started)
+    {
+        client->Started = 1;
+        return 1;
+    }
+
+    const char * result = strstr(client->Received, "= ");
+    if (step != NULL)
+    {
+        AddSample(step, ReadSeconds() - client->SentAt);
+        if (result == NULL || strtol(result + 2, NULL, 10) != client->Expected)
+        {
+            ++step->Wrong;
+        }
+    }
+
+    return 1;
+}
+
+// Keeps a command in flight on every client for the given time, and
+// returns the seconds measured
+static double RunStep(Client* clients, unsigned count, int epoll, double seconds, Step* step)
+{
+    struct epoll_event events[LOAD_EVENTS];
+    double start = ReadSeconds();
+    double end = start + seconds;
+    double now = start;
+    unsigned i = 0;
+
+    for(i = 0; i < count; ++i)
+    {
+        SendCommand(&clients[i]);
+    }
+
+    while (now < end)
+    {
+        int ready = epoll_wait(epoll, events, LOAD_EVENTS, 100);
+        int j = 0;
+
+        for(j = 0; j < ready; ++j)
+        {
+            Client * client = (Client*)events[j].data.ptr;
+            if (ReadClient(client, step))
+            {
+                SendCommand(client);
+            }
+        }
+
+        now = ReadSeconds();
+    }
+
+    // Drains the commands still in flight, unmeasured
+    for(i = 0; i < count; ++i)
+    {
+        while (!ReadClient(&clients[i], NULL))
+        {
+        }
+    }
+
+    return now - start;
+}
+
+int main(int argc, char* argv[])
+{
+    const char * path = LOAD_SOCKET_PATH;
+    unsigned maxSessions = LOAD_SESSIONS;
+    double seconds = LOAD_SECONDS;
+    unsigned opened = 0;
+    unsigned sessions = 0;
+    int i = 0;
+
+    for(i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-s") == 0)
+        {
+            path = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "-n") == 0)
+        {
+            maxSessions = (unsigned)atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "-d") == 0)
+        {
+            seconds = atof(argv[i + 1]);
+        }
+    }
+
+    Client * clients = calloc(maxSessions, sizeof(Client));
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (clients == NULL || epoll < 0 || maxSessions == 0)
+    {
+        fprintf(stderr, "Cannot allocate %u sessions.\n", maxSessions);
+        return 1;
+    }
+
+    srand(1);
+
+    printf("%8s %14s %10s %10s %10s %10s %8s\n",
+        "sessions", "commands/s", "p50 us", "p99 us", "p99.9 us", "max us", "wrong");
+
+    for(sessions = 1; ; sessions *= 4)
+    {
+        Step step = { NULL, 0, 0, 0 };
+
+        if (sessions > maxSessions)
+        {
+            sessions = maxSessions;
+        }
+
+        // Sessions stay open from one step to the next
+        for(; opened < sessions; ++opened)
+        {
+            if (!OpenClient(&clients[opened], path, epoll))
+            {
+                fprintf(stderr, "Cannot connect to %s: %s\n", path, strerror(errno));
+                return 1;
+            }
+
+            while (!ReadClient(&clients[opened], NULL))
+            {
+            }
+        }
+
+        double elapsed = RunStep(clients, sessions, epoll, seconds, &step);
+        WriteStep(sessions, &step, elapsed);
+        fflush(stdout);
+
+        free(step.Samples);
+
+        if (sessions == maxSessions)
+        {
+            break;
+        }
+    }
+
+    for(i = 0; i < (int)opened; ++i)
+    {
+        close(clients[i].Socket);
+    }
+
+    free(clients);
+
+    return 0;
+}
@@ -0,0 +1,688 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "commands.h"
+#include "command_clear.h"
+#include "command_help.h"
+#include "command_services.h"
+
+// Serves one engine per connection on a Unix socket, to run many simulated
+// consoles of the firmware on Linux. Each loop thread waits in epoll and
+// calls DoTasks only for the sessions with new input, room for their output
+// or a sleeping service that is due. The others have reported in OnIdle
+// when their next service wakes.
+//
+//   commands_server [-s socket] [-t threads]
+//
+// Connect with 'socat -,raw,echo=0 UNIX-CONNECT:/tmp/commands.sock', or load
+// it with commands_load.
+
+////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////
+
+#define SERVER_SOCKET_PATH "/tmp/commands.sock"
+#define SERVER_MAX_THREADS 16
+#define SERVER_BUFFER_SIZE 64
+#define SERVER_READ_SIZE 256
+#define SERVER_EVENTS 64
+// DoTasks calls a session gets before the next ready one runs
+#define SERVER_STEPS 64
+#define SERVER_HEARTBEAT_TICKS 1000
+
+typedef struct Session {
+    CommandEngine Engine;
+    byte CommandBuffer[SERVER_BUFFER_SIZE];
+    Service Heartbeat;
+    Service* Services[2];
+    struct ServerLoop* Loop;
+    struct Session* Next;
+    struct Session* NextReady;
+    int Socket;
+    unsigned int Events;
+    // Received and not yet taken by AddKeystrokes
+    byte Input[SERVER_READ_SIZE];
+    unsigned short InputStart;
+    unsigned short InputLength;
+    unsigned long WakeAt;
+    // Position in the sleepers heap of the loop, while Sleeping
+    unsigned int SleeperPosition;
+    unsigned long Heartbeats;
+    byte Ready : 1;
+    byte Idle : 1;
+    byte Sleeping : 1;
+    byte OutputBlocked : 1;
+    byte Closing : 1;
+} Session;
+
+typedef struct ServerLoop {
+    pthread_t Thread;
+    int Epoll;
+    int Listener;
+    Session* Sessions;
+    Session* ReadyHead;
+    Session* ReadyTail;
+    // Min-heap of the sleeping sessions by WakeAt
+    Session** Sleepers;
+    unsigned int SleeperCount;
+    unsigned int SleeperCapacity;
+} ServerLoop;
+
+// The engine callbacks have no context, they act on the session being run
+static __thread Session* currentSession;
+
+////////////////////////////////////////////////////////////////////////////////
+// Engine
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned long ReadTicks(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)now.tv_sec * 1000UL + (unsigned long)now.tv_nsec / 1000000UL;
+}
+
+static unsigned short WriteSession(const char* data, unsigned short length)
+{
+    Session * session = currentSession;
+    ssize_t written = send(session->Socket, data, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+    if (written < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+        // The output of a closed connection is dropped
+        session->Closing = 1;
+        return length;
+    }
+
+    if (written < 0)
+    {
+        written = 0;
+    }
+
+    if (written < length)
+    {
+        session->OutputBlocked = 1;
+    }
+
+    return (unsigned short)written;
+}
+
+static void AddSleeper(ServerLoop* loop, Session* session);
+static void RemoveSleeper(ServerLoop* loop, Session* session);
+
+static void IdleSession(unsigned long ticks, CommandEngine* commandEngine)
+{
+    Session * session = currentSession;
+
+    if (session->Sleeping)
+    {
+        RemoveSleeper(session->Loop, session);
+    }
+
+    session->Idle = 1;
+    session->WakeAt = ReadTicks() + ticks;
+
+    if (ticks != IDLE_FOREVER)
+    {
+        AddSleeper(session->Loop, session);
+    }
+}
+
+static byte HeartbeatRun(byte state, void* data, CommandEngine* commandEngine)
+{
+    ++((Session*)data)->Heartbeats;
+    SleepService(commandEngine, SERVER_HEARTBEAT_TICKS);
+
+    return state;
+}
+
+// Writes "= <sum>" for the load generator to check
+static byte* AddCommandImplementation(const char* args[], CommandEngine* commandEngine)
+{
+    char number[NUMBER_BUFFER_SIZE];
+    long sum = 0;
+    long value = 0;
+    byte i = 0;
+
+    for(i = 0; i < GetArgumentCount(commandEngine); ++i)
+    {
+        if (!GetIntegerArgument(commandEngine, i, &value))
+        {
+            WriteErrorOutput(commandEngine, CMD_CRLF "Usage: add [integer]..." CMD_CRLF);
+            return (byte*)NULL;
+        }
+
+        sum += value;
+    }
+
+    WriteOutput(commandEngine, sum < 0 ? CMD_CRLF "= -" : CMD_CRLF "= ");
+    WriteOutput(commandEngine, UnsignedToString(sum < 0 ? 0UL - (unsigned long)sum : (unsigned long)sum, number));
+    WriteOutput(commandEngine, CMD_CRLF);
+
+    return (byte*)NULL;
+}
+
+static const Command AddCommand = {
+    "add",
+    AddCommandImplementation,
+    "Adds its arguments."
+};
+
+static const Command* registeredCommands[] = {
+    &HelpCommand,
+    &ClearCommand,
+    &ServicesCommand,
+    &AddCommand,
+    NULL
+};
+
+static Application* registeredApplications[] = {
+    NULL
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Sessions
+////////////////////////////////////////////////////////////////////////////////
+
+static void UpdateEvents(Session* session)
+{
+    unsigned int events = 0;
+    struct epoll_event event;
+
+    // Reading stops while the keystrokes already received are not taken
+    if (session->InputLength < SERVER_READ_SIZE)
+    {
+        events |= EPOLLIN;
+    }
+
+    if (session->OutputBlocked)
+    {
+        events |= EPOLLOUT;
+    }
+
+    if (events == session->Events || session->Closing)
+    {
+        return;
+    }
+
+    event.events = events;
+    event.data.ptr = session;
+    epoll_ctl(session->Loop->Epoll, EPOLL_CTL_MOD, session->Socket, &event);
+    session->Events = events;
+}
+
+static void MakeReady(ServerLoop* loop, Session* session)
+{
+    if (session->Ready)
+    {
+        return;
+    }
+
+    session->Ready = 1;
+    session->NextReady = NULL;
+
+    if (loop->ReadyTail != NULL)
+    {
+        loop->ReadyTail->NextReady = session;
+    }
+    else
+    {
+        loop->ReadyHead = session;
+    }
+
+    loop->ReadyTail = session;
+}
+
+static void OpenSession(ServerLoop* loop, int socket)
+{
+    Session * session = calloc(1, sizeof(Session));
+    struct epoll_event event;
+
+    if (session == NULL)
+    {
+        close(socket);
+        return;
+    }
+
+    session->Heartbeat.Name = "heartbeat";
+    session->Heartbeat.HelpText = "Wakes every second";
+    session->Heartbeat.Run = HeartbeatRun;
+    session->Heartbeat.State = Starting;
+    session->Heartbeat.Data = session;
+    session->Services[0] = &session->Heartbeat;
+    session->Services[1] = NULL;
+
+    // The buffer size is constant, so the engine is initialized and copied
+    CommandEngine engine = { session->CommandBuffer, sizeof(session->CommandBuffer),
+        registeredCommands, registeredApplications, session->Services,
+        NULL, NULL, "> ", CMD_CRLF "Commands server" CMD_CRLF, ReadTicks, NULL, WriteSession,
+        NULL, NULL, IdleSession };
+    memcpy(&session->Engine, &engine, sizeof(CommandEngine));
+
+    session->Loop = loop;
+    session->Socket = socket;
+    session->Events = EPOLLIN;
+
+    event.events = session->Events;
+    event.data.ptr = session;
+    if (epoll_ctl(loop->Epoll, EPOLL_CTL_ADD, socket, &event) < 0)
+    {
+        close(socket);
+        free(session);
+        return;
+    }
+
+    session->Next = loop->Sessions;
+    loop->Sessions = session;
+
+    // Runs until idle, which initializes the engine
+    MakeReady(loop, session);
+}
+
+static void CloseSession(ServerLoop* loop, Session* session)
+{
+    Session ** link = &loop->Sessions;
+
+    while (*link != session)
+    {
+        link = &(*link)->Next;
+    }
+
+    *link = session->Next;
+
+    if (session->Sleeping)
+    {
+        RemoveSleeper(loop, session);
+    }
+
+    close(session->Socket);
+    free(session);
+}
+
+static void AcceptSessions(ServerLoop* loop)
+{
+    for(;;)
+    {
+        int socket = accept4(loop->Listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (socket < 0)
+        {
+            return;
+        }
+
+        OpenSession(loop, socket);
+    }
+}
+
+static void ReadSession(ServerLoop* loop, Session* session)
+{
+    if (session->InputLength == 0)
+    {
+        session->InputStart = 0;
+    }
+    else if (session->InputStart > 0)
+    {
+        memmove(session->Input, &session->Input[session->InputStart], session->InputLength);
+        session->InputStart = 0;
+    }
+
+    ssize_t length = recv(session->Socket, &session->Input[session->InputLength],
+        SERVER_READ_SIZE - session->InputLength, MSG_DONTWAIT);
+
+    if (length == 0 || (length < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+    {
+        session->Closing = 1;
+    }
+    else if (length > 0)
+    {
+        session->InputLength += length;
+    }
+
+    MakeReady(loop, session);
+}
+
+static void HandleEvents(ServerLoop* loop, Session* session, unsigned int events)
+{
+    if (events & EPOLLIN)
+    {
+        ReadSession(loop, session);
+    }
+    else if (events & (EPOLLHUP | EPOLLERR))
+    {
+        session->Closing = 1;
+        MakeReady(loop, session);
+    }
+
+    if (events & EPOLLOUT)
+    {
+        session->OutputBlocked = 0;
+        NotifyOutputReady(&session->Engine);
+        MakeReady(loop, session);
+    }
+}
+
+// Runs the session until it is idle, blocked on its output or has used its
+// steps, and queues it again when it still has work
+static void RunSession(ServerLoop* loop, Session* session)
+{
+    unsigned short steps = 0;
+
+    currentSession = session;
+    session->Idle = 0;
+    if (session->Sleeping)
+    {
+        RemoveSleeper(loop, session);
+    }
+
+    while (steps < SERVER_STEPS && !session->Idle && !session->OutputBlocked && !session->Closing)
+    {
+        if (session->InputLength > 0)
+        {
+            unsigned short taken = AddKeystrokes(&session->Engine,
+                &session->Input[session->InputStart], session->InputLength);
+
+            session->InputStart += taken;
+            session->InputLength -= taken;
+        }
+
+        DoTasks(&session->Engine);
+        ++steps;
+    }
+
+    currentSession = NULL;
+
+    if (session->Closing)
+    {
+        CloseSession(loop, session);
+        return;
+    }
+
+    if (session->InputLength > 0 || (!session->Idle && !session->OutputBlocked))
+    {
+        MakeReady(loop, session);
+    }
+
+    UpdateEvents(session);
+}
+
+static void RunReadySessions(ServerLoop* loop)
+{
+    // Sessions queued again while these run wait for the next pass
+    Session * session = loop->ReadyHead;
+
+    loop->ReadyHead = NULL;
+    loop->ReadyTail = NULL;
+
+    while (session != NULL)
+    {
+        Session * next = session->NextReady;
+
+        session->Ready = 0;
+        RunSession(loop, session);
+        session = next;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Sleeping sessions
+////////////////////////////////////////////////////////////////////////////////
+
+// The sleeping sessions of a loop are kept in a binary min-heap by WakeAt,
+// so that the loop only looks at the ones that are due and the first one
+// after them, however many sessions it serves.
+
+static bool WakesBefore(Session* session, Session* other)
+{
+    return (long)(session->WakeAt - other->WakeAt) < 0;
+}
+
+static void PlaceSleeper(ServerLoop* loop, Session* session, unsigned int position)
+{
+    loop->Sleepers[position] = session;
+    session->SleeperPosition = position;
+}
+
+static void SiftSleeperUp(ServerLoop* loop, Session* session, unsigned int position)
+{
+    while (position > 0 && WakesBefore(session, loop->Sleepers[(position - 1) / 2]))
+    {
+        PlaceSleeper(loop, loop->Sleepers[(position - 1) / 2], position);
+        position = (position - 1) / 2;
+    }
+
+    PlaceSleeper(loop, session, position);
+}
+
+static void SiftSleeperDown(ServerLoop* loop, Session* session, unsigned int position)
+{
+    for(;;)
+    {
+        unsigned int child = position * 2 + 1;
+        if (child >= loop->SleeperCount)
+        {
+            break;
+        }
+
+        if (child + 1 < loop->SleeperCount && WakesBefore(loop->Sleepers[child + 1], loop->Sleepers[child]))
+        {
+            ++child;
+        }
+
+        if (!WakesBefore(loop->Sleepers[child], session))
+        {
+            break;
+        }
+
+        PlaceSleeper(loop, loop->Sleepers[child], position);
+        position = child;
+    }
+
+    PlaceSleeper(loop, session, position);
+}
+
+static void AddSleeper(ServerLoop* loop, Session* session)
+{
+    if (loop->SleeperCount == loop->SleeperCapacity)
+    {
+        unsigned int capacity = loop->SleeperCapacity > 0 ? loop->SleeperCapacity * 2 : SERVER_EVENTS;
+        Session ** sleepers = realloc(loop->Sleepers, capacity * sizeof(Session*));
+
+        if (sleepers == NULL)
+        {
+            // Polled instead, as if it was never idle
+            session->Idle = 0;
+            return;
+        }
+
+        loop->Sleepers = sleepers;
+        loop->SleeperCapacity = capacity;
+    }
+
+    session->Sleeping = 1;
+    ++loop->SleeperCount;
+    SiftSleeperUp(loop, session, loop->SleeperCount - 1);
+}
+
+static void RemoveSleeper(ServerLoop* loop, Session* session)
+{
+    unsigned int position = session->SleeperPosition;
+    Session * last = loop->Sleepers[loop->SleeperCount - 1];
+
+    session->Sleeping = 0;
+    --loop->SleeperCount;
+
+    if (last == session)
+    {
+        return;
+    }
+
+    // The last one takes the place, and moves whichever way its WakeAt says
+    if (position > 0 && WakesBefore(last, loop->Sleepers[(position - 1) / 2]))
+    {
+        SiftSleeperUp(loop, last, position);
+    }
+    else
+    {
+        SiftSleeperDown(loop, last, position);
+    }
+}
+
+// Queues the sessions whose sleeping service is due, and returns the
+// milliseconds until the next one, or -1
+static int WakeSessions(ServerLoop* loop)
+{
+    unsigned long now = ReadTicks();
+
+    while (loop->SleeperCount > 0)
+    {
+        Session * session = loop->Sleepers[0];
+        if ((long)(session->WakeAt - now) > 0)
+        {
+            return (int)(session->WakeAt - now);
+        }
+
+        RemoveSleeper(loop, session);
+        MakeReady(loop, session);
+    }
+
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Event loop
+////////////////////////////////////////////////////////////////////////////////
+
+static void* RunLoop(void* argument)
+{
+    ServerLoop * loop = (ServerLoop*)argument;
+    struct epoll_event events[SERVER_EVENTS];
+
+    for(;;)
+    {
+        int timeout = WakeSessions(loop);
+        if (loop->ReadyHead != NULL)
+        {
+            timeout = 0;
+        }
+
+        int count = epoll_wait(loop->Epoll, events, SERVER_EVENTS, timeout);
+        int i = 0;
+
+        for(i = 0; i < count; ++i)
+        {
+            if (events[i].data.ptr == NULL)
+            {
+                AcceptSessions(loop);
+            }
+            else
+            {
+                HandleEvents(loop, (Session*)events[i].data.ptr, events[i].events);
+            }
+        }
+
+        RunReadySessions(loop);
+    }
+
+    return NULL;
+}
+
+static int OpenListener(const char* path)
+{
+    struct sockaddr_un address;
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (listener < 0 || strlen(path) >= sizeof(address.sun_path))
+    {
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    unlink(path);
+
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) < 0
+            || listen(listener, SOMAXCONN) < 0)
+    {
+        close(listener);
+        return -1;
+    }
+
+    return listener;
+}
+
+int main(int argc, char* argv[])
+{
+    static ServerLoop loops[SERVER_MAX_THREADS];
+    const char * path = SERVER_SOCKET_PATH;
+    unsigned threads = 1;
+    unsigned i = 0;
+    int listener = -1;
+
+    for(i = 1; i + 1 < (unsigned)argc; i += 2)
+    {
+        if (strcmp(argv[i], "-s") == 0)
+        {
+            path = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "-t") == 0)
+        {
+            threads = (unsigned)atoi(argv[i + 1]);
+        }
+    }
+
+    if (threads < 1 || threads > SERVER_MAX_THREADS)
+    {
+        fprintf(stderr, "Threads must be 1 to %d.\n", SERVER_MAX_THREADS);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    listener = OpenListener(path);
+    if (listener < 0)
+    {
+        fprintf(stderr, "Cannot listen on %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    for(i = 0; i < threads; ++i)
+    {
+        struct epoll_event event;
+
+        loops[i].Listener = listener;
+        loops[i].Epoll = epoll_create1(EPOLL_CLOEXEC);
+
+        // One of the waiting loops accepts each connection and keeps it
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        event.data.ptr = NULL;
+        if (loops[i].Epoll < 0 || epoll_ctl(loops[i].Epoll, EPOLL_CTL_ADD, listener, &event) < 0)
+        {
+            fprintf(stderr, "Cannot create the event loop: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+
+    printf("Serving on %s with %u loop threads\n", path, threads);
+    fflush(stdout);
+
+    for(i = 1; i < threads; ++i)
+    {
+        pthread_create(&loops[i].Thread, NULL, RunLoop, &loops[i]);
+    }
+
+    RunLoop(&loops[0]);
+
+    return 0;
+}
@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "commands.h"
+
+// Host decoder of the trace command output. Reads a terminal capture on the
+// standard input, finds the "TRACE <count>" header and the hex records up to
+// "END", then prints the timeline and latency histograms. The times are the
+// low 32 bits of GetCycles, or of GetTicks without it.
+//
+//   commands_trace [-s] < capture.txt
+//
+// -s prints the histograms only.
+
+////////////////////////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////////////////////////
+
+#define TRACE_LINE_SIZE 256
+#define TRACE_RECORD_DIGITS 12
+#define TRACE_BUCKETS 33
+#define TRACE_BAR_WIDTH 40
+
+typedef struct DecodedRecord {
+    unsigned long Time;
+    byte Event;
+    byte Data;
+} DecodedRecord;
+
+typedef struct Histogram {
+    const char * Name;
+    byte StartEvent;
+    byte EndEvent;
+    unsigned long Buckets[TRACE_BUCKETS];
+    unsigned long Count;
+    unsigned long Total;
+    unsigned long Max;
+} Histogram;
+
+////////////////////////////////////////////////////////////////////////////////
+// Decoding
+////////////////////////////////////////////////////////////////////////////////
+
+static int HexValue(char digit)
+{
+    if (digit >= '0' && digit <= '9')
+    {
+        return digit - '0';
+    }
+
+    if (digit >= 'A' && digit <= 'F')
+    {
+        return digit - 'A' + 10;
+    }
+
+    if (digit >= 'a' && digit <= 'f')
+    {
+        return digit - 'a' + 10;
+    }
+
+    return -1;
+}
+
+// Returns the number of records read, from the first TRACE header on
+static unsigned long ReadRecords(FILE* input, DecodedRecord** records)
+{
+    char line[TRACE_LINE_SIZE];
+    char digits[TRACE_RECORD_DIGITS];
+    unsigned long capacity = 0;
+    unsigned long count = 0;
+    byte header = 0;
+    int length = 0;
+
+    *records = NULL;
+
+    while (fgets(line, sizeof(line), input) != NULL)
+    {
+        const char * position = line;
+
+        if (!header)
+        {
+            const char * found = strstr(line, "TRACE ");
+            if (found != NULL)
+            {
+                capacity = strtoul(found + 6, NULL, 10) + 1;
+                *records = malloc(capacity * sizeof(DecodedRecord));
+                header = 1;
+            }
+
+            continue;
+        }
+
+        if (strncmp(line, "END", 3) == 0)
+        {
+            break;
+        }
+
+        for(; *position != '\0'; ++position)
+        {
+            if (HexValue(*position) < 0)
+            {
+                continue;
+            }
+
+            digits[length] = *position;
+            ++length;
+
+            if (length == TRACE_RECORD_DIGITS && count < capacity)
+            {
+                DecodedRecord * record = &(*records)[count];
+                int i = 0;
+
+                record->Time = 0;
+                for(i = 0; i < 8; ++i)
+                {
+                    record->Time = (record->Time << 4) | HexValue(digits[i]);
+                }
+
+                record->Event = (HexValue(digits[8]) << 4) | HexValue(digits[9]);
+                record->Data = (HexValue(digits[10]) << 4) | HexValue(digits[11]);
+
+                ++count;
+                length = 0;
+            }
+        }
+    }
+
+    return count;
+}
+
+// Differences of 32-bit times, across a wrap of the counter
+static unsigned long Elapsed(unsigned long from, unsigned long to)
+{
+    return (to - from) & 0xFFFFFFFFUL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Timeline
+////////////////////////////////////////////////////////////////////////////////
+
+static const char* StateName(byte status)
+{
+    switch (status)
+    {
+        case InitializeStatus: return "Initialize";
+        case ReadyForInputStatus: return "ReadyForInput";
+        case LoopStatus: return "Loop";
+        case WriteStatus: return "Write";
+        case ParseForCommandStatus: return "ParseForCommand";
+        case ExecuteCommandStatus: return "ExecuteCommand";
+        case ExecuteApplicationStatus: return "ExecuteApplication";
+        case ExecuteServicesStatus: return "ExecuteServices";
+        case IdleStatus: return "Idle";
+        default: return "?";
+    }
+}
+
+static void WriteTimeline(const DecodedRecord* records, unsigned long count)
+{
+    unsigned long i = 0;
+
+    printf("%12s %10s  %s\n", "time", "delta", "event");
+
+    for(i = 0; i < count; ++i)
+    {
+        const DecodedRecord * record = &records[i];
+
+        printf("%12lu %10lu  ",
+            Elapsed(records[0].Time, record->Time),
+            i > 0 ? Elapsed(records[i - 1].Time, record->Time) : 0);
+
+        switch (record->Event)
+        {
+            case KeystrokeTrace:
+                if (record->Data > 31 && record->Data < 127)
+                {
+                    printf("keystroke '%c'\n", record->Data);
+                }
+                else
+                {
+                    printf("keystroke 0x%02X\n", record->Data);
+                }
+                break;
+            case StateTrace:
+                printf("state %s\n", StateName(record->Data));
+                break;
+            case CommandStartTrace:
+                printf("command %u start\n", record->Data);
+                break;
+            case CommandEndTrace:
+                printf("command %u end\n", record->Data);
+                break;
+            case ServiceStartTrace:
+                printf("service %u start\n", record->Data);
+                break;
+            case ServiceEndTrace:
+                printf("service %u end\n", record->Data);
+                break;
+            case WriteStartTrace:
+                printf("write %u characters\n", record->Data);
+                break;
+            case WriteEndTrace:
+                printf("write end\n");
+                break;
+            case IdleStartTrace:
+                printf("idle\n");
+                break;
+            case IdleEndTrace:
+                printf("idle end\n");
+                break;
+            default:
+                printf("unknown event 0x%02X\n", record->Event);
+                break;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Histograms
+////////////////////////////////////////////////////////////////////////////////
+
+static void AddSample(Histogram* histogram, unsigned long value)
+{
+    byte bucket = 0;
+
+    while (bucket < TRACE_BUCKETS - 1 && (value >> bucket) > 1)
+    {
+        ++bucket;
+    }
+
+    ++histogram->Buckets[bucket];
+    ++histogram->Count;
+    histogram->Total += value;
+
+    if (value > histogram->Max)
+    {
+        histogram->Max = value;
+    }
+}
+
+// Pairs each start event with the next end event of the same data, e.g. a
+// service, or with the next end event at all when matchData is 0
+static void FillHistogram(Histogram* histogram, const DecodedRecord* records, unsigned long count, byte matchData)
+{
+    unsigned long i = 0;
+    unsigned long j = 0;
+
+    for(i = 0; i < count; ++i)
+    {
+        if (records[i].Event != histogram->StartEvent)
+        {
+            continue;
+        }
+
+        // An Enter keystroke starts the dispatch latency, other keys do not
+        if (histogram->StartEvent == KeystrokeTrace && records[i].Data != RETURN_ASCII)
+        {
+            continue;
+        }
+
+        for(j = i + 1; j < count; ++j)
+        {
+            if (records[j].Event == histogram->StartEvent && histogram->StartEvent != KeystrokeTrace)
+            {
+                if (!matchData || records[j].Data == records[i].Data)
+                {
+                    // Started again before it ended, the trace lost events
+                    break;
+                }
+            }
+
+            if (records[j].Event == histogram->EndEvent
+                    && (!matchData || records[j].Data == records[i].Data))
+            {
+                AddSample(histogram, Elapsed(records[i].Time, records[j].Time));
+                break;
+            }
+        }
+    }
+}
+
+static void WriteHistogram(const Histogram* histogram)
+{
+    unsigned long largest = 0;
+    byte bucket = 0;
+
+    printf("\n%s: %lu samples", histogram->Name, histogram->Count);
+    if (histogram->Count == 0)
+    {
+        printf("\n");
+        return;
+    }
+
+    printf(", mean %lu, max %lu\n", histogram->Total / histogram->Count, histogram->Max);
+
+    for(bucket = 0; bucket < TRACE_BUCKETS; ++bucket)
+    {
+        if (histogram->Buckets[bucket] > largest)
+        {
+            largest = histogram->Buckets[bucket];
+        }
+    }
+
+    for(bucket = 0; bucket < TRACE_BUCKETS; ++bucket)
+    {
+        if (histogram->Buckets[bucket] == 0)
+        {
+            continue;
+        }
+
+        unsigned long low = bucket == 0 ? 0 : 1UL << bucket;
+        unsigned long high = (bucket == TRACE_BUCKETS - 1 ? 0xFFFFFFFFUL : (2UL << bucket) - 1);
+        int width = (int)(histogram->Buckets[bucket] * TRACE_BAR_WIDTH / largest);
+        int i = 0;
+
+        printf("%10lu - %10lu | ", low, high);
+        for(i = 0; i < width || i == 0; ++i)
+        {
+            putchar('#');
+        }
+
+        printf(" %lu\n", histogram->Buckets[bucket]);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Histogram histograms[] = {
+        { "enter to dispatch", KeystrokeTrace, CommandStartTrace },
+        { "command", CommandStartTrace, CommandEndTrace },
+        { "service run", ServiceStartTrace, ServiceEndTrace },
+        { "writer call", WriteStartTrace, WriteEndTrace },
+        { "idle", IdleStartTrace, IdleEndTrace },
+    };
+    byte summary = argc > 1 && strcmp(argv[1], "-s") == 0;
+    DecodedRecord * records = NULL;
+    unsigned long count = ReadRecords(stdin, &records);
+    unsigned i = 0;
+
+    if (records == NULL)
+    {
+        fprintf(stderr, "No TRACE header found.\n");
+        return 1;
+    }
+
+    printf("%lu events\n", count);
+
+    if (!summary)
+    {
+        printf("\n");
+        WriteTimeline(records, count);
+    }
+
+    for(i = 0; i < sizeof(histograms) / sizeof(histograms[0]); ++i)
+    {
+        // Commands and services are told apart by their index
+        byte matchData = histograms[i].StartEvent == CommandStartTrace
+            || histograms[i].StartEvent == ServiceStartTrace;
+
+        FillHistogram(&histograms[i], records, count, matchData);
+        WriteHistogram(&histograms[i]);
+    }
+
+    free(records);
+
+    return 0;
+}